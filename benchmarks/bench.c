@@ -0,0 +1,396 @@
+/*
+ * Copyright Arthur Grillo (c) 2024
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#include <math.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cg_core.h"
+#include "cg_gfx.h"
+#include "cg_math.h"
+#include "cg_time.h"
+#include "cg_util.h"
+
+#include "external/bed.h"
+
+#define SUZZANNE_OBJ "../examples/resources/suzzanne.obj"
+#define SUZZANNE_TEX "../examples/resources/suzzanne_tex.png"
+#define SYNTHETIC_OBJ "synthetic.obj"
+
+#define MATH_BATCH 1024
+
+struct bench {
+	const char *name;
+	void (*setup)(void *arg);
+	void (*run)(void *arg);
+	void (*teardown)(void *arg);
+	void *arg;
+	size_t warmup;
+	size_t iterations;
+};
+
+struct bench_result {
+	const char *name;
+	size_t iterations;
+	uint64_t min_ns;
+	uint64_t median_ns;
+	uint64_t p99_ns;
+	double mean_ns;
+};
+
+struct synthetic_obj {
+	size_t grid_size;
+	size_t num_objects;
+};
+
+struct draw_bench {
+	size_t num_models;
+	struct synthetic_obj obj;
+};
+
+static struct CG_DA(char) synthetic_buf;
+static struct cg_model bench_model;
+
+static volatile float sink;
+
+static uint64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void buf_printf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+static void buf_printf(const char *fmt, ...) {
+	char line[256];
+	va_list ap;
+	va_start(ap, fmt);
+	int len = vsnprintf(line, sizeof(line), fmt, ap);
+	va_end(ap);
+
+	cg_assert(len >= 0 && (size_t)len < sizeof(line));
+	for (int i = 0; i < len; i++)
+		cg_da_append(&synthetic_buf, line[i]);
+}
+
+/*
+ * Writes an OBJ with num_objects objects, each a grid_size x grid_size grid of quads split in
+ * two triangles, with positions, normals and uvs shared between neighbouring quads.
+ */
+static void generate_synthetic_obj(const struct synthetic_obj *obj) {
+	synthetic_buf.len = 0;
+	size_t side = obj->grid_size + 1;
+
+	for (size_t o = 0; o < obj->num_objects; o++) {
+		buf_printf("o object_%zu\n", o);
+
+		for (size_t y = 0; y < side; y++) {
+			for (size_t x = 0; x < side; x++) {
+				float fx = (float)x / obj->grid_size;
+				float fy = (float)y / obj->grid_size;
+
+				buf_printf("v %f %f %f\n", fx + o, fy, sinf(fx * 6.0f) * 0.1f);
+				buf_printf("vt %f %f\n", fx, fy);
+				buf_printf("vn 0 0 1\n");
+			}
+		}
+
+		size_t base = o * side * side + 1;
+		for (size_t y = 0; y < obj->grid_size; y++) {
+			for (size_t x = 0; x < obj->grid_size; x++) {
+				size_t a = base + x + y * side;
+				size_t b = a + 1;
+				size_t c = a + side;
+				size_t d = c + 1;
+
+				buf_printf("f %zu/%zu/%zu %zu/%zu/%zu %zu/%zu/%zu\n",
+					   a, a, a, b, b, b, d, d, d);
+				buf_printf("f %zu/%zu/%zu %zu/%zu/%zu %zu/%zu/%zu\n",
+					   a, a, a, d, d, d, c, c, c);
+			}
+		}
+	}
+}
+
+static unsigned char *bench_file_read(const char *file_path, size_t *file_size) {
+	if (!strcmp(file_path, SYNTHETIC_OBJ)) {
+		*file_size = synthetic_buf.len;
+		return (unsigned char*)synthetic_buf.items;
+	}
+
+	return bed_get(file_path, file_size);
+}
+
+static void setup_synthetic(void *arg) {
+	generate_synthetic_obj(arg);
+}
+
+static void run_load_obj(void *arg) {
+	struct cg_model model = cg_model_from_obj_file(arg == NULL ? SUZZANNE_OBJ : SYNTHETIC_OBJ);
+	cg_model_destroy(&model);
+}
+
+static void run_load_texture(void *arg) {
+	(void) arg;
+
+	struct cg_texture tex = cg_texture_from_file_2d(SUZZANNE_TEX);
+	cg_texture_destroy(&tex);
+}
+
+static void setup_draw(void *arg) {
+	struct draw_bench *b = arg;
+
+	if (b->obj.num_objects == 0) {
+		bench_model = cg_model_from_obj_file(SUZZANNE_OBJ);
+	} else {
+		generate_synthetic_obj(&b->obj);
+		bench_model = cg_model_from_obj_file(SYNTHETIC_OBJ);
+	}
+}
+
+static void run_draw(void *arg) {
+	struct draw_bench *b = arg;
+	size_t side = ceilf(cbrtf(b->num_models));
+
+	cg_start_render();
+
+	for (size_t i = 0; i < b->num_models; i++) {
+		cg_model_set_position(&bench_model, (struct cg_vec3f) {
+			(float)(i % side) - side / 2.0f,
+			(float)(i / side % side) - side / 2.0f,
+			-(float)(i / (side * side)) - 2.0f,
+		});
+		cg_model_draw(&bench_model);
+	}
+
+	cg_end_render();
+
+	// Include the GPU work of the frame
+	glFinish();
+}
+
+static void teardown_draw(void *arg) {
+	(void) arg;
+
+	cg_model_destroy(&bench_model);
+}
+
+static void run_mat4f_multiply(void *arg) {
+	(void) arg;
+
+	struct cg_mat4f acc = cg_mat4f_identity();
+	struct cg_mat4f r = cg_mat4f_rotate_y(0.001f);
+
+	for (size_t i = 0; i < MATH_BATCH; i++)
+		acc = cg_mat4f_multiply(acc, r);
+
+	sink = acc.d[0];
+}
+
+static void run_mat4f_model(void *arg) {
+	(void) arg;
+
+	float acc = 0;
+	for (size_t i = 0; i < MATH_BATCH; i++) {
+		struct cg_mat4f m = cg_mat4f_model((struct cg_vec3f){i, 1, 2},
+						   (struct cg_vec3f){1, 2, 1},
+						   (struct cg_vec3f){0.1f * i, 0.2f, 0.3f});
+		acc += m.d[m(3, 0)];
+	}
+
+	sink = acc;
+}
+
+static void run_vec3f_mat4f_multiply(void *arg) {
+	(void) arg;
+
+	struct cg_mat4f m = cg_mat4f_model((struct cg_vec3f){1, 2, 3},
+					   (struct cg_vec3f){1, 1, 1},
+					   (struct cg_vec3f){0.1f, 0.2f, 0.3f});
+	struct cg_vec3f v = {1, 0, 0};
+
+	for (size_t i = 0; i < MATH_BATCH; i++)
+		v = cg_vec3f_mat4f_multiply(v, m);
+
+	sink = v.x;
+}
+
+static struct synthetic_obj synthetic_small = { .grid_size = 64, .num_objects = 1 };
+static struct synthetic_obj synthetic_large = { .grid_size = 512, .num_objects = 1 };
+
+static struct draw_bench draw_models_1 = { .num_models = 1 };
+static struct draw_bench draw_models_100 = { .num_models = 100 };
+static struct draw_bench draw_models_1000 = { .num_models = 1000 };
+static struct draw_bench draw_meshes_100 = {
+	.num_models = 1,
+	.obj = { .grid_size = 8, .num_objects = 100 },
+};
+static struct draw_bench draw_meshes_1000 = {
+	.num_models = 1,
+	.obj = { .grid_size = 4, .num_objects = 1000 },
+};
+
+static struct bench benches[] = {
+	{ "load_obj_suzzanne", NULL, run_load_obj, NULL, NULL, 3, 30 },
+	{ "load_obj_grid_64", setup_synthetic, run_load_obj, NULL, &synthetic_small, 3, 30 },
+	{ "load_obj_grid_512", setup_synthetic, run_load_obj, NULL, &synthetic_large, 1, 10 },
+	{ "load_texture_png", NULL, run_load_texture, NULL, NULL, 3, 30 },
+	{ "draw_models_1", setup_draw, run_draw, teardown_draw, &draw_models_1, 10, 200 },
+	{ "draw_models_100", setup_draw, run_draw, teardown_draw, &draw_models_100, 10, 200 },
+	{ "draw_models_1000", setup_draw, run_draw, teardown_draw, &draw_models_1000, 10, 100 },
+	{ "draw_meshes_100", setup_draw, run_draw, teardown_draw, &draw_meshes_100, 10, 200 },
+	{ "draw_meshes_1000", setup_draw, run_draw, teardown_draw, &draw_meshes_1000, 10, 100 },
+	{ "mat4f_multiply_x1024", NULL, run_mat4f_multiply, NULL, NULL, 100, 2000 },
+	{ "mat4f_model_x1024", NULL, run_mat4f_model, NULL, NULL, 100, 2000 },
+	{ "vec3f_mat4f_multiply_x1024", NULL, run_vec3f_mat4f_multiply, NULL, NULL, 100, 2000 },
+};
+
+static int compare_u64(const void *a, const void *b) {
+	uint64_t x = *(const uint64_t*)a;
+	uint64_t y = *(const uint64_t*)b;
+
+	return (x > y) - (x < y);
+}
+
+static struct bench_result run_bench(const struct bench *b) {
+	if (b->setup)
+		b->setup(b->arg);
+
+	for (size_t i = 0; i < b->warmup; i++)
+		b->run(b->arg);
+
+	uint64_t *samples = malloc(sizeof(*samples) * b->iterations);
+	cg_assert(samples != NULL);
+
+	double total = 0;
+	for (size_t i = 0; i < b->iterations; i++) {
+		uint64_t start = now_ns();
+		b->run(b->arg);
+		samples[i] = now_ns() - start;
+		total += samples[i];
+	}
+
+	if (b->teardown)
+		b->teardown(b->arg);
+
+	qsort(samples, b->iterations, sizeof(*samples), compare_u64);
+
+	size_t p99 = (b->iterations * 99 + 99) / 100 - 1;
+	struct bench_result res = {
+		.name = b->name,
+		.iterations = b->iterations,
+		.min_ns = samples[0],
+		.median_ns = samples[b->iterations / 2],
+		.p99_ns = samples[p99],
+		.mean_ns = total / b->iterations,
+	};
+
+	free(samples);
+
+	return res;
+}
+
+static void print_help(const char *prg_name) {
+	printf("usage: %s [-f csv|json] [-o <file>] [filter]\n", prg_name);
+	printf("Run the cg benchmarks whose name contains filter\n");
+	printf("Results go to stdout unless -o is given, the library logs also go there\n");
+}
+
+int main(int argc, char *argv[]) {
+	const char *format = "csv";
+	const char *output_path = NULL;
+
+	int c;
+	while (c = getopt(argc, argv, "f:o:h"), c != -1) {
+		switch (c) {
+		case 'f':
+			format = optarg;
+			break;
+		case 'o':
+			output_path = optarg;
+			break;
+		default:
+			print_help(argv[0]);
+			exit(c == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+		}
+	}
+
+	bool json = !strcmp(format, "json");
+	if (!json && strcmp(format, "csv")) {
+		cg_error("unknown format %s\n", format);
+		exit(EXIT_FAILURE);
+	}
+
+	const char *filter = optind < argc ? argv[optind] : NULL;
+
+	// Nothing is looked at, so do not depend on a display where possible
+#ifdef CG_EGL
+	cg_headless_create(640, 480);
+#else
+	cg_window_create_hidden("cg benchmarks", 640, 480);
+#endif
+	cg_set_file_read_callback(bench_file_read);
+
+	// Do not let vsync cap the draw benchmarks
+	cg_set_swap_interval(CG_SWAP_IMMEDIATE);
+
+	// The draw benchmarks measure submission, keep every model on the queue
+	cg_camera_create((struct cg_vec3f){0, 0, 0}, 1.5, 0.1, 1000);
+	cg_set_frustum_culling(false);
+
+	struct CG_DA(struct bench_result) results = {0};
+	for (size_t i = 0; i < CG_ARRAY_LEN(benches); i++) {
+		if (filter != NULL && strstr(benches[i].name, filter) == NULL)
+			continue;
+
+		cg_da_append(&results, run_bench(&benches[i]));
+	}
+
+	FILE *out = stdout;
+	if (output_path != NULL) {
+		out = fopen(output_path, "w");
+		cg_assert(out != NULL);
+	}
+
+	if (json)
+		fprintf(out, "{\n\t\"benchmarks\": [\n");
+	else
+		fprintf(out, "name,iterations,min_ns,median_ns,p99_ns,mean_ns\n");
+
+	for (size_t i = 0; i < results.len; i++) {
+		struct bench_result *r = &results.items[i];
+
+		if (json) {
+			fprintf(out, "\t\t{\"name\": \"%s\", \"iterations\": %zu, \"min_ns\": %lu, "
+				"\"median_ns\": %lu, \"p99_ns\": %lu, \"mean_ns\": %.0f}%s\n",
+				r->name, r->iterations, (unsigned long)r->min_ns,
+				(unsigned long)r->median_ns, (unsigned long)r->p99_ns, r->mean_ns,
+				i + 1 < results.len ? "," : "");
+		} else {
+			fprintf(out, "%s,%zu,%lu,%lu,%lu,%.0f\n",
+				r->name, r->iterations, (unsigned long)r->min_ns,
+				(unsigned long)r->median_ns, (unsigned long)r->p99_ns, r->mean_ns);
+		}
+	}
+
+	if (json)
+		fprintf(out, "\t]\n}\n");
+
+	if (out != stdout)
+		fclose(out);
+
+	free(results.items);
+	free(synthetic_buf.items);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,56 @@
+/*
+ * Copyright Arthur Grillo (c) 2024
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#include "cg_core.h"
+#include "cg_gfx.h"
+#include "cg_input.h"
+#include "cg_math.h"
+#include "cg_util.h"
+
+#include "external/bed.h"
+
+#define GRID_SIZE 10
+
+int main(void) {
+	cg_window_create("Instancing example", 600 , 400);
+
+	cg_set_file_read_callback(bed_get);
+
+	cg_disable_cursor();
+
+	struct cg_model model = cg_model_from_obj_file("../examples/resources/suzzanne.obj");
+
+	struct cg_camera camera = cg_camera_create((struct cg_vec3f){0, 0, -1}, 1.5, 0.1, 100);
+
+	static struct cg_mat4f transforms[GRID_SIZE * GRID_SIZE * GRID_SIZE];
+	for (int z = 0; z < GRID_SIZE; z++) {
+		for (int y = 0; y < GRID_SIZE; y++) {
+			for (int x = 0; x < GRID_SIZE; x++) {
+				struct cg_vec3f pos = {
+					(x - GRID_SIZE / 2) * 5,
+					(y - GRID_SIZE / 2) * 5,
+					(z - GRID_SIZE / 2) * 3
+				};
+				transforms[x + y * GRID_SIZE + z * GRID_SIZE * GRID_SIZE] =
+					cg_mat4f_model(pos, model.scale, model.rotation);
+			}
+		}
+	}
+
+	while (!cg_window_should_close()) {
+		cg_camera_update_FPS(&camera);
+
+		cg_start_render();
+
+		glClearColor(0.1, 0.1, 0.1, 1.0);
+
+		cg_model_draw_instanced(&model, transforms, CG_ARRAY_LEN(transforms));
+
+		cg_end_render();
+	}
+}
@@ -0,0 +1,96 @@
+/*
+ * Copyright Arthur Grillo (c) 2024
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#include <math.h>
+
+#include "cg_core.h"
+#include "cg_gfx.h"
+#include "cg_input.h"
+#include "cg_math.h"
+#include "cg_scene.h"
+#include "cg_util.h"
+
+#include "external/bed.h"
+
+#define WINDOW_WIDTH 600
+#define WINDOW_HEIGHT 400
+
+#define NUM_PLANETS 8
+#define NUM_MOONS 16
+
+int main(void) {
+	cg_window_create("Scene example", WINDOW_WIDTH, WINDOW_HEIGHT);
+
+	cg_set_file_read_callback(bed_get);
+
+	cg_disable_cursor();
+
+	// distant moons are drawn with simplified meshes
+	cg_set_mesh_lods(CG_MESH_MAX_LODS);
+
+	struct cg_model model = cg_model_from_obj_file("../examples/resources/suzzanne.obj");
+
+	struct cg_camera camera = cg_camera_create((struct cg_vec3f){0, 0, 40}, 1.5, 0.1, 200);
+
+	struct cg_scene scene = cg_scene_create();
+
+	cg_scene_node sun = cg_scene_add_node(&scene, CG_SCENE_NO_PARENT, &model);
+	cg_scene_node_set_scale(&scene, sun, (struct cg_vec3f){3, 3, 3});
+
+	cg_scene_node orbits[NUM_PLANETS];
+	for (size_t i = 0; i < NUM_PLANETS; i++) {
+		// the orbits have no model, they only rotate their planet around the sun
+		orbits[i] = cg_scene_add_node(&scene, sun, NULL);
+
+		cg_scene_node planet = cg_scene_add_node(&scene, orbits[i], &model);
+		cg_scene_node_set_position(&scene, planet, (struct cg_vec3f){2 + i * 1.5, 0, 0});
+		cg_scene_node_set_scale(&scene, planet, (struct cg_vec3f){0.2, 0.2, 0.2});
+
+		for (size_t j = 0; j < NUM_MOONS; j++) {
+			cg_scene_node moon = cg_scene_add_node(&scene, planet, &model);
+			float angle = j * 2 * M_PI / NUM_MOONS;
+			cg_scene_node_set_position(&scene, moon,
+						   (struct cg_vec3f){3 * cosf(angle), 0, 3 * sinf(angle)});
+			cg_scene_node_set_scale(&scene, moon, (struct cg_vec3f){0.3, 0.3, 0.3});
+		}
+	}
+
+	cg_scene_build_bvh(&scene);
+
+	float time = 0;
+	bool picking = false;
+	while (!cg_window_should_close()) {
+		cg_camera_update_FPS(&camera);
+
+		// the cursor is captured, so pick whatever is under the center of the window
+		if (cg_keycode_is_down(CG_KEY_E) && !picking) {
+			struct cg_vec2f center = {WINDOW_WIDTH / 2.0f, WINDOW_HEIGHT / 2.0f};
+			struct cg_ray_hit hit;
+
+			if (cg_ray_cast(&scene, cg_camera_screen_ray(center), &hit))
+				cg_info("Picked node %zu at distance %f\n", hit.node, hit.t);
+		}
+		picking = cg_keycode_is_down(CG_KEY_E);
+
+		time += 0.01;
+		for (size_t i = 0; i < NUM_PLANETS; i++) {
+			cg_scene_node_set_rotation(&scene, orbits[i],
+						   (struct cg_vec3f){0, time / (i + 1), 0});
+		}
+
+		cg_start_render();
+
+		glClearColor(0.1, 0.1, 0.1, 1.0);
+
+		cg_scene_draw(&scene);
+
+		cg_end_render();
+	}
+
+	cg_scene_destroy(&scene);
+}
@@ -0,0 +1,83 @@
+/*
+ * Copyright Arthur Grillo (c) 2024
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef __CG_BVH_H__
+#define __CG_BVH_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cg_math.h"
+#include "cg_util.h"
+
+struct cg_mesh;
+
+/*
+ * Inner nodes have count 0 and their children at first and first + 1, leaves reference
+ * count primitives starting at first in the primitive index array. Children always come
+ * after their parent.
+ */
+struct cg_bvh_node {
+	struct cg_box bounds;
+	uint32_t first;
+	uint32_t count;
+};
+
+// Hierarchy over primitives identified by their index in the box array it was built from
+struct cg_bvh {
+	struct CG_DA(struct cg_bvh_node) nodes;
+
+	size_t num_prims;
+	uint32_t *prims;
+	// bounds of every primitive, indexed by primitive
+	struct cg_box *prim_bounds;
+};
+
+typedef void (*cg_bvh_visit_callback_t)(size_t prim, void *user_data);
+// Distance along the ray to the primitive, or INFINITY when it is missed or beyond t_max
+typedef float (*cg_bvh_intersect_callback_t)(size_t prim, const struct cg_ray *ray,
+					     float t_max, void *user_data);
+
+// Builds the tree with binned surface area heuristic splits
+struct cg_bvh cg_bvh_build(const struct cg_box *boxes, size_t count);
+void cg_bvh_destroy(struct cg_bvh *bvh);
+
+/*
+ * Recomputes the node bounds from updated boxes, keeping the tree topology. Cheap, but the
+ * tree quality degrades as primitives move far from where they were at build time.
+ */
+void cg_bvh_refit(struct cg_bvh *bvh, const struct cg_box *boxes);
+
+void cg_bvh_query_frustum(const struct cg_bvh *bvh, const struct cg_frustum *frustum,
+			  cg_bvh_visit_callback_t visit, void *user_data);
+void cg_bvh_query_box(const struct cg_bvh *bvh, const struct cg_box box,
+		      cg_bvh_visit_callback_t visit, void *user_data);
+
+/*
+ * Closest primitive hit by the ray, visiting nodes front to back. Returns SIZE_MAX when
+ * nothing is hit, otherwise t holds the hit distance.
+ */
+size_t cg_bvh_ray_cast(const struct cg_bvh *bvh, const struct cg_ray *ray, float t_max,
+		       cg_bvh_intersect_callback_t intersect, void *user_data, float *t);
+
+/*
+ * Builds a triangle hierarchy for mesh ray casts, it needs the CPU side positions, see
+ * cg_set_mesh_cpu_data.
+ */
+bool cg_mesh_build_bvh(struct cg_mesh *mesh);
+
+/*
+ * Closest triangle of the mesh hit by the ray, in the mesh's space. Uses the mesh hierarchy
+ * when there is one and tests every triangle otherwise. Meshes without CPU side geometry
+ * are tested against their bounds, with triangle set to SIZE_MAX.
+ */
+bool cg_mesh_ray_cast(const struct cg_mesh *mesh, const struct cg_ray *ray, float t_max,
+		      float *t, size_t *triangle);
+
+#endif // __CG_BVH_H__
@@ -0,0 +1,42 @@
+/*
+ * Copyright Arthur Grillo (c) 2024
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef __CG_CAPTURE_H__
+#define __CG_CAPTURE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * A rendered frame, width * height RGBA8 pixels with the rows bottom up, as GL has them.
+ * pixels is only valid during the callback.
+ */
+struct cg_frame {
+	const unsigned char *pixels;
+	size_t width, height;
+	// number of the frame, counting every cg_end_render
+	uint64_t index;
+};
+
+typedef void (*cg_frame_callback_t)(const struct cg_frame *frame, void *user);
+
+/*
+ * Has func called with every frame from now on, NULL stops it. The frames are read back
+ * into pixel buffers when they end and delivered, in order, once the GPU is done with them,
+ * usually a frame later, so rendering does not stall on the readback. The frames still in
+ * flight are delivered to the previous callback first.
+ */
+void cg_set_frame_callback(cg_frame_callback_t func, void *user);
+
+// Waits for the frames in flight and delivers them
+void cg_capture_flush(void);
+
+// Starts the readback of the frame, called by cg_end_render
+void cg_capture_end_frame(void);
+
+#endif // __CG_CAPTURE_H__
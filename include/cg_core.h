@@ -16,13 +16,44 @@
 
 #include "cg_input.h"
 #include "cg_math.h"
+#include "cg_profile.h"
 #include "cg_util.h"
 
+/*
+ * Returns the contents of a file, or NULL when it can not be read. The data is handed back
+ * to the matching release callback once cg is done with it.
+ */
 typedef unsigned char* (*cg_file_reader_callback_t)(const char *file_path, size_t *file_size);
+typedef void (*cg_file_release_callback_t)(unsigned char *data, size_t file_size);
+
+#define CG_GL_STATE_TEXTURE_UNITS 16
+
+/*
+ * Shadow of the GL bindings last issued by cg, used to skip redundant state changes.
+ * camera_generation is bumped every time the view or projection matrix changes, and
+ * program_camera_generation, indexed by program id, holds the generation last uploaded to
+ * each program.
+ */
+struct cg_gl_state {
+	unsigned int program;
+	unsigned int vao;
+	unsigned int active_texture_unit;
+	unsigned int textures[CG_GL_STATE_TEXTURE_UNITS];
+	bool polygon_line;
+
+	unsigned long camera_generation;
+	struct CG_DA(unsigned long) program_camera_generation;
+
+	size_t calls_avoided;
+	size_t frame_calls_avoided;
+};
 
 struct cg_window {
+	// NULL when headless
 	void *base;
 	size_t width, height;
+	// drawing to an offscreen framebuffer, see cg_headless_create
+	bool headless;
 };
 
 struct cg_contex {
@@ -35,19 +66,39 @@ struct cg_contex {
 
 	struct cg_mat4f view_matrix;
 	struct cg_mat4f projection_matrix;
+	// world position the view matrix looks from
+	struct cg_vec3f camera_pos;
 
 	bool fill;
 
+	struct cg_gl_state gl_state;
+	struct cg_frame_stats frame_stats;
+
 	cg_file_reader_callback_t file_read;
+	cg_file_release_callback_t file_release;
 };
 
 void cg_window_create(const char *window_name, size_t width, size_t height);
+// Like cg_window_create, but the window is never shown, it still needs a display
+void cg_window_create_hidden(const char *window_name, size_t width, size_t height);
+/*
+ * Instead of a window, creates an EGL context needing no display, surfaceless where the
+ * driver allows it, that draws into a width by height framebuffer. Frames are not shown,
+ * they are only seen through cg_set_frame_callback. Needs cg to be built with EGL.
+ */
+void cg_headless_create(size_t width, size_t height);
 bool cg_window_should_close(void);
 
 void cg_enable_cursor(void);
 void cg_disable_cursor(void);
 
+// The reader keeps ownership of what it returns, like bed_get does with the embedded files
 void cg_set_file_read_callback(cg_file_reader_callback_t func);
+// release may be NULL when the reader keeps ownership
+void cg_set_file_callbacks(cg_file_reader_callback_t read, cg_file_release_callback_t release);
+// Back to the default reader, which maps the files in memory
 void cg_reset_file_read_callback();
+unsigned char *cg_file_read(const char *file_path, size_t *file_size);
+void cg_file_release(unsigned char *data, size_t file_size);
 
 #endif // __CG_CORE_H__
@@ -15,14 +15,23 @@
 #include "cg_math.h"
 #include "cg_util.h"
 
-struct cg_box {
-	struct cg_vec3f min, max;
-};
-
 enum cg_shader_attrib_loc {
 	CG_SATTRIB_LOC_VERTEX_POSITION,
 	CG_SATTRIB_LOC_VERTEX_NORMAL,
 	CG_SATTRIB_LOC_VERTEX_UV,
+	// mat4, takes this location and the next three
+	CG_SATTRIB_LOC_INSTANCE_MODEL,
+	// int, index of the material of the instance in the cg_materials block
+	CG_SATTRIB_LOC_INSTANCE_MATERIAL = CG_SATTRIB_LOC_INSTANCE_MODEL + 4,
+	CG_SATTRIB_LOC_SIZE,
+};
+
+enum cg_vertex_format {
+	// 32-bit floats for every attribute
+	CG_VERTEX_FORMAT_FLOAT,
+	// float positions, GL_INT_2_10_10_10_REV normals and half-float uvs
+	CG_VERTEX_FORMAT_COMPACT,
+	CG_VERTEX_FORMAT_SIZE,
 };
 
 enum cg_shader_uniform {
@@ -32,11 +41,37 @@ enum cg_shader_uniform {
 	CG_SUNIFORM_DIFFUSE_COLOR,
 	CG_SUNIFORM_DIFFUSE_TEXTURE,
 	CG_SUNIFORM_DIFFUSE_TEXTURE_PROVIDED,
+	CG_SUNIFORM_DIFFUSE_TEXTURE_ARRAY,
+	// layer of the array texture, -1 when the 2D one is used
+	CG_SUNIFORM_DIFFUSE_TEXTURE_LAYER,
+	// of the material in the cg_materials block
+	CG_SUNIFORM_MATERIAL_INDEX,
 	CG_SUNIFORM_SIZE,
 };
 
+// CPU side copies kept by a mesh after it is uploaded
+enum cg_mesh_cpu_data {
+	CG_MESH_CPU_DATA_ALL,
+	// positions and indices, for the CPU side geometry queries
+	CG_MESH_CPU_DATA_GEOMETRY,
+	CG_MESH_CPU_DATA_NONE,
+};
+
 enum cg_texture_type {
 	CG_TEXTURE_2D,
+	// a layer of a GL_TEXTURE_2D_ARRAY, shared by the textures of the other layers
+	CG_TEXTURE_2D_ARRAY,
+};
+
+struct cg_bvh;
+struct cg_mesh_arena;
+
+#define CG_MESH_MAX_LODS 4
+
+// Range of the element buffer holding one level of detail of a mesh
+struct cg_mesh_lod {
+	size_t first_index;
+	size_t num_indices;
 };
 
 struct cg_mesh {
@@ -45,6 +80,7 @@ struct cg_mesh {
 
 	size_t num_indices;
 	int *indices;
+	GLenum index_type;
 
 	size_t num_uvs;
 	float *uvs;
@@ -52,6 +88,24 @@ struct cg_mesh {
 	size_t num_normals;
 	float *normals;
 
+	struct cg_box bounds;
+
+	bool interleaved;
+	enum cg_vertex_format vertex_format;
+
+	// lods[0] is the full mesh, the next ones are simplified versions of the one before
+	size_t num_lods;
+	struct cg_mesh_lod lods[CG_MESH_MAX_LODS];
+
+	// triangle hierarchy for ray casts, NULL until cg_mesh_build_bvh
+	struct cg_bvh *bvh;
+
+	// buffers shared with the meshes of the same layout, NULL when it has its own
+	struct cg_mesh_arena *arena;
+	// where the mesh starts in the arena buffers, both 0 without one
+	size_t base_vertex;
+	size_t base_index;
+
 	unsigned int vao;
 	unsigned int vbo;
 	unsigned int ebo;
@@ -63,14 +117,37 @@ struct cg_shader_prg_builder {
 	struct CG_DA(unsigned int) shaders;
 };
 
+/*
+ * Uniform buffer bindings of the blocks programs can declare. cg_frame holds the camera of the
+ * frame and cg_materials the materials of the draws, see the default shaders for their
+ * layouts. Programs without them get the loose uniforms instead.
+ */
+enum cg_ubo_binding {
+	CG_UBO_BINDING_FRAME,
+	CG_UBO_BINDING_MATERIALS,
+};
+
 struct cg_shader_prg {
 	unsigned int id;
 	int uniform_locs[CG_SUNIFORM_SIZE];
+	// reads the model matrix from the instance_model attribute
+	bool instanced;
+	bool frame_block;
+	bool material_block;
 };
 
 struct cg_texture {
 	enum cg_texture_type type;
 	unsigned int gl_tex;
+	unsigned int layer;
+	// resident bindless handle, 0 unless bindless textures were enabled when created
+	GLuint64 handle;
+};
+
+// A mip level of compressed texture data
+struct cg_texture_level {
+	const void *data;
+	size_t size;
 };
 
 struct cg_material {
@@ -86,6 +163,8 @@ struct cg_material {
 	float opacity;
 
 	bool enable_color;
+	// drawn after the opaque meshes, sorted back to front
+	bool transparent;
 
 	struct cg_texture tex_ambient;
 	struct cg_texture tex_diffuse;
@@ -105,10 +184,20 @@ struct cg_model {
 
 	size_t *mesh_to_material;
 
+	/*
+	 * Change these through the cg_model_set_* and friends functions, they mark the cached
+	 * world matrix as dirty so it is only rebuilt when the transform actually changes.
+	 */
 	struct cg_vec3f position;
 	struct cg_vec3f rotation;
 	struct cg_vec3f scale;
 
+	struct cg_mat4f world_matrix;
+	bool world_dirty;
+
+	// level of detail cg_model_draw used last, see cg_model_select_lod
+	size_t lod;
+
 	struct cg_box bounding_box;
 };
 
@@ -116,31 +205,99 @@ struct cg_camera {
 	struct cg_vec3f pos;
 	struct cg_mat4f rotation;
 
+	// set when pos or rotation change, the view matrix is only rebuilt then
+	bool view_dirty;
+
+	// units per second cg_camera_update_FPS moves it by
+	float speed;
+
 	float fov;
 	float far_plane;
 	float near_plane;
 };
 
+/*
+ * Models drawn between cg_start_render and cg_end_render are queued and submitted sorted by
+ * state and depth in cg_end_render, so they must be kept alive until then.
+ */
 void cg_start_render(void);
 void cg_end_render(void);
 
 void cg_set_fill(bool fill);
 bool cg_get_fill();
 
+size_t cg_get_gl_calls_avoided();
+
+void cg_set_mesh_cpu_data(enum cg_mesh_cpu_data keep);
+
+/*
+ * Number of levels of detail built for the indexed meshes created from now on, each one
+ * simplified to about half the triangles of the previous. 1, the default, builds none.
+ */
+void cg_set_mesh_lods(size_t count);
+/*
+ * Projected size below which a model switches to its first simplified level, every next
+ * level takes half of it. The size is the radius of the model's bounds over the half height
+ * of the view at its distance.
+ */
+void cg_set_lod_threshold(float threshold);
+
+// Skip models whose bounding box is outside the camera frustum, enabled by default
+void cg_set_frustum_culling(bool enable);
+bool cg_get_frustum_culling(void);
+// Frustum of the current view and projection matrices
+const struct cg_frustum *cg_view_frustum(void);
+
 struct cg_mesh cg_mesh_create(const float *verts, const size_t num_verts,
 			      const int *indices, const size_t num_indices,
 			      const float *normals, const size_t num_normals,
 			      const float *uvs, const size_t num_uvs);
+struct cg_mesh cg_mesh_create_interleaved(const float *verts, const size_t num_verts,
+					  const int *indices, const size_t num_indices,
+					  const float *normals, const float *uvs,
+					  enum cg_vertex_format format);
+void cg_mesh_destroy(struct cg_mesh *mesh);
 
 void cg_shader_prg_builder_add_shader(struct cg_shader_prg_builder *builder, const char *src,
 				      int length,
 				      GLenum type);
 struct cg_shader_prg cg_shader_prg_builder_build(struct cg_shader_prg_builder *builder);
+void cg_shader_prg_destroy(struct cg_shader_prg *prg);
 struct cg_shader_prg cg_shader_prg_default();
+struct cg_shader_prg cg_shader_prg_default_instanced();
+/*
+ * Program of a vertex and a fragment shader, each given a "#define <entry>" line for every
+ * entry of defines after its #version line. Variants are cached by the hash of the sources
+ * and defines, so asking for one again returns the program built the first time, until it
+ * is destroyed. A length below 1 means the source is null terminated.
+ */
+struct cg_shader_prg cg_shader_prg_variant(const char *vert_src, int vert_len,
+					   const char *frag_src, int frag_len,
+					   const char *const *defines, size_t num_defines);
+/*
+ * Keep the linked variants in dir through glGetProgramBinary, loaded on later runs instead
+ * of compiling them, which still happens when the driver changed or rejects the binary. dir
+ * must outlive the builds, NULL, the default, disables it.
+ */
+void cg_set_shader_cache_dir(const char *dir);
 
 struct cg_texture cg_texture_create_2d(const unsigned char *data, size_t width, size_t height,
 				       int internal_format, int format);
+// Every layer has width * height pixels, the texture of the first layer is returned
+struct cg_texture cg_texture_create_2d_array(const unsigned char *const *layers,
+					     size_t num_layers, size_t width, size_t height,
+					     int internal_format, int format);
+// levels go from the full size down, the chain can stop before 1x1
+struct cg_texture cg_texture_create_2d_compressed(int format, size_t width, size_t height,
+						  const struct cg_texture_level *levels,
+						  size_t num_levels);
+/*
+ * PNG, JPEG and the like, or DDS and KTX2 files with BC1, BC3, BC7 or ETC2 data, which are
+ * uploaded as they are with their mips. Loading a path again gives the same texture, it is
+ * only deleted once every load of it was destroyed.
+ */
 struct cg_texture cg_texture_from_file_2d(const char *file_path);
+void cg_texture_destroy(struct cg_texture *tex);
 struct cg_texture cg_texture_default();
 
 struct cg_material cg_material_default();
@@ -149,14 +306,86 @@ struct cg_model cg_model_create(const struct cg_mesh *meshes, const size_t num_m
 				const struct cg_material *materials, const size_t num_materials,
 				const size_t *mesh_to_material);
 struct cg_model cg_model_from_obj_file(const char *file_path);
+/*
+ * Keep a cooked binary copy of every model loaded from a file in dir, loaded instead of
+ * parsing the source again while the source size and modification time stay the same.
+ * Cooked meshes only keep the positions and indices as CPU side data. dir must outlive the
+ * loads, NULL, the default, disables the cache.
+ */
+void cg_set_model_cache_dir(const char *dir);
+
+enum cg_load_status {
+	CG_LOAD_PENDING,
+	CG_LOAD_DONE,
+	CG_LOAD_FAILED,
+};
+
+struct cg_load;
+
+/*
+ * Loads run in the background: reading, decoding and parsing happen on the job threads, and
+ * the GL upload is spread over the following frames by cg_start_render. The handle is freed
+ * by taking its result.
+ */
+struct cg_load *cg_texture_load_async(const char *file_path);
+struct cg_load *cg_model_load_async(const char *file_path);
+enum cg_load_status cg_load_poll(const struct cg_load *load);
+// Blocks until the load is done, finishing its upload right away, call it from the GL thread
+void cg_load_wait(struct cg_load *load);
+// Waits for the load and frees it, failed loads give the default texture or an empty model
+struct cg_texture cg_load_take_texture(struct cg_load *load);
+struct cg_model cg_load_take_model(struct cg_load *load);
+// Milliseconds cg_start_render spends on uploads each frame, 2 by default
+void cg_set_upload_budget(double ms);
+
+/*
+ * Pack the textures of a loaded model that have the same size and format into the layers of
+ * texture arrays, so its meshes share the texture binding. Disabled by default.
+ */
+void cg_set_texture_arrays(bool enable);
+/*
+ * Make the textures created from now on resident through ARB_bindless_texture, so drawing
+ * with them needs no binds. Returns whether it is enabled, it needs the extension.
+ */
+bool cg_set_bindless_textures(bool enable);
+/*
+ * Put the interleaved meshes created from now on into vertex and index buffers shared by the
+ * meshes of the same layout, and draw runs of queued items on those with the default shaders
+ * through a single glMultiDrawElementsIndirect. Returns whether it is enabled, it needs
+ * ARB_multi_draw_indirect and ARB_base_instance.
+ */
+bool cg_set_multi_draw(bool enable);
+// Destroys the meshes and textures of the model, shader programs are left alive
+void cg_model_destroy(struct cg_model *model);
 void cg_model_set_position(struct cg_model *model, struct cg_vec3f position);
 void cg_model_move(struct cg_model *model, struct cg_vec3f ds);
 void cg_model_set_rotation(struct cg_model *model, struct cg_vec3f rotation);
 void cg_model_rotate(struct cg_model *model, struct cg_vec3f dr);
 void cg_model_set_scale(struct cg_model *model, struct cg_vec3f scale);
 void cg_model_scale(struct cg_model *model, struct cg_vec3f ds);
+const struct cg_mat4f *cg_model_get_world_matrix(struct cg_model *model);
+// Axis aligned box enclosing the model in world space
 struct cg_box cg_model_get_bounding_box(struct cg_model *model);
+/*
+ * Whether the model with the world transform is inside the view frustum, always true when
+ * culling is disabled. The result is counted in the frame stats.
+ */
+bool cg_model_is_visible(const struct cg_model *model, const struct cg_mat4f *world);
+/*
+ * Level of detail for the model with the world transform as seen from the camera. current
+ * is the level used last time, switching away from it needs the size to pass the threshold
+ * by a margin so models at the boundary do not flicker between levels.
+ */
+size_t cg_model_select_lod(const struct cg_model *model, const struct cg_mat4f *world,
+			   size_t current);
+// Draws the model if it is visible, at the level of detail given by its size on screen
 void cg_model_draw(struct cg_model *model);
+// Draws the model with world instead of its own transform at full detail, without culling it
+void cg_model_draw_transformed(struct cg_model *model, const struct cg_mat4f *world);
+// Like cg_model_draw_transformed, but at a level of detail, clamped to the ones of each mesh
+void cg_model_draw_lod(struct cg_model *model, const struct cg_mat4f *world, size_t lod);
+void cg_model_draw_instanced(struct cg_model *model, const struct cg_mat4f *transforms,
+			     size_t count);
 void cg_model_draw_bounding_box(struct cg_model *model);
 
 struct cg_camera cg_camera_create(const struct cg_vec3f pos,
@@ -168,4 +397,7 @@ void cg_camera_look_at(struct cg_camera *camera, const struct cg_vec3f target);
 
 void cg_camera_update_FPS(struct cg_camera *camera);
 
+// Ray from the camera through a window position in pixels, e.g. cg_mouse_pos()
+struct cg_ray cg_camera_screen_ray(const struct cg_vec2f pos);
+
 #endif // __CG_GFX_H__
@@ -10,6 +10,8 @@
 #define __CG_INPUT_H__
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
 #include "cg_math.h"
 
@@ -48,12 +50,148 @@ enum cg_keycode {
 	CG_KEY_LEFT,
 	CG_KEY_RIGHT,
 
+	CG_KEY_0,
+	CG_KEY_1,
+	CG_KEY_2,
+	CG_KEY_3,
+	CG_KEY_4,
+	CG_KEY_5,
+	CG_KEY_6,
+	CG_KEY_7,
+	CG_KEY_8,
+	CG_KEY_9,
+
+	CG_KEY_F1,
+	CG_KEY_F2,
+	CG_KEY_F3,
+	CG_KEY_F4,
+	CG_KEY_F5,
+	CG_KEY_F6,
+	CG_KEY_F7,
+	CG_KEY_F8,
+	CG_KEY_F9,
+	CG_KEY_F10,
+	CG_KEY_F11,
+	CG_KEY_F12,
+
+	CG_KEY_ESCAPE,
+	CG_KEY_ENTER,
+	CG_KEY_TAB,
+	CG_KEY_BACKSPACE,
+	CG_KEY_SPACE,
+
+	CG_KEY_MINUS,
+	CG_KEY_EQUALS,
+	CG_KEY_LEFT_BRACKET,
+	CG_KEY_RIGHT_BRACKET,
+	CG_KEY_BACKSLASH,
+	CG_KEY_SEMICOLON,
+	CG_KEY_APOSTROPHE,
+	CG_KEY_GRAVE,
+	CG_KEY_COMMA,
+	CG_KEY_PERIOD,
+	CG_KEY_SLASH,
+
+	CG_KEY_CAPS_LOCK,
+	CG_KEY_PRINT_SCREEN,
+	CG_KEY_SCROLL_LOCK,
+	CG_KEY_PAUSE,
+	CG_KEY_INSERT,
+	CG_KEY_HOME,
+	CG_KEY_PAGE_UP,
+	CG_KEY_DELETE,
+	CG_KEY_END,
+	CG_KEY_PAGE_DOWN,
+
+	CG_KEY_NUM_LOCK,
+	CG_KEY_KP_DIVIDE,
+	CG_KEY_KP_MULTIPLY,
+	CG_KEY_KP_MINUS,
+	CG_KEY_KP_PLUS,
+	CG_KEY_KP_ENTER,
+	CG_KEY_KP_PERIOD,
+	CG_KEY_KP_0,
+	CG_KEY_KP_1,
+	CG_KEY_KP_2,
+	CG_KEY_KP_3,
+	CG_KEY_KP_4,
+	CG_KEY_KP_5,
+	CG_KEY_KP_6,
+	CG_KEY_KP_7,
+	CG_KEY_KP_8,
+	CG_KEY_KP_9,
+
+	CG_KEY_LEFT_CTRL,
+	CG_KEY_LEFT_SHIFT,
+	CG_KEY_LEFT_ALT,
+	CG_KEY_LEFT_SUPER,
+	CG_KEY_RIGHT_CTRL,
+	CG_KEY_RIGHT_SHIFT,
+	CG_KEY_RIGHT_ALT,
+	CG_KEY_RIGHT_SUPER,
+	CG_KEY_MENU,
+
 	CG_KEY_LEN,
 };
 
+enum cg_input_event_type {
+	CG_INPUT_QUIT,
+	CG_INPUT_RESIZE,
+	CG_INPUT_KEY_DOWN,
+	CG_INPUT_KEY_UP,
+	CG_INPUT_MOUSE_MOTION,
+};
+
+struct cg_input_event {
+	enum cg_input_event_type type;
+	// milliseconds since SDL started
+	uint32_t timestamp;
+
+	union {
+		struct {
+			enum cg_keycode code;
+			// sent by the key being held down
+			bool repeat;
+		} key;
+
+		struct {
+			struct cg_vec2f pos;
+			struct cg_vec2f rel;
+		} motion;
+
+		struct {
+			size_t width, height;
+		} resize;
+	};
+};
+
+/*
+ * Keys are looked up by scancode, the position on the keyboard, so CG_KEY_W is the key left
+ * of CG_KEY_E whatever the layout.
+ */
 bool cg_keycode_is_down(enum cg_keycode code);
 
 struct cg_vec2f cg_mouse_pos();
+// Sum of the mouse motion of every event of the frame
 struct cg_vec2f cg_mouse_rel_pos();
 
+/*
+ * Every event of the frame, in the order they happened, so a key pressed and released
+ * within a frame is still seen. Valid until the next cg_window_should_close.
+ */
+const struct cg_input_event *cg_input_events(size_t *count);
+
+/*
+ * Window events go through a lock-free queue from the thread pumping them to the one
+ * calling cg_window_should_close, which applies them to the input state and makes them the
+ * events of the frame. By default cg_window_should_close pumps them itself. Threaded input
+ * leaves it to cg_input_pump, called in a loop by the thread that created the window, and
+ * the queue only ever blocks the pumping thread, while it is full.
+ */
+void cg_set_threaded_input(bool threaded);
+void cg_input_pump(void);
+
+// Starts the frame of input, called by cg_window_should_close
+void cg_input_update(void);
+
 #endif // __CG_INPUT_H__
@@ -0,0 +1,35 @@
+/*
+ * Copyright Arthur Grillo (c) 2024
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef __CG_JOBS_H__
+#define __CG_JOBS_H__
+
+#include <stddef.h>
+
+typedef void (*cg_job_func_t)(void *arg);
+typedef void (*cg_job_range_func_t)(size_t i, void *arg);
+
+/*
+ * Worker threads for the work that can run off the render thread, like reading and decoding
+ * assets. They are started on first use, one per core besides the render thread's. Jobs must
+ * not make GL calls.
+ */
+void cg_jobs_submit(cg_job_func_t func, void *arg);
+
+/*
+ * Calls func for every i in [0, count) spread over the workers, the calling thread included,
+ * returning once all of them are done. Safe to call from a job.
+ */
+void cg_jobs_parallel_for(size_t count, cg_job_range_func_t func, void *arg);
+
+size_t cg_jobs_num_threads(void);
+
+// Waits for the queued jobs to finish and stops the workers
+void cg_jobs_shutdown(void);
+
+#endif // __CG_JOBS_H__
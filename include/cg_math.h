@@ -9,6 +9,9 @@
 #ifndef __CG_MATH_H__
 #define __CG_MATH_H__
 
+#include <stdbool.h>
+#include <stddef.h>
+
 struct cg_vec2f {
 	float x, y;
 };
@@ -17,8 +20,30 @@ struct cg_vec3f {
 	float x, y, z;
 };
 
+struct cg_box {
+	struct cg_vec3f min, max;
+};
+
+// Points along the ray are origin + t * dir for t >= 0, dir is not required to be normalized
+struct cg_ray {
+	struct cg_vec3f origin;
+	struct cg_vec3f dir;
+};
+
+// Points p with dot(normal, p) + d >= 0 are in front of the plane
+struct cg_plane {
+	struct cg_vec3f normal;
+	float d;
+};
+
+// Left, right, bottom, top, near and far planes, all facing inwards
+struct cg_frustum {
+	struct cg_plane planes[6];
+};
+
+// aligned so that every matrix row can be loaded with a single aligned SIMD load
 struct cg_mat4f {
-	float d[16];
+	_Alignas(16) float d[16];
 };
 
 #define m(col, row) ((col) + (row) * 4)
@@ -27,6 +52,7 @@ struct cg_vec3f cg_vec3f_add(const struct cg_vec3f a, const struct cg_vec3f b);
 struct cg_vec3f cg_vec3f_sub(const struct cg_vec3f a, const struct cg_vec3f b);
 struct cg_vec3f cg_vec3f_mul(const struct cg_vec3f a, const struct cg_vec3f b);
 struct cg_vec3f cg_vec3f_cross(const struct cg_vec3f a, const struct cg_vec3f b);
+float cg_vec3f_dot(const struct cg_vec3f a, const struct cg_vec3f b);
 struct cg_vec3f cg_vec3f_normalize(const struct cg_vec3f a);
 
 inline struct cg_vec3f cg_vec3f_from_array(const float *array) {
@@ -48,8 +74,32 @@ struct cg_mat4f cg_mat4f_model(const struct cg_vec3f translation,
 			       const struct cg_vec3f scale,
 			       const struct cg_vec3f rotation);
 struct cg_mat4f cg_mat4f_multiply(const struct cg_mat4f a, const struct cg_mat4f b);
+// Returns false, leaving ret untouched, when mat is singular
+bool cg_mat4f_inverse(struct cg_mat4f *ret, const struct cg_mat4f *mat);
 
 struct cg_vec3f cg_vec3f_mat4f_multiply(const struct cg_vec3f vec, const struct cg_mat4f mat);
+// Transforms a point the same way the shaders do: vec4(point, 1.0) * mat
+struct cg_vec3f cg_vec3f_transform(const struct cg_vec3f point, const struct cg_mat4f *mat);
+
+// ret[i] = cg_mat4f_multiply(a[i], *b), ret may alias a
+void cg_mat4f_multiply_n(struct cg_mat4f *ret, const struct cg_mat4f *a,
+			 const struct cg_mat4f *b, size_t n);
+// ret[i] = cg_vec3f_transform(points[i], mat), ret may alias points
+void cg_vec3f_transform_n(struct cg_vec3f *ret, const struct cg_vec3f *points,
+			  const struct cg_mat4f *mat, size_t n);
+
+// The ray in the space mat transforms to, t values along it are preserved
+struct cg_ray cg_ray_transform(const struct cg_ray ray, const struct cg_mat4f *mat);
+
+struct cg_box cg_box_union(const struct cg_box a, const struct cg_box b);
+float cg_box_surface_area(const struct cg_box box);
+
+// Box enclosing box after being transformed by mat, as the shaders do
+struct cg_box cg_box_transform(const struct cg_box box, const struct cg_mat4f *mat);
+
+// Frustum of the clip space of view_projection, i.e. cg_mat4f_multiply(view, projection)
+struct cg_frustum cg_frustum_from_matrix(const struct cg_mat4f *view_projection);
+bool cg_frustum_test_box(const struct cg_frustum *frustum, const struct cg_box box);
 
 void cg_mat4f_rotation_to_angles(struct cg_mat4f matrix, float *pitch, float *yaw, float *roll);
 
@@ -0,0 +1,73 @@
+/*
+ * Copyright Arthur Grillo (c) 2024
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef __CG_PROFILE_H__
+#define __CG_PROFILE_H__
+
+#include <stddef.h>
+
+#define CG_PROFILE_MAX_TIMERS 32
+
+struct cg_profile_timer {
+	const char *name;
+	// milliseconds
+	double time;
+	size_t calls;
+};
+
+/*
+ * Times are in milliseconds. The GPU time of a frame is only known a few frames later, so
+ * gpu_time holds the most recent result available when the frame ended.
+ */
+struct cg_frame_stats {
+	double frame_time;
+	double cpu_time;
+	double gpu_time;
+
+	size_t draw_calls;
+	size_t instances;
+	size_t triangles;
+	size_t uniform_uploads;
+	size_t binds;
+	size_t gl_calls_avoided;
+
+	// models and instances that passed or failed frustum culling
+	size_t visible;
+	size_t culled;
+
+	size_t num_timers;
+	struct cg_profile_timer timers[CG_PROFILE_MAX_TIMERS];
+};
+
+// Statistics of the last finished frame
+struct cg_frame_stats cg_frame_stats(void);
+
+// Print the statistics averaged over every n frames, 0 disables it
+void cg_profile_set_summary_interval(size_t n);
+
+void cg_profile_timer_begin(const char *name);
+void cg_profile_timer_end(const char *name);
+
+static inline void __cg_profile_scope_end(const char **name) {
+	cg_profile_timer_end(*name);
+}
+
+#define __CG_PROFILE_CONCAT(a, b) a ## b
+#define CG_PROFILE_CONCAT(a, b) __CG_PROFILE_CONCAT(a, b)
+
+// Times from this point until the end of the enclosing scope
+#define CG_PROFILE_SCOPE(name) \
+	const char *CG_PROFILE_CONCAT(__cg_profile_scope_, __LINE__) \
+		__attribute__((cleanup(__cg_profile_scope_end))) = \
+		(cg_profile_timer_begin(name), (name))
+
+// Called by cg_start_render and cg_end_render
+void cg_profile_frame_begin(void);
+void cg_profile_frame_end(void);
+
+#endif // __CG_PROFILE_H__
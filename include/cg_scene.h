@@ -0,0 +1,113 @@
+/*
+ * Copyright Arthur Grillo (c) 2024
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef __CG_SCENE_H__
+#define __CG_SCENE_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cg_bvh.h"
+#include "cg_gfx.h"
+#include "cg_math.h"
+
+#define CG_SCENE_NO_PARENT SIZE_MAX
+
+// Index of a node inside its scene
+typedef size_t cg_scene_node;
+
+/*
+ * Nodes are stored as parallel arrays indexed by cg_scene_node. A node can only be added
+ * after its parent, so parents always come before their children and the world matrices
+ * can be updated front to back in one pass.
+ */
+struct cg_scene {
+	size_t len;
+	size_t capacity;
+
+	cg_scene_node *parent;
+
+	struct cg_vec3f *position;
+	struct cg_vec3f *rotation;
+	struct cg_vec3f *scale;
+
+	struct cg_mat4f *local;
+	struct cg_mat4f *world;
+
+	// dirty state of each node, see cg_scene.c
+	uint8_t *flags;
+
+	// models are not owned by the scene and can be shared by many nodes, NULL for none
+	struct cg_model **model;
+	// level of detail each node was drawn with last, see cg_model_select_lod
+	uint8_t *lod;
+
+	bool dirty;
+
+	/*
+	 * Hierarchy over the world bounding boxes of the nodes with a model, bvh_nodes maps
+	 * its primitives back to nodes. Refitted when those nodes move and rebuilt when the set
+	 * of models changes.
+	 */
+	bool bvh_enabled;
+	bool bvh_stale;
+	struct cg_bvh bvh;
+	struct CG_DA(cg_scene_node) bvh_nodes;
+	struct CG_DA(struct cg_box) bvh_boxes;
+};
+
+struct cg_ray_hit {
+	float t;
+	struct cg_vec3f point;
+
+	cg_scene_node node;
+	struct cg_model *model;
+	size_t mesh;
+	// SIZE_MAX when the mesh has no CPU side geometry and only its bounds were hit
+	size_t triangle;
+};
+
+struct cg_scene cg_scene_create(void);
+// The models of the nodes are left alive
+void cg_scene_destroy(struct cg_scene *scene);
+
+cg_scene_node cg_scene_add_node(struct cg_scene *scene, cg_scene_node parent,
+				struct cg_model *model);
+
+void cg_scene_node_set_position(struct cg_scene *scene, cg_scene_node node,
+				struct cg_vec3f position);
+void cg_scene_node_set_rotation(struct cg_scene *scene, cg_scene_node node,
+				struct cg_vec3f rotation);
+void cg_scene_node_set_scale(struct cg_scene *scene, cg_scene_node node,
+			     struct cg_vec3f scale);
+void cg_scene_node_set_model(struct cg_scene *scene, cg_scene_node node,
+			     struct cg_model *model);
+
+// Brings the world matrix of every node whose transform, or any ancestor's, changed up to date
+void cg_scene_update(struct cg_scene *scene);
+const struct cg_mat4f *cg_scene_node_world_matrix(struct cg_scene *scene, cg_scene_node node);
+
+/*
+ * Keeps a BVH over the nodes with models, used by cg_scene_draw to cull, cg_ray_cast and
+ * cg_scene_query_box. Calling it again rebuilds the tree, which is worth doing after most of
+ * the scene has moved, as refitting keeps the topology of the first build.
+ */
+void cg_scene_build_bvh(struct cg_scene *scene);
+
+// Updates the scene and draws the model of every visible node, queued like cg_model_draw
+void cg_scene_draw(struct cg_scene *scene);
+
+// Closest model triangle hit by ray, in world space, see cg_camera_screen_ray
+bool cg_ray_cast(struct cg_scene *scene, const struct cg_ray ray, struct cg_ray_hit *hit);
+
+// Calls visit with every node holding a model whose world bounding box overlaps box
+void cg_scene_query_box(struct cg_scene *scene, const struct cg_box box,
+			cg_bvh_visit_callback_t visit, void *user_data);
+
+#endif // __CG_SCENE_H__
@@ -0,0 +1,27 @@
+/*
+ * Copyright Arthur Grillo (c) 2024
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef __CG_SIMPLIFY_H__
+#define __CG_SIMPLIFY_H__
+
+#include <stddef.h>
+
+/*
+ * Simplifies an indexed triangle list towards target_num_indices by collapsing edges in
+ * quadric error order. Vertices are never moved or created, so the result indexes the same
+ * vertex buffer. Vertices sharing a position are simplified together, so attribute seams of
+ * a welded mesh can collapse, and vertices on open borders are kept in place.
+ *
+ * dst must hold num_indices indices, the number written is returned. error, when not NULL,
+ * is set to the largest error introduced, roughly a distance in object space.
+ */
+size_t cg_simplify(int *dst, const int *indices, size_t num_indices,
+		   const float *verts, size_t num_verts,
+		   size_t target_num_indices, float *error);
+
+#endif // __CG_SIMPLIFY_H__
@@ -0,0 +1,44 @@
+/*
+ * Copyright Arthur Grillo (c) 2024
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef __CG_STREAM_H__
+#define __CG_STREAM_H__
+
+#include <stddef.h>
+
+/*
+ * A range of the streaming buffer, for data that changes every frame. Write size bytes to
+ * data, call cg_stream_commit and draw from buffer at offset, binding it to any target.
+ * It is valid until the end of the frame.
+ */
+struct cg_stream_range {
+	void *data;
+	unsigned int buffer;
+	size_t offset;
+	size_t size;
+};
+
+/*
+ * The ranges come out of a ring of three frames, each one fenced when the frame ends and only
+ * reused once the GPU is past it. With ARB_buffer_storage the ring is mapped persistently and
+ * written in place, otherwise data points to a CPU copy that cg_stream_commit writes with an
+ * unsynchronized map. A frame needing more than its part of the ring is served from
+ * temporary buffers and the ring grows for the next one.
+ */
+struct cg_stream_range cg_stream_alloc(size_t size, size_t alignment);
+void cg_stream_commit(const struct cg_stream_range *range);
+// Allocates, copies data in and commits
+struct cg_stream_range cg_stream_upload(const void *data, size_t size, size_t alignment);
+
+// Bytes of the ring each frame gets, 4 MiB by default, takes effect on the next frame
+void cg_set_stream_frame_size(size_t size);
+
+// Fences the ranges of the frame, called by cg_end_render
+void cg_stream_end_frame(void);
+
+#endif // __CG_STREAM_H__
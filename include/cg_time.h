@@ -0,0 +1,73 @@
+/*
+ * Copyright Arthur Grillo (c) 2024
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef __CG_TIME_H__
+#define __CG_TIME_H__
+
+#include <stddef.h>
+
+// Values are the ones SDL_GL_SetSwapInterval takes
+enum cg_swap_interval {
+	// swap as soon as the frame is done, tearing if needed
+	CG_SWAP_IMMEDIATE = 0,
+	CG_SWAP_VSYNC = 1,
+	// vsync, but late frames swap right away instead of waiting for the next one
+	CG_SWAP_ADAPTIVE = -1,
+};
+
+/*
+ * Returns the interval in use, adaptive falls back to vsync where the driver lacks it.
+ * Headless contexts never swap, so there it is always immediate.
+ */
+enum cg_swap_interval cg_set_swap_interval(enum cg_swap_interval interval);
+
+// Seconds since the first call to a cg_time function, at the performance counter resolution
+double cg_time(void);
+
+/*
+ * Seconds between the ends of the last two frames, what the current one should advance by.
+ * It is 0 before the first cg_end_render and clamped to a quarter of a second, so a stall
+ * does not make everything jump.
+ */
+double cg_delta_time(void);
+
+/*
+ * Have cg_end_render wait so frames take at least 1 / fps seconds, 0 disables it. Frames are
+ * kept on a fixed schedule, one running late does not make the next ones shorter.
+ */
+void cg_set_frame_limit(double fps);
+
+/*
+ * Updates a simulation in steps of a fixed length, whatever the frame rate:
+ *
+ *	struct cg_fixed_step sim = cg_fixed_step_create(1.0 / 60);
+ *	...
+ *	for (size_t n = cg_fixed_step_advance(&sim, cg_delta_time()); n > 0; n--)
+ *		update(sim.step);
+ *	draw(cg_fixed_step_alpha(&sim));
+ *
+ * draw interpolates between the last two states by the alpha, the fraction of a step the
+ * simulation is behind the frame.
+ */
+struct cg_fixed_step {
+	double step;
+	// time not simulated yet, less than a step after advancing
+	double accumulator;
+	// taken at most per advance, the time past them is dropped so slow steps do not pile up
+	size_t max_steps;
+};
+
+struct cg_fixed_step cg_fixed_step_create(double step);
+// Adds dt seconds and returns how many steps to take
+size_t cg_fixed_step_advance(struct cg_fixed_step *fixed, double dt);
+float cg_fixed_step_alpha(const struct cg_fixed_step *fixed);
+
+// Applies the frame limit and measures the delta time, called by cg_end_render after the swap
+void cg_time_end_frame(void);
+
+#endif // __CG_TIME_H__
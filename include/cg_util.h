@@ -13,6 +13,8 @@
 #include <stdbool.h>
 #include <stdlib.h>
 
+#include "cg_config.h"
+
 #define cg_error(...) fprintf(stderr, "[ERROR]: "  __VA_ARGS__)
 #define cg_warn(...) fprintf(stderr, "[WARNING]: " __VA_ARGS__)
 #define cg_info(...) fprintf(stdout, "[INFO]: " __VA_ARGS__)
@@ -20,8 +22,24 @@
 
 #define cg_assert(val) __cg_assert((val), #val, __FILE__, __LINE__)
 
+#define CG_GL_CHECK_POLL 0
+#define CG_GL_CHECK_CALLBACK 1
+#define CG_GL_CHECK_NONE 2
+
+/*
+ * CG_GL_CHECK comes from the gl_check option, through the generated cg_config.h. Only
+ * CG_GL_CHECK_POLL queries glGetError after GL calls, which stalls the pipeline on some
+ * drivers. CG_GL_CHECK_CALLBACK reports errors through a GL_KHR_debug callback instead.
+ */
+#if CG_GL_CHECK == CG_GL_CHECK_POLL
+#define cg_assert_gl() cg_assert(!cg_check_gl())
+#else
+#define cg_assert_gl() ((void)0)
+#endif
+
 bool cg_check_gl(void);
 bool cg_check_sdl(void);
+void cg_install_gl_debug_callback(void);
 
 static inline void __cg_assert(int val, const char* expr_str, const char *file_name, int line) {
 	if (!val) {
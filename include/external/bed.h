@@ -19,6 +19,11 @@
 #define BED_FUNC(func) func
 #endif // BED_FUNC_PREFIX
 
+/*
+ * Data of the embedded file, NULL when there is no such file. It is aligned to the -a
+ * alignment of bed and stays valid for the whole run. Files embedded with -z are
+ * decompressed by the first call asking for them.
+ */
 unsigned char* BED_FUNC(bed_get)(const char *file_name, size_t *size);
 
 #endif // __BED_H__
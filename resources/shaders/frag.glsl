@@ -1,18 +1,61 @@
 #version 330 core
+// built as a 4.00 variant for this, see default_shader_prg
+#ifdef CG_BINDLESS_TEXTURES
+#extension GL_ARB_bindless_texture : require
+#endif
 
 in vec3 norm_frac;
 in vec2 uv_frac;
+flat in int material_frac;
 
 out vec4 frag_color;
 
-uniform vec3 diffuse_color;
+struct cg_material {
+	// rgb and opacity
+	vec4 diffuse;
+	// rgb and specular exponent
+	vec4 ambient;
+	// rgb and index of refraction
+	vec4 specular;
+	vec4 emission;
+	// x is 1 when there is a diffuse texture, y its layer or -1 to use diffuse_tex
+	ivec4 diffuse_tex;
+	// bindless handle of the texture in xy, zero when it is bound to the samplers instead
+	uvec4 diffuse_handle;
+};
+
+layout(std140) uniform cg_materials {
+	cg_material materials[128];
+};
+
 uniform sampler2D diffuse_tex;
-uniform bool diffuse_tex_provided;
+uniform sampler2DArray diffuse_tex_array;
 
-void main() {
-	if (diffuse_tex_provided) {
-		frag_color = texture(diffuse_tex, uv_frac);
-	} else {
-		frag_color = vec4(diffuse_color, 1.0);
+vec4 diffuse_texel(cg_material material) {
+	bool array = material.diffuse_tex.y >= 0;
+
+#ifdef CG_BINDLESS_TEXTURES
+	// the same for a whole draw, even when a multi draw mixes textures
+	uvec2 handle = material.diffuse_handle.xy;
+	if (handle != uvec2(0u)) {
+		if (array)
+			return texture(sampler2DArray(handle), vec3(uv_frac, material.diffuse_tex.y));
+
+		return texture(sampler2D(handle), uv_frac);
 	}
+#endif
+
+	if (array)
+		return texture(diffuse_tex_array, vec3(uv_frac, material.diffuse_tex.y));
+
+	return texture(diffuse_tex, uv_frac);
+}
+
+void main() {
+	cg_material material = materials[material_frac];
+
+	if (material.diffuse_tex.x != 0)
+		frag_color = diffuse_texel(material);
+	else
+		frag_color = vec4(material.diffuse.rgb, 1.0);
 }
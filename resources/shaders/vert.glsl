@@ -5,14 +5,22 @@ in vec2 uv;
 
 out vec3 norm_frac;
 out vec2 uv_frac;
+flat out int material_frac;
 
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+uniform int material_index;
+layout(std140) uniform cg_frame {
+	mat4 view;
+	mat4 projection;
+	mat4 view_projection;
+	vec4 camera_pos;
+	float time;
+};
 
 void main() {
 	norm_frac = normal;
 	uv_frac = uv;
 	uv_frac.y *= -1;
-	gl_Position =  vec4(position, 1.0) * model * view * projection;
+	material_frac = material_index;
+	gl_Position =  vec4(position, 1.0) * model * view_projection;
 }
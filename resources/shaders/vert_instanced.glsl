@@ -0,0 +1,27 @@
+#version 330 core
+in vec3 position;
+in vec3 normal;
+in vec2 uv;
+in mat4 instance_model;
+// of the material in the cg_materials block
+in int instance_material;
+
+out vec3 norm_frac;
+out vec2 uv_frac;
+flat out int material_frac;
+
+layout(std140) uniform cg_frame {
+	mat4 view;
+	mat4 projection;
+	mat4 view_projection;
+	vec4 camera_pos;
+	float time;
+};
+
+void main() {
+	norm_frac = normal;
+	uv_frac = uv;
+	uv_frac.y *= -1;
+	material_frac = instance_material;
+	gl_Position =  vec4(position, 1.0) * instance_model * view_projection;
+}
@@ -0,0 +1,588 @@
+/*
+ * Copyright Arthur Grillo (c) 2024
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cg_bvh.h"
+#include "cg_gfx.h"
+#include "cg_math.h"
+#include "cg_util.h"
+
+#define BVH_BINS 12
+#define BVH_MAX_LEAF_SIZE 4
+// Cost of visiting a node relative to testing a primitive
+#define BVH_TRAVERSAL_COST 1.0f
+// Also bounds the traversal stacks, as every pop pushes at most two nodes
+#define BVH_MAX_DEPTH 64
+
+#define EMPTY_BOX ((struct cg_box){ \
+	.min = {INFINITY, INFINITY, INFINITY}, \
+	.max = {-INFINITY, -INFINITY, -INFINITY}, \
+})
+
+static float vec_axis(const struct cg_vec3f v, int axis) {
+	return axis == 0 ? v.x : axis == 1 ? v.y : v.z;
+}
+
+static float box_area(const struct cg_box box) {
+	if (box.min.x > box.max.x)
+		return 0.0f;
+
+	return cg_box_surface_area(box);
+}
+
+static struct cg_box node_prims_bounds(const struct cg_bvh *bvh, const struct cg_bvh_node *node) {
+	struct cg_box ret = EMPTY_BOX;
+
+	for (size_t i = node->first; i < node->first + node->count; i++)
+		ret = cg_box_union(ret, bvh->prim_bounds[bvh->prims[i]]);
+
+	return ret;
+}
+
+struct bin {
+	struct cg_box bounds;
+	size_t count;
+};
+
+static size_t bin_index(float centroid, float min, float scale) {
+	size_t b = (centroid - min) * scale;
+
+	return CG_MIN(b, BVH_BINS - 1);
+}
+
+/*
+ * Finds the bin boundary, over the three axes, that minimizes the surface area heuristic
+ * cost. Returns false when keeping the node as a leaf is cheaper or nothing can be split.
+ */
+static bool find_split(const struct cg_bvh *bvh, const struct cg_vec3f *centroids,
+		       const struct cg_bvh_node *node, int *split_axis, size_t *split_bin,
+		       struct cg_box *centroid_bounds) {
+	struct cg_box cb = EMPTY_BOX;
+	for (size_t i = node->first; i < node->first + node->count; i++) {
+		struct cg_vec3f c = centroids[bvh->prims[i]];
+		cb = cg_box_union(cb, (struct cg_box){c, c});
+	}
+
+	float best_cost = INFINITY;
+
+	for (int axis = 0; axis < 3; axis++) {
+		float min = vec_axis(cb.min, axis);
+		float extent = vec_axis(cb.max, axis) - min;
+		if (extent <= 0.0f)
+			continue;
+
+		float scale = BVH_BINS / extent;
+
+		struct bin bins[BVH_BINS];
+		for (size_t b = 0; b < BVH_BINS; b++)
+			bins[b] = (struct bin){EMPTY_BOX, 0};
+
+		for (size_t i = node->first; i < node->first + node->count; i++) {
+			uint32_t prim = bvh->prims[i];
+			struct bin *bin = &bins[bin_index(vec_axis(centroids[prim], axis), min,
+							  scale)];
+
+			bin->bounds = cg_box_union(bin->bounds, bvh->prim_bounds[prim]);
+			bin->count++;
+		}
+
+		// right_cost[b] is the cost of everything in bins b and above
+		float right_cost[BVH_BINS];
+		struct cg_box right = EMPTY_BOX;
+		size_t right_count = 0;
+		for (size_t b = BVH_BINS - 1; b > 0; b--) {
+			right = cg_box_union(right, bins[b].bounds);
+			right_count += bins[b].count;
+			right_cost[b] = right_count * box_area(right);
+		}
+
+		struct cg_box left = EMPTY_BOX;
+		size_t left_count = 0;
+		for (size_t b = 1; b < BVH_BINS; b++) {
+			left = cg_box_union(left, bins[b - 1].bounds);
+			left_count += bins[b - 1].count;
+
+			if (left_count == 0 || left_count == node->count)
+				continue;
+
+			float cost = left_count * box_area(left) + right_cost[b];
+			if (cost < best_cost) {
+				best_cost = cost;
+				*split_axis = axis;
+				*split_bin = b;
+			}
+		}
+	}
+
+	if (best_cost == INFINITY)
+		return false;
+
+	*centroid_bounds = cb;
+
+	float node_area = box_area(node->bounds);
+	best_cost += BVH_TRAVERSAL_COST * node_area;
+
+	return node->count > BVH_MAX_LEAF_SIZE || best_cost < node->count * node_area;
+}
+
+struct cg_bvh cg_bvh_build(const struct cg_box *boxes, size_t count) {
+	struct cg_bvh bvh = {0};
+
+	if (count == 0)
+		return bvh;
+
+	cg_assert(count < UINT32_MAX);
+
+	bvh.num_prims = count;
+	bvh.prims = malloc(count * sizeof(*bvh.prims));
+	bvh.prim_bounds = malloc(count * sizeof(*bvh.prim_bounds));
+	struct cg_vec3f *centroids = malloc(count * sizeof(*centroids));
+	cg_assert(bvh.prims != NULL && bvh.prim_bounds != NULL && centroids != NULL);
+
+	memcpy(bvh.prim_bounds, boxes, count * sizeof(*boxes));
+
+	for (size_t i = 0; i < count; i++) {
+		bvh.prims[i] = i;
+		centroids[i] = (struct cg_vec3f) {
+			(boxes[i].min.x + boxes[i].max.x) * 0.5f,
+			(boxes[i].min.y + boxes[i].max.y) * 0.5f,
+			(boxes[i].min.z + boxes[i].max.z) * 0.5f,
+		};
+	}
+
+	// a binary tree with count leaves never has more than 2 * count - 1 nodes
+	bvh.nodes.capacity = 2 * count - 1;
+	bvh.nodes.items = malloc(bvh.nodes.capacity * sizeof(*bvh.nodes.items));
+	cg_assert(bvh.nodes.items != NULL);
+
+	bvh.nodes.items[0] = (struct cg_bvh_node){.first = 0, .count = count};
+	bvh.nodes.items[0].bounds = node_prims_bounds(&bvh, &bvh.nodes.items[0]);
+	bvh.nodes.len = 1;
+
+	struct {
+		uint32_t node;
+		uint32_t depth;
+	} stack[BVH_MAX_DEPTH];
+	size_t stack_len = 0;
+
+	stack[stack_len].node = 0;
+	stack[stack_len++].depth = 0;
+
+	while (stack_len > 0) {
+		stack_len--;
+		uint32_t node_index = stack[stack_len].node;
+		uint32_t depth = stack[stack_len].depth;
+		struct cg_bvh_node *node = &bvh.nodes.items[node_index];
+
+		if (node->count <= 1 || depth + 1 >= BVH_MAX_DEPTH)
+			continue;
+
+		int axis = 0;
+		size_t split_bin = 0;
+		struct cg_box cb;
+		if (!find_split(&bvh, centroids, node, &axis, &split_bin, &cb))
+			continue;
+
+		float min = vec_axis(cb.min, axis);
+		float scale = BVH_BINS / (vec_axis(cb.max, axis) - min);
+
+		// partition the primitives of the node around the split, like quicksort
+		size_t i = node->first;
+		size_t j = node->first + node->count;
+		while (i < j) {
+			if (bin_index(vec_axis(centroids[bvh.prims[i]], axis), min, scale) < split_bin) {
+				i++;
+			} else {
+				j--;
+				uint32_t tmp = bvh.prims[i];
+				bvh.prims[i] = bvh.prims[j];
+				bvh.prims[j] = tmp;
+			}
+		}
+
+		uint32_t left = bvh.nodes.len;
+		bvh.nodes.len += 2;
+
+		bvh.nodes.items[left] = (struct cg_bvh_node) {
+			.first = node->first,
+			.count = i - node->first,
+		};
+		bvh.nodes.items[left + 1] = (struct cg_bvh_node) {
+			.first = i,
+			.count = node->first + node->count - i,
+		};
+		bvh.nodes.items[left].bounds = node_prims_bounds(&bvh, &bvh.nodes.items[left]);
+		bvh.nodes.items[left + 1].bounds = node_prims_bounds(&bvh, &bvh.nodes.items[left + 1]);
+
+		node->first = left;
+		node->count = 0;
+
+		stack[stack_len].node = left;
+		stack[stack_len++].depth = depth + 1;
+		stack[stack_len].node = left + 1;
+		stack[stack_len++].depth = depth + 1;
+	}
+
+	free(centroids);
+
+	return bvh;
+}
+
+void cg_bvh_destroy(struct cg_bvh *bvh) {
+	free(bvh->nodes.items);
+	free(bvh->prims);
+	free(bvh->prim_bounds);
+
+	*bvh = (struct cg_bvh){0};
+}
+
+// Children come after their parents, so walking backwards sees them first
+void cg_bvh_refit(struct cg_bvh *bvh, const struct cg_box *boxes) {
+	memcpy(bvh->prim_bounds, boxes, bvh->num_prims * sizeof(*boxes));
+
+	for (size_t i = bvh->nodes.len; i-- > 0;) {
+		struct cg_bvh_node *node = &bvh->nodes.items[i];
+
+		if (node->count > 0)
+			node->bounds = node_prims_bounds(bvh, node);
+		else
+			node->bounds = cg_box_union(bvh->nodes.items[node->first].bounds,
+						    bvh->nodes.items[node->first + 1].bounds);
+	}
+}
+
+enum frustum_side {
+	FRUSTUM_OUTSIDE,
+	FRUSTUM_INTERSECTS,
+	FRUSTUM_INSIDE,
+};
+
+static enum frustum_side frustum_classify_box(const struct cg_frustum *frustum,
+					      const struct cg_box box) {
+	enum frustum_side ret = FRUSTUM_INSIDE;
+
+	for (size_t i = 0; i < CG_ARRAY_LEN(frustum->planes); i++) {
+		const struct cg_plane *plane = &frustum->planes[i];
+
+		struct cg_vec3f far = {
+			plane->normal.x >= 0 ? box.max.x : box.min.x,
+			plane->normal.y >= 0 ? box.max.y : box.min.y,
+			plane->normal.z >= 0 ? box.max.z : box.min.z,
+		};
+		struct cg_vec3f near = {
+			plane->normal.x >= 0 ? box.min.x : box.max.x,
+			plane->normal.y >= 0 ? box.min.y : box.max.y,
+			plane->normal.z >= 0 ? box.min.z : box.max.z,
+		};
+
+		if (cg_vec3f_dot(plane->normal, far) + plane->d < 0)
+			return FRUSTUM_OUTSIDE;
+
+		if (cg_vec3f_dot(plane->normal, near) + plane->d < 0)
+			ret = FRUSTUM_INTERSECTS;
+	}
+
+	return ret;
+}
+
+// Subtrees entirely inside the frustum are reported without testing any further box
+void cg_bvh_query_frustum(const struct cg_bvh *bvh, const struct cg_frustum *frustum,
+			  cg_bvh_visit_callback_t visit, void *user_data) {
+	if (bvh->nodes.len == 0)
+		return;
+
+	struct {
+		uint32_t node;
+		bool inside;
+	} stack[BVH_MAX_DEPTH + 1];
+	size_t stack_len = 0;
+
+	stack[stack_len].node = 0;
+	stack[stack_len++].inside = false;
+
+	while (stack_len > 0) {
+		stack_len--;
+		const struct cg_bvh_node *node = &bvh->nodes.items[stack[stack_len].node];
+		bool inside = stack[stack_len].inside;
+
+		if (!inside) {
+			enum frustum_side side = frustum_classify_box(frustum, node->bounds);
+			if (side == FRUSTUM_OUTSIDE)
+				continue;
+
+			inside = side == FRUSTUM_INSIDE;
+		}
+
+		if (node->count == 0) {
+			stack[stack_len].node = node->first;
+			stack[stack_len++].inside = inside;
+			stack[stack_len].node = node->first + 1;
+			stack[stack_len++].inside = inside;
+			continue;
+		}
+
+		for (size_t i = node->first; i < node->first + node->count; i++) {
+			uint32_t prim = bvh->prims[i];
+
+			if (inside || cg_frustum_test_box(frustum, bvh->prim_bounds[prim]))
+				visit(prim, user_data);
+		}
+	}
+}
+
+static bool boxes_overlap(const struct cg_box a, const struct cg_box b) {
+	return a.min.x <= b.max.x && a.max.x >= b.min.x &&
+	       a.min.y <= b.max.y && a.max.y >= b.min.y &&
+	       a.min.z <= b.max.z && a.max.z >= b.min.z;
+}
+
+void cg_bvh_query_box(const struct cg_bvh *bvh, const struct cg_box box,
+		      cg_bvh_visit_callback_t visit, void *user_data) {
+	if (bvh->nodes.len == 0)
+		return;
+
+	uint32_t stack[BVH_MAX_DEPTH + 1];
+	size_t stack_len = 0;
+
+	stack[stack_len++] = 0;
+
+	while (stack_len > 0) {
+		const struct cg_bvh_node *node = &bvh->nodes.items[stack[--stack_len]];
+
+		if (!boxes_overlap(node->bounds, box))
+			continue;
+
+		if (node->count == 0) {
+			stack[stack_len++] = node->first;
+			stack[stack_len++] = node->first + 1;
+			continue;
+		}
+
+		for (size_t i = node->first; i < node->first + node->count; i++) {
+			uint32_t prim = bvh->prims[i];
+
+			if (boxes_overlap(bvh->prim_bounds[prim], box))
+				visit(prim, user_data);
+		}
+	}
+}
+
+// Slab test, returns the entry distance or INFINITY when the box is missed
+static float ray_box_intersect(const struct cg_ray *ray, const struct cg_vec3f inv_dir,
+			       const struct cg_box box, float t_max) {
+	float tx1 = (box.min.x - ray->origin.x) * inv_dir.x;
+	float tx2 = (box.max.x - ray->origin.x) * inv_dir.x;
+	float t_near = fminf(tx1, tx2);
+	float t_far = fmaxf(tx1, tx2);
+
+	float ty1 = (box.min.y - ray->origin.y) * inv_dir.y;
+	float ty2 = (box.max.y - ray->origin.y) * inv_dir.y;
+	t_near = fmaxf(t_near, fminf(ty1, ty2));
+	t_far = fminf(t_far, fmaxf(ty1, ty2));
+
+	float tz1 = (box.min.z - ray->origin.z) * inv_dir.z;
+	float tz2 = (box.max.z - ray->origin.z) * inv_dir.z;
+	t_near = fmaxf(t_near, fminf(tz1, tz2));
+	t_far = fminf(t_far, fmaxf(tz1, tz2));
+
+	if (t_far < t_near || t_far < 0 || t_near > t_max)
+		return INFINITY;
+
+	return t_near;
+}
+
+size_t cg_bvh_ray_cast(const struct cg_bvh *bvh, const struct cg_ray *ray, float t_max,
+		       cg_bvh_intersect_callback_t intersect, void *user_data, float *t) {
+	size_t hit = SIZE_MAX;
+
+	if (bvh->nodes.len == 0)
+		return hit;
+
+	struct cg_vec3f inv_dir = {1.0f / ray->dir.x, 1.0f / ray->dir.y, 1.0f / ray->dir.z};
+
+	uint32_t stack[BVH_MAX_DEPTH + 1];
+	size_t stack_len = 0;
+
+	if (ray_box_intersect(ray, inv_dir, bvh->nodes.items[0].bounds, t_max) == INFINITY)
+		return hit;
+
+	stack[stack_len++] = 0;
+
+	while (stack_len > 0) {
+		const struct cg_bvh_node *node = &bvh->nodes.items[stack[--stack_len]];
+
+		if (node->count > 0) {
+			for (size_t i = node->first; i < node->first + node->count; i++) {
+				float prim_t = intersect(bvh->prims[i], ray, t_max, user_data);
+
+				if (prim_t < t_max) {
+					t_max = prim_t;
+					hit = bvh->prims[i];
+				}
+			}
+			continue;
+		}
+
+		uint32_t near = node->first;
+		uint32_t far = node->first + 1;
+		float t_near = ray_box_intersect(ray, inv_dir, bvh->nodes.items[near].bounds, t_max);
+		float t_far = ray_box_intersect(ray, inv_dir, bvh->nodes.items[far].bounds, t_max);
+
+		if (t_far < t_near) {
+			uint32_t tmp_node = near;
+			near = far;
+			far = tmp_node;
+
+			float tmp_t = t_near;
+			t_near = t_far;
+			t_far = tmp_t;
+		}
+
+		// the nearest child is pushed last so it is visited first
+		if (t_far != INFINITY)
+			stack[stack_len++] = far;
+		if (t_near != INFINITY)
+			stack[stack_len++] = near;
+	}
+
+	if (hit != SIZE_MAX && t != NULL)
+		*t = t_max;
+
+	return hit;
+}
+
+static size_t mesh_num_triangles(const struct cg_mesh *mesh) {
+	return (mesh->num_indices > 0 ? mesh->num_indices : mesh->num_verts) / 3;
+}
+
+static struct cg_vec3f mesh_triangle_vert(const struct cg_mesh *mesh, size_t triangle, size_t i) {
+	size_t index = triangle * 3 + i;
+
+	if (mesh->num_indices > 0)
+		index = mesh->indices[index];
+
+	return cg_vec3f_from_array(&mesh->verts[index * 3]);
+}
+
+// Möller–Trumbore, two sided
+static float ray_triangle_intersect(const struct cg_ray *ray, const struct cg_vec3f a,
+				    const struct cg_vec3f b, const struct cg_vec3f c) {
+	const float epsilon = 1e-8f;
+
+	struct cg_vec3f e1 = cg_vec3f_sub(b, a);
+	struct cg_vec3f e2 = cg_vec3f_sub(c, a);
+
+	struct cg_vec3f p = cg_vec3f_cross(ray->dir, e2);
+	float det = cg_vec3f_dot(e1, p);
+	if (fabsf(det) < epsilon)
+		return INFINITY;
+
+	float inv_det = 1.0f / det;
+	struct cg_vec3f s = cg_vec3f_sub(ray->origin, a);
+
+	float u = cg_vec3f_dot(s, p) * inv_det;
+	if (u < 0.0f || u > 1.0f)
+		return INFINITY;
+
+	struct cg_vec3f q = cg_vec3f_cross(s, e1);
+	float v = cg_vec3f_dot(ray->dir, q) * inv_det;
+	if (v < 0.0f || u + v > 1.0f)
+		return INFINITY;
+
+	float t = cg_vec3f_dot(e2, q) * inv_det;
+
+	return t >= 0.0f ? t : INFINITY;
+}
+
+static float mesh_triangle_intersect(size_t prim, const struct cg_ray *ray, float t_max,
+				     void *user_data) {
+	const struct cg_mesh *mesh = user_data;
+
+	float t = ray_triangle_intersect(ray, mesh_triangle_vert(mesh, prim, 0),
+					 mesh_triangle_vert(mesh, prim, 1),
+					 mesh_triangle_vert(mesh, prim, 2));
+
+	return t <= t_max ? t : INFINITY;
+}
+
+bool cg_mesh_build_bvh(struct cg_mesh *mesh) {
+	if (mesh->verts == NULL || (mesh->num_indices > 0 && mesh->indices == NULL)) {
+		cg_warn("Mesh has no CPU side geometry to build a BVH from\n");
+		return false;
+	}
+
+	size_t num_triangles = mesh_num_triangles(mesh);
+	struct cg_box *boxes = malloc(num_triangles * sizeof(*boxes));
+	cg_assert(num_triangles == 0 || boxes != NULL);
+
+	for (size_t i = 0; i < num_triangles; i++) {
+		struct cg_vec3f v = mesh_triangle_vert(mesh, i, 0);
+		boxes[i] = (struct cg_box){v, v};
+
+		for (size_t j = 1; j < 3; j++) {
+			v = mesh_triangle_vert(mesh, i, j);
+			boxes[i] = cg_box_union(boxes[i], (struct cg_box){v, v});
+		}
+	}
+
+	if (mesh->bvh == NULL)
+		mesh->bvh = malloc(sizeof(*mesh->bvh));
+	else
+		cg_bvh_destroy(mesh->bvh);
+	cg_assert(mesh->bvh != NULL);
+
+	*mesh->bvh = cg_bvh_build(boxes, num_triangles);
+	free(boxes);
+
+	return true;
+}
+
+bool cg_mesh_ray_cast(const struct cg_mesh *mesh, const struct cg_ray *ray, float t_max,
+		      float *t, size_t *triangle) {
+	size_t hit = SIZE_MAX;
+	float hit_t = t_max;
+
+	if (mesh->bvh != NULL) {
+		hit = cg_bvh_ray_cast(mesh->bvh, ray, t_max, mesh_triangle_intersect,
+				      (void *)mesh, &hit_t);
+	} else {
+		struct cg_vec3f inv_dir = {1.0f / ray->dir.x, 1.0f / ray->dir.y, 1.0f / ray->dir.z};
+		float box_t = ray_box_intersect(ray, inv_dir, mesh->bounds, t_max);
+		if (box_t == INFINITY)
+			return false;
+
+		if (mesh->verts == NULL || (mesh->num_indices > 0 && mesh->indices == NULL)) {
+			if (t != NULL)
+				*t = CG_MAX(box_t, 0.0f);
+			if (triangle != NULL)
+				*triangle = SIZE_MAX;
+			return true;
+		}
+
+		for (size_t i = 0; i < mesh_num_triangles(mesh); i++) {
+			float tri_t = mesh_triangle_intersect(i, ray, hit_t, (void *)mesh);
+			if (tri_t < hit_t) {
+				hit_t = tri_t;
+				hit = i;
+			}
+		}
+	}
+
+	if (hit == SIZE_MAX)
+		return false;
+
+	if (t != NULL)
+		*t = hit_t;
+	if (triangle != NULL)
+		*triangle = hit;
+
+	return true;
+}
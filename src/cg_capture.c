@@ -0,0 +1,171 @@
+/*
+ * Copyright Arthur Grillo (c) 2024
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <GL/glew.h>
+
+#include "cg_capture.h"
+#include "cg_core.h"
+#include "cg_util.h"
+
+extern struct cg_contex cg_ctx;
+
+// Two so one frame is read back while the next is drawn
+#define READBACK_SLOTS 2
+
+struct readback {
+	unsigned int pbo;
+	size_t capacity;
+
+	// NULL when nothing is being read into the buffer
+	GLsync fence;
+	uint64_t index;
+	size_t width, height;
+};
+
+/*
+ * The slots are used round robin, so the one the next frame goes to is also the oldest one
+ * in flight, and following it gives the frames in order.
+ */
+static struct {
+	cg_frame_callback_t func;
+	void *user;
+
+	struct readback slots[READBACK_SLOTS];
+	size_t next;
+
+	uint64_t frame_index;
+} capture;
+
+// Hands the frame to the callback, waiting for the GPU to finish it when wait is set
+static bool readback_deliver(struct readback *slot, bool wait) {
+	GLenum res = glClientWaitSync(slot->fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+				      wait ? UINT64_MAX : 0);
+	while (wait && res == GL_TIMEOUT_EXPIRED)
+		res = glClientWaitSync(slot->fence, GL_SYNC_FLUSH_COMMANDS_BIT, UINT64_MAX);
+	cg_assert_gl();
+	cg_assert(res != GL_WAIT_FAILED);
+
+	if (res == GL_TIMEOUT_EXPIRED)
+		return false;
+
+	glDeleteSync(slot->fence);
+	slot->fence = NULL;
+
+	size_t size = slot->width * slot->height * 4;
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, slot->pbo);
+	const unsigned char *pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size,
+						       GL_MAP_READ_BIT);
+	cg_assert_gl();
+	cg_assert(pixels != NULL);
+
+	struct cg_frame frame = {
+		.pixels = pixels,
+		.width = slot->width,
+		.height = slot->height,
+		.index = slot->index,
+	};
+	capture.func(&frame, capture.user);
+
+	glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	cg_assert_gl();
+
+	return true;
+}
+
+// Delivers the finished frames from the oldest, stopping at the first one still in flight
+static void capture_poll(bool wait) {
+	for (size_t i = 0; i < READBACK_SLOTS; i++) {
+		struct readback *slot = &capture.slots[(capture.next + i) % READBACK_SLOTS];
+
+		if (slot->fence == NULL)
+			continue;
+
+		if (!readback_deliver(slot, wait))
+			break;
+	}
+}
+
+static void readback_start(struct readback *slot, uint64_t index) {
+	slot->width = cg_ctx.window.width;
+	slot->height = cg_ctx.window.height;
+	slot->index = index;
+
+	size_t size = slot->width * slot->height * 4;
+
+	if (slot->pbo == 0) {
+		glGenBuffers(1, &slot->pbo);
+		cg_assert(slot->pbo > 0);
+	}
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, slot->pbo);
+	cg_assert_gl();
+
+	if (size > slot->capacity) {
+		glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+		cg_assert_gl();
+		slot->capacity = size;
+	}
+
+	// with a pack buffer bound this only queues the copy, the pointer is an offset in it
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	glReadPixels(0, 0, slot->width, slot->height, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	cg_assert_gl();
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	cg_assert_gl();
+
+	slot->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	cg_assert_gl();
+}
+
+void cg_capture_flush(void) {
+	capture_poll(true);
+}
+
+void cg_set_frame_callback(cg_frame_callback_t func, void *user) {
+	cg_capture_flush();
+
+	capture.func = func;
+	capture.user = user;
+
+	if (func != NULL)
+		return;
+
+	for (size_t i = 0; i < READBACK_SLOTS; i++) {
+		struct readback *slot = &capture.slots[i];
+
+		if (slot->pbo != 0) {
+			glDeleteBuffers(1, &slot->pbo);
+			cg_assert_gl();
+		}
+
+		*slot = (struct readback){0};
+	}
+}
+
+void cg_capture_end_frame(void) {
+	uint64_t index = capture.frame_index++;
+
+	if (capture.func == NULL)
+		return;
+
+	capture_poll(false);
+
+	// about to be reused, this only waits when the GPU is two frames behind
+	struct readback *slot = &capture.slots[capture.next];
+	if (slot->fence != NULL)
+		readback_deliver(slot, true);
+
+	readback_start(slot, index);
+	capture.next = (capture.next + 1) % READBACK_SLOTS;
+}
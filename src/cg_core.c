@@ -6,17 +6,55 @@
  * file, You can obtain one at https://mozilla.org/MPL/2.0/.
  */
 
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include <SDL2/SDL.h>
 
 #include <GL/glew.h>
 
+#ifdef CG_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
 #include "cg_core.h"
 #include "cg_input.h"
 #include "cg_math.h"
 
 struct cg_contex cg_ctx = {0};
 
-void cg_window_create(const char *window_name, size_t width, size_t height) {
+// Everything of creating the context besides making it, once it is current
+static void gl_init(void) {
+	GLenum res = glewInit();
+	// Wayland issues, and EGL contexts have no GLX display either
+	cg_assert(res == GLEW_OK || res == GLEW_ERROR_NO_GLX_DISPLAY);
+
+	cg_info("Plataform: %s - %s\n", glGetString(GL_VENDOR), glGetString(GL_RENDERER));
+	cg_info("GL version: %s\n", glGetString(GL_VERSION));
+	cg_info("GLSL version: %s\n", glGetString(GL_SHADING_LANGUAGE_VERSION));
+
+#if CG_GL_CHECK == CG_GL_CHECK_CALLBACK
+	cg_install_gl_debug_callback();
+#endif
+
+	glEnable(GL_DEPTH_TEST);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	glEnable(GL_BLEND );
+
+	cg_ctx.view_matrix = cg_mat4f_identity();
+	cg_ctx.projection_matrix = cg_mat4f_identity();
+	cg_ctx.gl_state.camera_generation = 1;
+	cg_reset_file_read_callback();
+
+	cg_ctx.fill = true;
+}
+
+static void window_create(const char *window_name, size_t width, size_t height,
+			  Uint32 flags) {
 	cg_assert(!SDL_InitSubSystem(SDL_INIT_VIDEO));
 
 	cg_assert(!SDL_VideoInit(NULL));
@@ -25,7 +63,7 @@ void cg_window_create(const char *window_name, size_t width, size_t height) {
 	SDL_Window *window = SDL_CreateWindow(window_name,
 					      SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
 					      width,  height,
-					      SDL_WINDOW_RESIZABLE | SDL_WINDOW_OPENGL);
+					      flags | SDL_WINDOW_OPENGL);
 	cg_assert(window != NULL);
 	cg_ctx.window = (struct cg_window) {
 		.base = window,
@@ -33,128 +71,168 @@ void cg_window_create(const char *window_name, size_t width, size_t height) {
 		.height = height,
 	};
 
+#if CG_GL_CHECK == CG_GL_CHECK_CALLBACK
+	SDL_GL_SetAttribute(SDL_GL_CONTEXT_FLAGS, SDL_GL_CONTEXT_DEBUG_FLAG);
+#endif
+
 	cg_info("Getting GL context...\n");
 	SDL_GLContext gl_ctx = SDL_GL_CreateContext(window);
 	cg_assert(gl_ctx != NULL);
 
-	GLenum res = glewInit();
-	// Wayland issues
-	cg_assert(res == GLEW_OK || res == GLEW_ERROR_NO_GLX_DISPLAY);
+	gl_init();
+}
 
-	cg_info("Plataform: %s - %s\n", glGetString(GL_VENDOR), glGetString(GL_RENDERER));
-	cg_info("GL version: %s\n", glGetString(GL_VERSION));
-	cg_info("GLSL version: %s\n", glGetString(GL_SHADING_LANGUAGE_VERSION));
+void cg_window_create(const char *window_name, size_t width, size_t height) {
+	window_create(window_name, width, height, SDL_WINDOW_RESIZABLE);
+}
 
-	glEnable(GL_DEPTH_TEST);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-	glEnable(GL_BLEND );
+void cg_window_create_hidden(const char *window_name, size_t width, size_t height) {
+	window_create(window_name, width, height, SDL_WINDOW_HIDDEN);
+}
 
-	cg_ctx.view_matrix = cg_mat4f_identity();
-	cg_ctx.projection_matrix = cg_mat4f_identity();
-	cg_reset_file_read_callback();
+#ifdef CG_EGL
 
-	cg_ctx.fill = true;
+#ifndef EGL_PLATFORM_SURFACELESS_MESA
+#define EGL_PLATFORM_SURFACELESS_MESA 0x31DD
+#endif
+
+static struct {
+	EGLDisplay display;
+	EGLContext context;
+	EGLSurface surface;
+
+	unsigned int fbo;
+	unsigned int color;
+	unsigned int depth;
+} headless;
+
+// The surfaceless platform needs neither a display server nor a window system
+static EGLDisplay headless_display(void) {
+	PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display =
+		(PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+
+	if (get_platform_display != NULL) {
+		EGLDisplay display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA,
+							  EGL_DEFAULT_DISPLAY, NULL);
+		if (display != EGL_NO_DISPLAY && eglInitialize(display, NULL, NULL))
+			return display;
+	}
+
+	EGLDisplay display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	if (display != EGL_NO_DISPLAY && eglInitialize(display, NULL, NULL))
+		return display;
+
+	return EGL_NO_DISPLAY;
 }
 
-static enum cg_keycode sdl2_to_cg_kc(SDL_Keycode kc) {
-	switch (kc) {
-		case SDLK_a:
-			return CG_KEY_A;
-		case SDLK_b:
-			return CG_KEY_B;
-		case SDLK_c:
-			return CG_KEY_C;
-		case SDLK_d:
-			return CG_KEY_D;
-		case SDLK_e:
-			return CG_KEY_E;
-		case SDLK_f:
-			return CG_KEY_F;
-		case SDLK_g:
-			return CG_KEY_G;
-		case SDLK_h:
-			return CG_KEY_H;
-		case SDLK_i:
-			return CG_KEY_I;
-		case SDLK_j:
-			return CG_KEY_J;
-		case SDLK_k:
-			return CG_KEY_K;
-		case SDLK_l:
-			return CG_KEY_L;
-		case SDLK_m:
-			return CG_KEY_M;
-		case SDLK_n:
-			return CG_KEY_N;
-		case SDLK_o:
-			return CG_KEY_O;
-		case SDLK_p:
-			return CG_KEY_P;
-		case SDLK_q:
-			return CG_KEY_Q;
-		case SDLK_r:
-			return CG_KEY_R;
-		case SDLK_s:
-			return CG_KEY_S;
-		case SDLK_t:
-			return CG_KEY_T;
-		case SDLK_u:
-			return CG_KEY_U;
-		case SDLK_v:
-			return CG_KEY_V;
-		case SDLK_w:
-			return CG_KEY_W;
-		case SDLK_x:
-			return CG_KEY_X;
-		case SDLK_y:
-			return CG_KEY_Y;
-		case SDLK_z:
-			return CG_KEY_Z;
-		case SDLK_UP:
-			return CG_KEY_UP;
+static bool egl_has_extension(EGLDisplay display, const char *name) {
+	const char *extensions = eglQueryString(display, EGL_EXTENSIONS);
+	size_t len = strlen(name);
+
+	for (const char *c = extensions; c != NULL && (c = strstr(c, name)) != NULL; c += len) {
+		if ((c == extensions || c[-1] == ' ') && (c[len] == ' ' || c[len] == '\0'))
+			return true;
 	}
 
-	return CG_KEY_UNKNOWN;
-}
-
-static void check_events(void) {
-	SDL_Event e = {0};
-	while(SDL_PollEvent(&e)) {
-		switch (e.type) {
-			case SDL_QUIT:
-				cg_ctx.window_should_close = true;
-				break;
-			case SDL_WINDOWEVENT:;
-			SDL_WindowEvent *w = &e.window;
-			switch (w->event) {
-				case SDL_WINDOWEVENT_SIZE_CHANGED:
-				case SDL_WINDOWEVENT_RESIZED:
-					glViewport(0, 0, w->data1, w->data2);
-					cg_ctx.window.width = w->data1;
-					cg_ctx.window.height = w->data2;
-					break;
-			}
-			break;
-
-			case SDL_KEYDOWN:
-				cg_ctx.keys[sdl2_to_cg_kc(e.key.keysym.sym)] = true;
-			break;
-
-			case SDL_KEYUP:
-				cg_ctx.keys[sdl2_to_cg_kc(e.key.keysym.sym)] = false;
-			break;
-
-			case SDL_MOUSEMOTION:;
-				SDL_MouseMotionEvent *mouse = &e.motion;
-				cg_ctx.mouse_pos = (struct cg_vec2f){mouse->x, mouse->y};
-				cg_ctx.mouse_rel_pos = (struct cg_vec2f){mouse->xrel, mouse->yrel};
-			break;
-		}
+	return false;
+}
+
+// The frames are drawn into the renderbuffers of this instead of a window
+static void headless_create_framebuffer(size_t width, size_t height) {
+	glGenFramebuffers(1, &headless.fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, headless.fbo);
+	cg_assert_gl();
+
+	glGenRenderbuffers(1, &headless.color);
+	glBindRenderbuffer(GL_RENDERBUFFER, headless.color);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER,
+				  headless.color);
+	cg_assert_gl();
+
+	glGenRenderbuffers(1, &headless.depth);
+	glBindRenderbuffer(GL_RENDERBUFFER, headless.depth);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER,
+				  headless.depth);
+	cg_assert_gl();
+
+	cg_assert(glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
+
+	glViewport(0, 0, width, height);
+	cg_assert_gl();
+}
+
+void cg_headless_create(size_t width, size_t height) {
+	cg_info("Getting headless GL context...\n");
+
+	headless.display = headless_display();
+	cg_assert(headless.display != EGL_NO_DISPLAY);
+
+	// without surfaceless contexts a pbuffer stands in, it is never drawn to
+	bool surfaceless = egl_has_extension(headless.display, "EGL_KHR_surfaceless_context");
+
+	EGLint config_attribs[] = {
+		EGL_SURFACE_TYPE, surfaceless ? 0 : EGL_PBUFFER_BIT,
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+		EGL_NONE,
+	};
+
+	EGLConfig config;
+	EGLint num_configs;
+	cg_assert(eglChooseConfig(headless.display, config_attribs, &config, 1, &num_configs));
+	cg_assert(num_configs > 0);
+
+	cg_assert(eglBindAPI(EGL_OPENGL_API));
+
+	EGLint context_attribs[] = {
+#if CG_GL_CHECK == CG_GL_CHECK_CALLBACK
+		EGL_CONTEXT_OPENGL_DEBUG, EGL_TRUE,
+#endif
+		EGL_NONE,
+	};
+
+	headless.context = eglCreateContext(headless.display, config, EGL_NO_CONTEXT,
+					    context_attribs);
+	cg_assert(headless.context != EGL_NO_CONTEXT);
+
+	headless.surface = EGL_NO_SURFACE;
+	if (!surfaceless) {
+		EGLint pbuffer_attribs[] = {EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE};
+
+		headless.surface = eglCreatePbufferSurface(headless.display, config,
+							   pbuffer_attribs);
+		cg_assert(headless.surface != EGL_NO_SURFACE);
 	}
+
+	cg_assert(eglMakeCurrent(headless.display, headless.surface, headless.surface,
+				 headless.context));
+
+	cg_ctx.window = (struct cg_window) {
+		.width = width,
+		.height = height,
+		.headless = true,
+	};
+
+	gl_init();
+	headless_create_framebuffer(width, height);
 }
 
+#else
+
+void cg_headless_create(size_t width, size_t height) {
+	(void) width;
+	(void) height;
+
+	cg_error("cg was built without EGL, there is no headless mode\n");
+	cg_assert(0);
+}
+
+#endif // CG_EGL
+
 bool cg_window_should_close(void) {
-	check_events();
+	cg_input_update();
+
 	return cg_ctx.window_should_close;
 }
 
@@ -167,33 +245,72 @@ void cg_disable_cursor(void) {
 }
 
 void cg_set_file_read_callback(cg_file_reader_callback_t func) {
-	cg_ctx.file_read = func;
+	cg_set_file_callbacks(func, NULL);
 }
 
+void cg_set_file_callbacks(cg_file_reader_callback_t read, cg_file_release_callback_t release) {
+	cg_ctx.file_read = read;
+	cg_ctx.file_release = release;
+}
+
+// mmap can not map empty files, they all share this instead
+static unsigned char empty_file[1];
+
+/*
+ * Maps the file instead of copying it, so the pages come straight from the page cache and
+ * are shared with anything else that has the same file open.
+ */
 static unsigned char* default_file_read_callback(const char *file_path, size_t *file_size) {
-	FILE *fp = fopen(file_path, "r");
-	cg_assert(fp != NULL);
+	int fd = open(file_path, O_RDONLY);
+	if (fd == -1) {
+		cg_error("Could not open %s\n", file_path);
+		return NULL;
+	}
 
-	int ret = fseek(fp, 0, SEEK_END);
-	cg_assert(ret == 0);
-	int size = ftell(fp);
-	cg_assert(size != -1);
-	ret = fseek(fp, 0, SEEK_SET);
-	cg_assert(ret == 0);
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		cg_error("Could not stat %s\n", file_path);
+		close(fd);
+		return NULL;
+	}
+
+	*file_size = st.st_size;
+
+	if (*file_size == 0) {
+		close(fd);
+		return empty_file;
+	}
+
+	unsigned char *data = mmap(NULL, *file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (data == MAP_FAILED) {
+		cg_error("Could not map %s\n", file_path);
+		return NULL;
+	}
 
-	unsigned char *buf = malloc(sizeof(*buf) * size);
-	cg_assert(buf != NULL);
+	// files are parsed or decoded front to back
+	madvise(data, *file_size, MADV_SEQUENTIAL);
 
-	fread(buf, sizeof(*buf) * size, 1, fp);
-	cg_assert(ferror(fp) == 0);
+	return data;
+}
 
-	ret = fclose(fp);
-	cg_assert(ret == 0);
+static void default_file_release_callback(unsigned char *data, size_t file_size) {
+	if (data == empty_file)
+		return;
 
-	*file_size = size;
-	return buf;
+	cg_assert(munmap(data, file_size) == 0);
 }
 
 void cg_reset_file_read_callback() {
-		cg_ctx.file_read = default_file_read_callback;
+	cg_set_file_callbacks(default_file_read_callback, default_file_release_callback);
+}
+
+unsigned char *cg_file_read(const char *file_path, size_t *file_size) {
+	return cg_ctx.file_read(file_path, file_size);
+}
+
+void cg_file_release(unsigned char *data, size_t file_size) {
+	if (data != NULL && cg_ctx.file_release != NULL)
+		cg_ctx.file_release(data, file_size);
 }
@@ -9,11 +9,18 @@
 #include <assert.h>
 #include <math.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
 
+#include <fcntl.h>
+#include <inttypes.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include <SDL2/SDL.h>
 
 #include <GL/glew.h>
@@ -27,10 +34,17 @@
 #define STB_IMAGE_IMPLEMENTATION
 #include "external/stb_image.h"
 
+#include "cg_bvh.h"
+#include "cg_capture.h"
 #include "cg_core.h"
 #include "cg_gfx.h"
 #include "cg_input.h"
+#include "cg_jobs.h"
 #include "cg_math.h"
+#include "cg_profile.h"
+#include "cg_simplify.h"
+#include "cg_stream.h"
+#include "cg_time.h"
 #include "cg_util.h"
 
 #define DEFAULT_TEX_SIZE 32
@@ -41,6 +55,8 @@ static const char* shader_attrib_names[] = {
 	[CG_SATTRIB_LOC_VERTEX_POSITION] = "position",
 	[CG_SATTRIB_LOC_VERTEX_UV] = "uv",
 	[CG_SATTRIB_LOC_VERTEX_NORMAL] = "normal",
+	[CG_SATTRIB_LOC_INSTANCE_MODEL] = "instance_model",
+	[CG_SATTRIB_LOC_INSTANCE_MATERIAL] = "instance_material",
 };
 
 static const char* shader_uniform_names[] = {
@@ -50,35 +66,371 @@ static const char* shader_uniform_names[] = {
 	[CG_SUNIFORM_DIFFUSE_COLOR] = "diffuse_color",
 	[CG_SUNIFORM_DIFFUSE_TEXTURE] = "diffuse_tex",
 	[CG_SUNIFORM_DIFFUSE_TEXTURE_PROVIDED] = "diffuse_tex_provided",
+	[CG_SUNIFORM_DIFFUSE_TEXTURE_ARRAY] = "diffuse_tex_array",
+	[CG_SUNIFORM_DIFFUSE_TEXTURE_LAYER] = "diffuse_tex_layer",
+	[CG_SUNIFORM_MATERIAL_INDEX] = "material_index",
+};
+
+static void state_use_program(unsigned int program) {
+	if (cg_ctx.gl_state.program == program) {
+		cg_ctx.gl_state.calls_avoided++;
+		return;
+	}
+
+	glUseProgram(program);
+	cg_assert_gl();
+	cg_ctx.gl_state.program = program;
+	cg_ctx.frame_stats.binds++;
+}
+
+static void state_bind_vao(unsigned int vao) {
+	if (cg_ctx.gl_state.vao == vao) {
+		cg_ctx.gl_state.calls_avoided++;
+		return;
+	}
+
+	glBindVertexArray(vao);
+	cg_assert_gl();
+	cg_ctx.gl_state.vao = vao;
+	cg_ctx.frame_stats.binds++;
+}
+
+// Texture names are unique across targets, so only the name is tracked per unit
+static void state_bind_texture(unsigned int unit, GLenum target, unsigned int tex) {
+	cg_assert(unit < CG_GL_STATE_TEXTURE_UNITS);
+	struct cg_gl_state *state = &cg_ctx.gl_state;
+
+	if (state->textures[unit] == tex) {
+		state->calls_avoided++;
+		return;
+	}
+
+	if (state->active_texture_unit != unit) {
+		glActiveTexture(GL_TEXTURE0 + unit);
+		cg_assert_gl();
+		state->active_texture_unit = unit;
+	}
+
+	glBindTexture(target, tex);
+	cg_assert_gl();
+	state->textures[unit] = tex;
+	cg_ctx.frame_stats.binds++;
+}
+
+static void state_polygon_fill(bool fill) {
+	if (cg_ctx.gl_state.polygon_line == !fill) {
+		cg_ctx.gl_state.calls_avoided++;
+		return;
+	}
+
+	glPolygonMode(GL_FRONT_AND_BACK, fill ? GL_FILL : GL_LINE);
+	cg_assert_gl();
+	cg_ctx.gl_state.polygon_line = !fill;
+}
+
+#define GL_NAME_POOL_SIZE 64
+
+/*
+ * Buffer and vertex array names released by destroyed meshes, handed out again instead of
+ * generating new ones.
+ */
+struct gl_name_pool {
+	unsigned int names[GL_NAME_POOL_SIZE];
+	size_t len;
+};
+
+static struct gl_name_pool buffer_pool;
+static struct gl_name_pool vao_pool;
+
+static unsigned int gen_buffer(void) {
+	if (buffer_pool.len > 0)
+		return buffer_pool.names[--buffer_pool.len];
+
+	unsigned int buffer;
+	glGenBuffers(1, &buffer);
+	cg_assert(buffer > 0);
+
+	return buffer;
+}
+
+static void delete_buffer(unsigned int buffer) {
+	if (buffer == 0)
+		return;
+
+	if (buffer_pool.len == GL_NAME_POOL_SIZE) {
+		glDeleteBuffers(1, &buffer);
+		cg_assert_gl();
+		return;
+	}
+
+	// Drop the storage, only the name is kept
+	glBindBuffer(GL_ARRAY_BUFFER, buffer);
+	glBufferData(GL_ARRAY_BUFFER, 0, NULL, GL_STATIC_DRAW);
+	cg_assert_gl();
+
+	buffer_pool.names[buffer_pool.len++] = buffer;
+}
+
+static unsigned int gen_vertex_array(void) {
+	if (vao_pool.len > 0)
+		return vao_pool.names[--vao_pool.len];
+
+	unsigned int vao;
+	glGenVertexArrays(1, &vao);
+	cg_assert(vao > 0);
+
+	return vao;
+}
+
+static void delete_vertex_array(unsigned int vao) {
+	if (vao == 0)
+		return;
+
+	if (vao_pool.len == GL_NAME_POOL_SIZE) {
+		if (cg_ctx.gl_state.vao == vao)
+			cg_ctx.gl_state.vao = 0;
+
+		glDeleteVertexArrays(1, &vao);
+		cg_assert_gl();
+		return;
+	}
+
+	// Reset the attribute state so the next mesh starts from a clean vertex array
+	state_bind_vao(vao);
+
+	for (unsigned int loc = 0; loc < CG_SATTRIB_LOC_SIZE; loc++) {
+		glDisableVertexAttribArray(loc);
+		glVertexAttribDivisor(loc, 0);
+	}
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	cg_assert_gl();
+
+	state_bind_vao(0);
+
+	vao_pool.names[vao_pool.len++] = vao;
+}
+
+/*
+ * Returns true if the view and projection matrices must be uploaded to the program, marking
+ * them as up to date.
+ */
+static bool state_camera_outdated(unsigned int program) {
+	struct cg_gl_state *state = &cg_ctx.gl_state;
+
+	while (state->program_camera_generation.len <= program)
+		cg_da_append(&state->program_camera_generation, 0);
+
+	unsigned long *generation = &state->program_camera_generation.items[program];
+	if (*generation == state->camera_generation) {
+		state->calls_avoided += 2;
+		return false;
+	}
+
+	*generation = state->camera_generation;
+	return true;
+}
+
+/*
+ * A draw of one mesh. Instanced items take their model matrices from instance_count entries
+ * of the instance buffer starting at instance_offset, instead of model_matrix.
+ */
+struct draw_item {
+	uint64_t key;
+	const struct cg_mesh *mesh;
+	const struct cg_material *material;
+	struct cg_shader_prg shader;
+	struct cg_mat4f model_matrix;
+	size_t instance_offset;
+	size_t instance_count;
+	size_t lod;
+	bool fill;
+	// into the materials gathered by the flush, SIZE_MAX for draws outside of the queue
+	size_t material_index;
 };
 
+static struct {
+	bool recording;
+	struct CG_DA(struct draw_item) items;
+	struct CG_DA(struct cg_mat4f) instances;
+} render_queue;
+
+// where the instance transforms of the queue, or of the last direct instanced draw, are
+static struct cg_stream_range instance_range;
+
+#define DRAW_KEY_DEPTH_BITS 22
+
+static void draw_mesh(const struct draw_item *item);
+static bool draw_item_batchable(const struct draw_item *item);
+static size_t draw_batch(const struct draw_item *items, size_t count,
+			 const struct cg_mat4f *instances);
+static void materials_upload(struct draw_item *items, size_t count);
+static void frame_block_begin(void);
+
+/*
+ * Distance to the camera along the view direction of a world position, the camera looks down
+ * the -z axis of view space.
+ */
+static float view_depth(const struct cg_mat4f *model_matrix) {
+	const float *v = cg_ctx.view_matrix.d;
+	float x = model_matrix->d[m(3, 0)];
+	float y = model_matrix->d[m(3, 1)];
+	float z = model_matrix->d[m(3, 2)];
+
+	return -(x * v[m(0, 2)] + y * v[m(1, 2)] + z * v[m(2, 2)] + v[m(3, 2)]);
+}
+
+/*
+ * Sort key layout, from the most significant bit:
+ *
+ * opaque:      0 | wireframe | program:12 | texture:12 | vao:16 | depth:22
+ * transparent: 1 | wireframe | ~depth:22  | program:12 | texture:12 | vao:16
+ *
+ * So opaque items are grouped by state and drawn front to back inside each group, while
+ * transparent ones are drawn after them, back to front.
+ */
+static uint64_t draw_item_key(const struct draw_item *item, float depth) {
+	uint32_t depth_bits;
+	depth = CG_MAX(depth, 0.0f);
+	memcpy(&depth_bits, &depth, sizeof(depth_bits));
+	depth_bits >>= 32 - DRAW_KEY_DEPTH_BITS;
+
+	// the multi draw path uses the instanced program for all of them
+	unsigned int program_id = draw_item_batchable(item) ? cg_shader_prg_default_instanced().id
+							    : item->shader.id;
+	uint64_t program = program_id & 0xfff;
+	// bindless textures are not bound, so they do not split the groups
+	const struct cg_texture *diffuse = &item->material->tex_diffuse;
+	uint64_t texture = diffuse->handle != 0 ? 0 : diffuse->gl_tex & 0xfff;
+	uint64_t vao = item->mesh->vao & 0xffff;
+	uint64_t wireframe = !item->fill;
+
+	if (item->material->transparent) {
+		uint64_t inv_depth = ~depth_bits & ((1u << DRAW_KEY_DEPTH_BITS) - 1);
+		return 1ull << 63 | wireframe << 62 | inv_depth << 40 |
+			program << 28 | texture << 16 | vao;
+	}
+
+	return wireframe << 62 | program << 50 | texture << 38 | vao << 22 | depth_bits;
+}
+
+static int draw_item_compare(const void *a, const void *b) {
+	uint64_t key_a = ((const struct draw_item*)a)->key;
+	uint64_t key_b = ((const struct draw_item*)b)->key;
+
+	return (key_a > key_b) - (key_a < key_b);
+}
+
+static void upload_instances(const struct cg_mat4f *transforms, size_t count) {
+	instance_range = cg_stream_upload(transforms, sizeof(*transforms) * count,
+					  sizeof(struct cg_mat4f));
+}
+
+static void render_queue_flush(void) {
+	if (render_queue.instances.len > 0)
+		upload_instances(render_queue.instances.items, render_queue.instances.len);
+
+	qsort(render_queue.items.items, render_queue.items.len, sizeof(*render_queue.items.items),
+	      draw_item_compare);
+
+	materials_upload(render_queue.items.items, render_queue.items.len);
+
+	for (size_t i = 0; i < render_queue.items.len;) {
+		struct draw_item *item = &render_queue.items.items[i];
+
+		state_polygon_fill(item->fill);
+
+		size_t drawn = draw_batch(item, render_queue.items.len - i,
+					  render_queue.instances.items);
+		if (drawn == 0) {
+			draw_mesh(item);
+			drawn = 1;
+		}
+
+		i += drawn;
+	}
+
+	state_polygon_fill(cg_ctx.fill);
+	render_queue.items.len = 0;
+	render_queue.instances.len = 0;
+}
+
+static void loads_upload(void);
+
 void cg_start_render(void) {
+	cg_profile_frame_begin();
+
+	loads_upload();
+
+	cg_ctx.gl_state.frame_calls_avoided = cg_ctx.gl_state.calls_avoided;
+	cg_ctx.gl_state.calls_avoided = 0;
+
+	render_queue.recording = true;
+	render_queue.items.len = 0;
+	render_queue.instances.len = 0;
+
+	frame_block_begin();
+
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-	cg_assert(!cg_check_gl());
+	cg_assert_gl();
 }
 
+static void debug_lines_flush(void);
+
 void cg_end_render(void) {
-	SDL_GL_SwapWindow(cg_ctx.window.base);
+	render_queue_flush();
+	debug_lines_flush();
+	render_queue.recording = false;
+
+	cg_capture_end_frame();
+	cg_stream_end_frame();
+
+	cg_ctx.frame_stats.gl_calls_avoided = cg_ctx.gl_state.calls_avoided;
+	cg_profile_frame_end();
+
+	if (!cg_ctx.window.headless)
+		SDL_GL_SwapWindow(cg_ctx.window.base);
+
+	cg_time_end_frame();
 }
 
 void cg_set_fill(bool fill) {
 	cg_ctx.fill = fill;
-	if (fill) {
-		glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-	} else {
-		glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-	}
-	cg_assert(!cg_check_gl());
+	state_polygon_fill(fill);
 }
 
 bool cg_get_fill() {
 	return cg_ctx.fill;
 }
 
-struct cg_mesh cg_mesh_create(const float *verts, const size_t num_verts,
-			      const int *indices, const size_t num_indices,
-			      const float *normals, const size_t num_normals,
-			      const float *uvs, const size_t num_uvs) {
+size_t cg_get_gl_calls_avoided() {
+	return cg_ctx.gl_state.frame_calls_avoided;
+}
+
+static void find_coord_min_max(const float *vertices, const size_t vert_len,
+			       float *x_min, float *x_max,
+			       float *y_min, float *y_max,
+			       float *z_min, float *z_max) {
+	*x_min = vertices[0];
+	*x_max = vertices[0];
+	*y_min = vertices[1];
+	*y_max = vertices[1];
+	*z_min = vertices[2];
+	*z_max = vertices[2];
+
+	for (size_t i = 0; i < vert_len; i += 1) {
+		*x_min = CG_MIN(vertices[i * 3 + 0], *x_min);
+		*x_max = CG_MAX(vertices[i * 3 + 0], *x_max);
+		*y_min = CG_MIN(vertices[i * 3 + 1], *y_min);
+		*y_max = CG_MAX(vertices[i * 3 + 1], *y_max);
+		*z_min = CG_MIN(vertices[i * 3 + 2], *z_min);
+		*z_max = CG_MAX(vertices[i * 3 + 2], *z_max);
+	}
+}
+
+static struct cg_mesh mesh_init(const float *verts, const size_t num_verts,
+				const int *indices, const size_t num_indices,
+				const float *normals, const size_t num_normals,
+				const float *uvs, const size_t num_uvs) {
 	cg_assert(verts != NULL);
 
 	struct cg_mesh mesh = {0};
@@ -90,14 +442,28 @@ struct cg_mesh cg_mesh_create(const float *verts, const size_t num_verts,
 
 	mesh.num_verts = num_verts;
 
+	find_coord_min_max(mesh.verts, mesh.num_verts,
+			   &mesh.bounds.min.x, &mesh.bounds.max.x,
+			   &mesh.bounds.min.y, &mesh.bounds.max.y,
+			   &mesh.bounds.min.z, &mesh.bounds.max.z);
+
 	if (indices != NULL) {
 		mesh.indices = malloc(sizeof(*mesh.indices) * num_indices);
 		assert(mesh.indices);
 
 		memcpy(mesh.indices, indices, sizeof(*mesh.indices) * num_indices);
 		mesh.num_indices = num_indices;
+
+		int max_index = 0;
+		for (size_t i = 0; i < num_indices; i++)
+			max_index = CG_MAX(max_index, indices[i]);
+
+		mesh.index_type = max_index <= UINT16_MAX ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
 	}
 
+	mesh.num_lods = 1;
+	mesh.lods[0] = (struct cg_mesh_lod){0, mesh.num_indices};
+
 	if (normals != NULL) {
 		mesh.normals = malloc(sizeof(*mesh.normals) * num_normals * 3);
 		assert(mesh.normals);
@@ -116,748 +482,4194 @@ struct cg_mesh cg_mesh_create(const float *verts, const size_t num_verts,
 
 	cg_info("Mesh loaded:\n");
 	cg_info("\tnumber of vertices: %zu\n", num_verts);
-	if (mesh.indices != NULL)
+	if (mesh.indices != NULL) {
 		cg_info("\tnumber of indicies: %zu\n", num_indices);
+		cg_info("\tdedup ratio: %.2f\n", (float)num_indices / num_verts);
+	}
 	if (mesh.normals != NULL)
 		cg_info("\tnumber of normals: %zu\n", num_normals);
 	if (mesh.uvs != NULL)
 		cg_info("\tnumber of uvs: %zu\n", num_uvs);
 
-	glGenVertexArrays(1, &mesh.vao);
-	cg_assert(mesh.vao > 0);
+	return mesh;
+}
+
+static enum cg_mesh_cpu_data mesh_cpu_data = CG_MESH_CPU_DATA_ALL;
 
-	glBindVertexArray(mesh.vao);
-	cg_assert(!cg_check_gl());
+void cg_set_mesh_cpu_data(enum cg_mesh_cpu_data keep) {
+	mesh_cpu_data = keep;
+}
 
-	glGenBuffers(1, &mesh.vbo);
-	cg_assert(mesh.vbo > 0);
+static void mesh_release_cpu_data(struct cg_mesh *mesh) {
+	if (mesh_cpu_data == CG_MESH_CPU_DATA_ALL)
+		return;
 
-	if (mesh.indices != NULL) {
-		glGenBuffers(1, &mesh.ebo);
+	free(mesh->normals);
+	mesh->normals = NULL;
+	free(mesh->uvs);
+	mesh->uvs = NULL;
+
+	if (mesh_cpu_data == CG_MESH_CPU_DATA_GEOMETRY)
+		return;
+
+	free(mesh->verts);
+	mesh->verts = NULL;
+	free(mesh->indices);
+	mesh->indices = NULL;
+}
+
+// a level is only kept when it has at most this fraction of the indices of the previous one
+#define LOD_MIN_REDUCTION 0.9f
+
+static size_t mesh_lods = 1;
+
+void cg_set_mesh_lods(size_t count) {
+	cg_assert(count >= 1 && count <= CG_MESH_MAX_LODS);
+
+	mesh_lods = count;
+}
+
+/*
+ * Indices of every level of detail one after the other, the first being the given ones, with
+ * their ranges in lods. The simplification stops early once it no longer removes a
+ * meaningful part of the triangles.
+ */
+static int *build_lods(const int *indices, size_t num_indices,
+		       const float *verts, size_t num_verts,
+		       struct cg_mesh_lod *lods, size_t *num_lods, size_t *total_indices) {
+	int *ret = malloc(sizeof(*ret) * num_indices * mesh_lods);
+	cg_assert(ret != NULL);
+
+	memcpy(ret, indices, sizeof(*ret) * num_indices);
+	size_t len = num_indices;
+
+	lods[0] = (struct cg_mesh_lod){0, num_indices};
+	*num_lods = 1;
+
+	while (*num_lods < mesh_lods) {
+		const struct cg_mesh_lod *prev = &lods[*num_lods - 1];
+
+		float error;
+		size_t count = cg_simplify(&ret[len], &ret[prev->first_index], prev->num_indices,
+					   verts, num_verts, prev->num_indices / 2, &error);
+
+		if (count == 0 || count > prev->num_indices * LOD_MIN_REDUCTION)
+			break;
+
+		cg_info("\tlod %zu: %zu indices, error %f\n", *num_lods, count, error);
+
+		lods[(*num_lods)++] = (struct cg_mesh_lod){len, count};
+		len += count;
+	}
+
+	*total_indices = len;
+	return ret;
+}
+
+static size_t index_size(GLenum index_type) {
+	return index_type == GL_UNSIGNED_SHORT ? sizeof(unsigned short) : sizeof(unsigned int);
+}
+
+// Converts indices to the type the element buffer holds
+static void *pack_indices(const int *indices, size_t num_indices, GLenum index_type) {
+	void *ret = malloc(index_size(index_type) * num_indices);
+	cg_assert(ret != NULL);
+
+	if (index_type == GL_UNSIGNED_SHORT) {
+		unsigned short *short_indices = ret;
+
+		for (size_t i = 0; i < num_indices; i++)
+			short_indices[i] = indices[i];
+	} else {
+		memcpy(ret, indices, sizeof(*indices) * num_indices);
 	}
 
+	return ret;
+}
+
+/*
+ * Indices of every level of detail of the mesh in the type of its element buffer, NULL when
+ * it has none. num_indices is set to their count.
+ */
+static void *mesh_pack_indices(struct cg_mesh *mesh, size_t *num_indices) {
+	*num_indices = 0;
+	if (mesh->indices == NULL)
+		return NULL;
+
+	*num_indices = mesh->num_indices;
+	int *indices = mesh->indices;
+	if (mesh_lods > 1)
+		indices = build_lods(mesh->indices, mesh->num_indices, mesh->verts, mesh->num_verts,
+				     mesh->lods, &mesh->num_lods, num_indices);
+
+	void *packed = pack_indices(indices, *num_indices, mesh->index_type);
+
+	if (indices != mesh->indices)
+		free(indices);
+
+	return packed;
+}
+
+// Creates the element buffer of the mesh, its VAO must be bound
+static void mesh_upload_element_buffer(struct cg_mesh *mesh, const void *indices,
+				       size_t num_indices) {
+	if (indices == NULL)
+		return;
+
+	mesh->ebo = gen_buffer();
+
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->ebo);
+	cg_assert_gl();
+
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, index_size(mesh->index_type) * num_indices,
+		     indices, GL_STATIC_DRAW);
+	cg_assert_gl();
+}
+
+static void mesh_upload_indices(struct cg_mesh *mesh) {
+	size_t num_indices;
+	void *packed = mesh_pack_indices(mesh, &num_indices);
+
+	mesh_upload_element_buffer(mesh, packed, num_indices);
+
+	free(packed);
+}
+
+struct cg_mesh cg_mesh_create(const float *verts, const size_t num_verts,
+			      const int *indices, const size_t num_indices,
+			      const float *normals, const size_t num_normals,
+			      const float *uvs, const size_t num_uvs) {
+	struct cg_mesh mesh = mesh_init(verts, num_verts,
+					indices, num_indices,
+					normals, num_normals,
+					uvs, num_uvs);
+
+	mesh.vao = gen_vertex_array();
+
+	state_bind_vao(mesh.vao);
+
+	mesh.vbo = gen_buffer();
+
 	if (mesh.normals != NULL) {
-		glGenBuffers(1, &mesh.nbo);
+		mesh.nbo = gen_buffer();
 	}
 
 	if (mesh.uvs != NULL) {
-		glGenBuffers(1, &mesh.tbo);
+		mesh.tbo = gen_buffer();
 	}
 
 	glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo);
-	cg_assert(!cg_check_gl());
+	cg_assert_gl();
 
 	glBufferData(GL_ARRAY_BUFFER, sizeof(*mesh.verts) * mesh.num_verts * 3, mesh.verts,
 		     GL_STATIC_DRAW);
-	cg_assert(!cg_check_gl());
+	cg_assert_gl();
 
 	glVertexAttribPointer(CG_SATTRIB_LOC_VERTEX_POSITION, 3, GL_FLOAT, GL_FALSE,
 			      sizeof(*mesh.verts) * 3, 0);
-	cg_assert(!cg_check_gl());
+	cg_assert_gl();
 
 	glEnableVertexAttribArray(CG_SATTRIB_LOC_VERTEX_POSITION);
-	cg_assert(!cg_check_gl());
-
-	if (mesh.indices != NULL) {
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.ebo);
-		cg_assert(!cg_check_gl());
+	cg_assert_gl();
 
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(*mesh.indices) * num_indices,
-			     mesh.indices, GL_STATIC_DRAW);
-		cg_assert(!cg_check_gl());
-	}
+	mesh_upload_indices(&mesh);
 
 	if (mesh.uvs != NULL) {
 		glBindBuffer(GL_ARRAY_BUFFER, mesh.tbo);
-		cg_assert(!cg_check_gl());
+		cg_assert_gl();
 
 		glBufferData(GL_ARRAY_BUFFER, sizeof(*mesh.uvs) * mesh.num_uvs * 2,
 			     mesh.uvs, GL_STATIC_DRAW);
-		cg_assert(!cg_check_gl());
+		cg_assert_gl();
 
 		glVertexAttribPointer(CG_SATTRIB_LOC_VERTEX_UV, 2, GL_FLOAT, GL_FALSE,
 				      sizeof(*mesh.uvs) * 2, 0);
-		cg_assert(!cg_check_gl());
+		cg_assert_gl();
 
 		glEnableVertexAttribArray(CG_SATTRIB_LOC_VERTEX_UV);
-		cg_assert(!cg_check_gl());
+		cg_assert_gl();
 	}
 
 	if (mesh.normals != NULL) {
 		glBindBuffer(GL_ARRAY_BUFFER, mesh.nbo);
-		cg_assert(!cg_check_gl());
+		cg_assert_gl();
 
 		glBufferData(GL_ARRAY_BUFFER, sizeof(*mesh.normals) * mesh.num_normals * 3,
 			     mesh.normals, GL_STATIC_DRAW);
-		cg_assert(!cg_check_gl());
+		cg_assert_gl();
 
 		glVertexAttribPointer(CG_SATTRIB_LOC_VERTEX_NORMAL, 3, GL_FLOAT, GL_FALSE,
 				      sizeof(*mesh.normals) * 3, 0);
-		cg_assert(!cg_check_gl());
+		cg_assert_gl();
 
 		glEnableVertexAttribArray(CG_SATTRIB_LOC_VERTEX_NORMAL);
-		cg_assert(!cg_check_gl());
+		cg_assert_gl();
 	}
 
+	mesh_release_cpu_data(&mesh);
+
 	return mesh;
 }
 
-static unsigned int create_shader(const char *src, int length, GLenum type) {
-	unsigned int shader = glCreateShader(type);
-	cg_assert(shader != 0);
+static void mesh_arena_free(const struct cg_mesh *mesh);
 
-	if (length < 1)
-		glShaderSource(shader, 1, &src, NULL);
+void cg_mesh_destroy(struct cg_mesh *mesh) {
+	if (mesh->arena != NULL)
+		mesh_arena_free(mesh);
 	else
-		glShaderSource(shader, 1, &src, &length);
-	cg_assert(!cg_check_gl());
+		delete_vertex_array(mesh->vao);
+	delete_buffer(mesh->vbo);
+	delete_buffer(mesh->ebo);
+	delete_buffer(mesh->nbo);
+	delete_buffer(mesh->tbo);
+
+	free(mesh->verts);
+	free(mesh->indices);
+	free(mesh->normals);
+	free(mesh->uvs);
+
+	if (mesh->bvh != NULL) {
+		cg_bvh_destroy(mesh->bvh);
+		free(mesh->bvh);
+	}
 
-	glCompileShader(shader);
-	cg_assert(!cg_check_gl());
+	*mesh = (struct cg_mesh){0};
+}
 
-	int status;
-	glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
-	cg_assert(!cg_check_gl());
+static unsigned short float_to_half(float f) {
+	uint32_t x;
+	memcpy(&x, &f, sizeof(x));
 
-	char info_log[1024];
-	if (status == false) {
-		glGetShaderInfoLog(shader, 1024, NULL, info_log);
-		cg_error("Shader compilation error: %s", info_log);
-		cg_assert(0);
+	uint32_t sign = (x >> 16) & 0x8000;
+	uint32_t mantissa = x & 0x7fffff;
+	int exponent = (int)((x >> 23) & 0xff) - 127 + 15;
+
+	if (((x >> 23) & 0xff) == 0xff)
+		return sign | 0x7c00 | (mantissa != 0 ? 0x200 : 0);
+
+	if (exponent >= 0x1f)
+		return sign | 0x7c00;
+
+	if (exponent <= 0) {
+		if (exponent < -10)
+			return sign;
+
+		mantissa |= 0x800000;
+		int shift = 14 - exponent;
+		uint32_t half = mantissa >> shift;
+		if ((mantissa >> (shift - 1)) & 1)
+			half++;
+		return sign | half;
 	}
 
-	return shader;
+	uint32_t half = sign | (exponent << 10) | (mantissa >> 13);
+	if (mantissa & 0x1000)
+		half++;
+	return half;
 }
 
-void cg_shader_prg_builder_add_shader(struct cg_shader_prg_builder *builder, const char *src,
-				      int length,
-				      GLenum type) {
-	unsigned int shader = create_shader(src, length, type);
-	cg_da_append(&builder->shaders, shader);
-}
+static uint32_t pack_int_2_10_10_10(const float *v) {
+	uint32_t packed = 0;
 
-static void bind_loc(unsigned int prg, enum cg_shader_attrib_loc loc) {
-	glBindAttribLocation(prg, loc, shader_attrib_names[loc]);
-	cg_assert(!cg_check_gl());
+	for (size_t i = 0; i < 3; i++) {
+		int c = lroundf(CG_MAX(-1.0f, CG_MIN(1.0f, v[i])) * 511.0f);
+		packed |= ((uint32_t)c & 0x3ff) << (i * 10);
+	}
+
+	return packed;
 }
 
-struct cg_shader_prg cg_shader_prg_builder_build(struct cg_shader_prg_builder *builder) {
-	struct cg_shader_prg prg = {0};
+struct vertex_attrib_format {
+	int size;
+	GLenum type;
+	bool normalized;
+	size_t bytes;
+};
 
-	prg.id = glCreateProgram();
-	cg_assert(prg.id != 0);
+static const struct vertex_attrib_format
+vertex_formats[CG_VERTEX_FORMAT_SIZE][CG_SATTRIB_LOC_SIZE] = {
+	[CG_VERTEX_FORMAT_FLOAT] = {
+		[CG_SATTRIB_LOC_VERTEX_POSITION] = {3, GL_FLOAT, GL_FALSE, sizeof(float) * 3},
+		[CG_SATTRIB_LOC_VERTEX_NORMAL] = {3, GL_FLOAT, GL_FALSE, sizeof(float) * 3},
+		[CG_SATTRIB_LOC_VERTEX_UV] = {2, GL_FLOAT, GL_FALSE, sizeof(float) * 2},
+	},
+	[CG_VERTEX_FORMAT_COMPACT] = {
+		[CG_SATTRIB_LOC_VERTEX_POSITION] = {3, GL_FLOAT, GL_FALSE, sizeof(float) * 3},
+		[CG_SATTRIB_LOC_VERTEX_NORMAL] = {4, GL_INT_2_10_10_10_REV, GL_TRUE,
+						  sizeof(uint32_t)},
+		[CG_SATTRIB_LOC_VERTEX_UV] = {2, GL_HALF_FLOAT, GL_FALSE, sizeof(uint16_t) * 2},
+	},
+};
 
-	for (size_t i = 0; i < builder->shaders.len; i++) {
-		unsigned int shader = builder->shaders.items[i];
+/*
+ * Stride of an interleaved vertex holding the attributes whose bit is set in attribs, and the
+ * offset of each of them inside it. Missing attributes take no space, their offsets are -1.
+ */
+static size_t vertex_layout(enum cg_vertex_format format, unsigned int attribs,
+			    long offsets[CG_SATTRIB_LOC_SIZE]) {
+	size_t stride = 0;
 
-		glAttachShader(prg.id, shader);
-		cg_assert(!cg_check_gl());
+	for (size_t loc = 0; loc < CG_SATTRIB_LOC_SIZE; loc++) {
+		offsets[loc] = -1;
+		if (!(attribs & 1u << loc))
+			continue;
+
+		offsets[loc] = stride;
+		stride += vertex_formats[format][loc].bytes;
 	}
 
-	bind_loc(prg.id, CG_SATTRIB_LOC_VERTEX_POSITION);
-	bind_loc(prg.id, CG_SATTRIB_LOC_VERTEX_UV);
+	return stride;
+}
 
-	glLinkProgram(prg.id);
-	cg_assert(!cg_check_gl());
+static unsigned int mesh_attribs(const struct cg_mesh *mesh) {
+	unsigned int attribs = 1u << CG_SATTRIB_LOC_VERTEX_POSITION;
 
-	int status;
-	char info_log[1024];
-	glGetProgramiv(prg.id, GL_LINK_STATUS, &status);
-	cg_assert(!cg_check_gl());
+	if (mesh->normals != NULL)
+		attribs |= 1u << CG_SATTRIB_LOC_VERTEX_NORMAL;
+	if (mesh->uvs != NULL)
+		attribs |= 1u << CG_SATTRIB_LOC_VERTEX_UV;
 
+	return attribs;
+}
+
+/*
+ * Pack the CPU side attributes of a mesh into a single array of vertices, returning the
+ * stride of one vertex and the offset of each attribute inside it, see vertex_layout.
+ */
+static unsigned char *interleave_vertices(const struct cg_mesh *mesh,
+					  enum cg_vertex_format format,
+					  size_t *stride,
+					  long offsets[CG_SATTRIB_LOC_SIZE]) {
+	*stride = vertex_layout(format, mesh_attribs(mesh), offsets);
+
+	unsigned char *data = malloc(*stride * mesh->num_verts);
+	cg_assert(data != NULL);
+
+	for (size_t i = 0; i < mesh->num_verts; i++) {
+		unsigned char *vertex = data + i * *stride;
+
+		memcpy(vertex + offsets[CG_SATTRIB_LOC_VERTEX_POSITION], &mesh->verts[i * 3],
+		       sizeof(float) * 3);
+
+		if (mesh->normals != NULL) {
+			unsigned char *dst = vertex + offsets[CG_SATTRIB_LOC_VERTEX_NORMAL];
+			if (format == CG_VERTEX_FORMAT_COMPACT) {
+				uint32_t packed = pack_int_2_10_10_10(&mesh->normals[i * 3]);
+				memcpy(dst, &packed, sizeof(packed));
+			} else {
+				memcpy(dst, &mesh->normals[i * 3], sizeof(float) * 3);
+			}
+		}
+
+		if (mesh->uvs != NULL) {
+			unsigned char *dst = vertex + offsets[CG_SATTRIB_LOC_VERTEX_UV];
+			if (format == CG_VERTEX_FORMAT_COMPACT) {
+				uint16_t half[2] = {
+					float_to_half(mesh->uvs[i * 2 + 0]),
+					float_to_half(mesh->uvs[i * 2 + 1]),
+				};
+				memcpy(dst, half, sizeof(half));
+			} else {
+				memcpy(dst, &mesh->uvs[i * 2], sizeof(float) * 2);
+			}
+		}
+	}
+
+	return data;
+}
+
+// Creates the VAO of an interleaved mesh and fills its vertex buffer with data
+static void mesh_upload_vertices(struct cg_mesh *mesh, const void *data, size_t stride,
+				 const long offsets[CG_SATTRIB_LOC_SIZE]) {
+	mesh->vao = gen_vertex_array();
+
+	state_bind_vao(mesh->vao);
+
+	mesh->vbo = gen_buffer();
+
+	glBindBuffer(GL_ARRAY_BUFFER, mesh->vbo);
+	cg_assert_gl();
+
+	glBufferData(GL_ARRAY_BUFFER, stride * mesh->num_verts, data, GL_STATIC_DRAW);
+	cg_assert_gl();
+
+	for (size_t loc = 0; loc < CG_SATTRIB_LOC_SIZE; loc++) {
+		if (offsets[loc] == -1)
+			continue;
+
+		const struct vertex_attrib_format *attrib = &vertex_formats[mesh->vertex_format][loc];
+
+		glVertexAttribPointer(loc, attrib->size, attrib->type, attrib->normalized,
+				      stride, (void*)offsets[loc]);
+		cg_assert_gl();
+
+		glEnableVertexAttribArray(loc);
+		cg_assert_gl();
+	}
+}
+
+static bool multi_draw;
+
+bool cg_set_multi_draw(bool enable) {
+	multi_draw = enable && (GLEW_VERSION_4_3 ||
+				(GLEW_ARB_multi_draw_indirect && GLEW_ARB_base_instance));
+
+	return multi_draw;
+}
+
+// In vertices or indices, depending on the buffer
+struct arena_range {
+	size_t offset;
+	size_t size;
+};
+
+// A buffer of an arena and its ranges no mesh uses, sorted by offset
+struct arena_space {
+	unsigned int buffer;
+	size_t capacity;
+	struct CG_DA(struct arena_range) free;
+};
+
+/*
+ * Vertex and index buffers shared by the meshes of one layout. They all draw from the same
+ * vertex array, their first vertex and index telling them apart, so a run of them can be
+ * drawn by a single multi draw.
+ */
+struct cg_mesh_arena {
+	enum cg_vertex_format format;
+	unsigned int attribs;
+	GLenum index_type;
+
+	size_t stride;
+	long offsets[CG_SATTRIB_LOC_SIZE];
+
+	unsigned int vao;
+	struct arena_space vertices;
+	struct arena_space indices;
+};
+
+static struct CG_DA(struct cg_mesh_arena*) mesh_arenas;
+
+// the least a buffer of an arena grows to, in vertices and indices
+#define ARENA_MIN_VERTICES (1 << 16)
+#define ARENA_MIN_INDICES (3 << 16)
+
+// First fit, returns SIZE_MAX when no free range is large enough
+static size_t arena_space_take(struct arena_space *space, size_t size) {
+	for (size_t i = 0; i < space->free.len; i++) {
+		struct arena_range *range = &space->free.items[i];
+
+		if (range->size < size)
+			continue;
+
+		size_t offset = range->offset;
+		range->offset += size;
+		range->size -= size;
+
+		if (range->size == 0) {
+			memmove(range, range + 1, sizeof(*range) * (space->free.len - i - 1));
+			space->free.len--;
+		}
+
+		return offset;
+	}
+
+	return SIZE_MAX;
+}
+
+// Gives a range back, merging it with the free ranges around it
+static void arena_space_give(struct arena_space *space, size_t offset, size_t size) {
+	struct arena_range *ranges = space->free.items;
+	size_t len = space->free.len;
+
+	size_t i = 0;
+	while (i < len && ranges[i].offset < offset)
+		i++;
+
+	bool prev = i > 0 && ranges[i - 1].offset + ranges[i - 1].size == offset;
+	bool next = i < len && offset + size == ranges[i].offset;
+
+	if (prev && next) {
+		ranges[i - 1].size += size + ranges[i].size;
+		memmove(&ranges[i], &ranges[i + 1], sizeof(*ranges) * (len - i - 1));
+		space->free.len--;
+	} else if (prev) {
+		ranges[i - 1].size += size;
+	} else if (next) {
+		ranges[i].offset = offset;
+		ranges[i].size += size;
+	} else {
+		cg_da_append(&space->free, ((struct arena_range){0}));
+		ranges = space->free.items;
+
+		memmove(&ranges[i + 1], &ranges[i], sizeof(*ranges) * (len - i));
+		ranges[i] = (struct arena_range){offset, size};
+	}
+}
+
+/*
+ * Moves the contents of the space into a buffer with room for at least size more elements,
+ * the GPU doing the copy. The space added at the end is free.
+ */
+static void arena_space_grow(struct arena_space *space, size_t size, size_t elem_size,
+			     size_t min_capacity) {
+	size_t capacity = CG_MAX(space->capacity * 2, space->capacity + size);
+	capacity = CG_MAX(capacity, min_capacity);
+
+	unsigned int buffer = gen_buffer();
+
+	glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+	cg_assert_gl();
+
+	glBufferData(GL_COPY_WRITE_BUFFER, capacity * elem_size, NULL, GL_STATIC_DRAW);
+	cg_assert_gl();
+
+	if (space->buffer != 0) {
+		glBindBuffer(GL_COPY_READ_BUFFER, space->buffer);
+		cg_assert_gl();
+
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0,
+				    space->capacity * elem_size);
+		cg_assert_gl();
+
+		delete_buffer(space->buffer);
+	}
+
+	arena_space_give(space, space->capacity, capacity - space->capacity);
+
+	space->buffer = buffer;
+	space->capacity = capacity;
+}
+
+// Points the vertex array of the arena to its current buffers
+static void arena_attach_buffers(struct cg_mesh_arena *arena) {
+	state_bind_vao(arena->vao);
+
+	glBindBuffer(GL_ARRAY_BUFFER, arena->vertices.buffer);
+	cg_assert_gl();
+
+	for (size_t loc = 0; loc < CG_SATTRIB_LOC_SIZE; loc++) {
+		if (arena->offsets[loc] == -1)
+			continue;
+
+		const struct vertex_attrib_format *attrib = &vertex_formats[arena->format][loc];
+
+		glVertexAttribPointer(loc, attrib->size, attrib->type, attrib->normalized,
+				      arena->stride, (void*)arena->offsets[loc]);
+		cg_assert_gl();
+
+		glEnableVertexAttribArray(loc);
+		cg_assert_gl();
+	}
+
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, arena->indices.buffer);
+	cg_assert_gl();
+}
+
+static size_t arena_alloc(struct cg_mesh_arena *arena, struct arena_space *space, size_t size,
+			  size_t elem_size, size_t min_capacity) {
+	size_t offset = arena_space_take(space, size);
+	if (offset != SIZE_MAX)
+		return offset;
+
+	arena_space_grow(space, size, elem_size, min_capacity);
+	arena_attach_buffers(arena);
+
+	offset = arena_space_take(space, size);
+	cg_assert(offset != SIZE_MAX);
+
+	return offset;
+}
+
+static struct cg_mesh_arena *mesh_arena_get(enum cg_vertex_format format, unsigned int attribs,
+					    GLenum index_type) {
+	for (size_t i = 0; i < mesh_arenas.len; i++) {
+		struct cg_mesh_arena *arena = mesh_arenas.items[i];
+
+		if (arena->format == format && arena->attribs == attribs &&
+		    arena->index_type == index_type)
+			return arena;
+	}
+
+	struct cg_mesh_arena *arena = calloc(1, sizeof(*arena));
+	cg_assert(arena != NULL);
+
+	arena->format = format;
+	arena->attribs = attribs;
+	arena->index_type = index_type;
+	arena->stride = vertex_layout(format, attribs, arena->offsets);
+	arena->vao = gen_vertex_array();
+
+	cg_da_append(&mesh_arenas, arena);
+
+	return arena;
+}
+
+static size_t mesh_total_indices(const struct cg_mesh *mesh) {
+	const struct cg_mesh_lod *last = &mesh->lods[mesh->num_lods - 1];
+
+	return last->first_index + last->num_indices;
+}
+
+/*
+ * Places an interleaved mesh in the arena of its layout when multi draw is enabled, returning
+ * false otherwise so it gets buffers of its own. indices are packed to the index type of the
+ * mesh, num_indices counting the ones of every level of detail.
+ */
+static bool mesh_upload_arena(struct cg_mesh *mesh, unsigned int attribs, const void *vertices,
+			      const void *indices, size_t num_indices) {
+	if (!multi_draw)
+		return false;
+
+	struct cg_mesh_arena *arena = mesh_arena_get(mesh->vertex_format, attribs,
+						     mesh->index_type);
+
+	mesh->arena = arena;
+	mesh->base_vertex = arena_alloc(arena, &arena->vertices, mesh->num_verts, arena->stride,
+					ARENA_MIN_VERTICES);
+
+	// the copy target leaves the vertex array of whatever is bound alone
+	glBindBuffer(GL_COPY_WRITE_BUFFER, arena->vertices.buffer);
+	cg_assert_gl();
+
+	glBufferSubData(GL_COPY_WRITE_BUFFER, mesh->base_vertex * arena->stride,
+			mesh->num_verts * arena->stride, vertices);
+	cg_assert_gl();
+
+	if (num_indices > 0) {
+		size_t size = index_size(mesh->index_type);
+		mesh->base_index = arena_alloc(arena, &arena->indices, num_indices, size,
+					       ARENA_MIN_INDICES);
+
+		glBindBuffer(GL_COPY_WRITE_BUFFER, arena->indices.buffer);
+		cg_assert_gl();
+
+		glBufferSubData(GL_COPY_WRITE_BUFFER, mesh->base_index * size, num_indices * size,
+				indices);
+		cg_assert_gl();
+	}
+
+	mesh->vao = arena->vao;
+
+	return true;
+}
+
+static void mesh_arena_free(const struct cg_mesh *mesh) {
+	struct cg_mesh_arena *arena = mesh->arena;
+
+	arena_space_give(&arena->vertices, mesh->base_vertex, mesh->num_verts);
+	if (mesh->num_indices > 0)
+		arena_space_give(&arena->indices, mesh->base_index, mesh_total_indices(mesh));
+}
+
+struct cg_mesh cg_mesh_create_interleaved(const float *verts, const size_t num_verts,
+					  const int *indices, const size_t num_indices,
+					  const float *normals, const float *uvs,
+					  enum cg_vertex_format format) {
+	struct cg_mesh mesh = mesh_init(verts, num_verts,
+					indices, num_indices,
+					normals, num_verts,
+					uvs, num_verts);
+	mesh.interleaved = true;
+	mesh.vertex_format = format;
+
+	size_t stride;
+	long offsets[CG_SATTRIB_LOC_SIZE];
+	unsigned char *data = interleave_vertices(&mesh, format, &stride, offsets);
+
+	size_t total_indices;
+	void *packed = mesh_pack_indices(&mesh, &total_indices);
+
+	if (!mesh_upload_arena(&mesh, mesh_attribs(&mesh), data, packed, total_indices)) {
+		mesh_upload_vertices(&mesh, data, stride, offsets);
+		mesh_upload_element_buffer(&mesh, packed, total_indices);
+	}
+
+	free(packed);
+	free(data);
+
+	mesh_release_cpu_data(&mesh);
+
+	return mesh;
+}
+
+static unsigned int create_shader(const char *src, int length, GLenum type) {
+	unsigned int shader = glCreateShader(type);
+	cg_assert(shader != 0);
+
+	if (length < 1)
+		glShaderSource(shader, 1, &src, NULL);
+	else
+		glShaderSource(shader, 1, &src, &length);
+	cg_assert_gl();
+
+	glCompileShader(shader);
+	cg_assert_gl();
+
+	int status;
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+	cg_assert_gl();
+
+	char info_log[1024];
 	if (status == false) {
-		glGetProgramInfoLog(prg.id, 1024, NULL, info_log);
-		cg_error("Shader program linking error: %s\n", info_log);
+		glGetShaderInfoLog(shader, 1024, NULL, info_log);
+		cg_error("Shader compilation error: %s", info_log);
 		cg_assert(0);
 	}
 
+	return shader;
+}
+
+void cg_shader_prg_builder_add_shader(struct cg_shader_prg_builder *builder, const char *src,
+				      int length,
+				      GLenum type) {
+	unsigned int shader = create_shader(src, length, type);
+	cg_da_append(&builder->shaders, shader);
+}
+
+static void bind_loc(unsigned int prg, enum cg_shader_attrib_loc loc) {
+	glBindAttribLocation(prg, loc, shader_attrib_names[loc]);
+	cg_assert_gl();
+}
+
+#define FRAME_BLOCK_NAME "cg_frame"
+#define MATERIAL_BLOCK_NAME "cg_materials"
+
+// Points the uniform block of the program to binding, returns false if it has no such block
+static bool bind_block(unsigned int prg, const char *name, unsigned int binding) {
+	unsigned int index = glGetUniformBlockIndex(prg, name);
+	cg_assert_gl();
+
+	if (index == GL_INVALID_INDEX)
+		return false;
+
+	glUniformBlockBinding(prg, index, binding);
+	cg_assert_gl();
+
+	return true;
+}
+
+// Finds what the linked program declares and points its blocks to their bindings
+static void program_query(struct cg_shader_prg *prg) {
 	for (size_t i = 0; i < CG_SUNIFORM_SIZE; i++) {
-		prg.uniform_locs[i] = glGetUniformLocation(prg.id, shader_uniform_names[i]);
-		cg_assert(!cg_check_gl());
+		prg->uniform_locs[i] = glGetUniformLocation(prg->id, shader_uniform_names[i]);
+		cg_assert_gl();
+	}
+
+	prg->instanced = glGetAttribLocation(prg->id,
+					     shader_attrib_names[CG_SATTRIB_LOC_INSTANCE_MODEL]) != -1;
+	cg_assert_gl();
+
+	prg->frame_block = bind_block(prg->id, FRAME_BLOCK_NAME, CG_UBO_BINDING_FRAME);
+	prg->material_block = bind_block(prg->id, MATERIAL_BLOCK_NAME, CG_UBO_BINDING_MATERIALS);
+
+	int tex_loc = prg->uniform_locs[CG_SUNIFORM_DIFFUSE_TEXTURE];
+	int array_loc = prg->uniform_locs[CG_SUNIFORM_DIFFUSE_TEXTURE_ARRAY];
+	if (tex_loc == -1 && array_loc == -1)
+		return;
+
+	// both samplers have their own unit, as they are of different types
+	state_use_program(prg->id);
+	glUniform1i(tex_loc, 0);
+	glUniform1i(array_loc, 1);
+	cg_assert_gl();
+}
+
+static bool program_linked(unsigned int prg) {
+	int status;
+	glGetProgramiv(prg, GL_LINK_STATUS, &status);
+	cg_assert_gl();
+
+	return status;
+}
+
+// retrievable asks the driver to keep the binary of the program around for glGetProgramBinary
+static struct cg_shader_prg program_build(struct cg_shader_prg_builder *builder,
+					  bool retrievable) {
+	struct cg_shader_prg prg = {0};
+
+	prg.id = glCreateProgram();
+	cg_assert(prg.id != 0);
+
+	for (size_t i = 0; i < builder->shaders.len; i++) {
+		unsigned int shader = builder->shaders.items[i];
+
+		glAttachShader(prg.id, shader);
+		cg_assert_gl();
+	}
+
+	bind_loc(prg.id, CG_SATTRIB_LOC_VERTEX_POSITION);
+	bind_loc(prg.id, CG_SATTRIB_LOC_VERTEX_NORMAL);
+	bind_loc(prg.id, CG_SATTRIB_LOC_VERTEX_UV);
+	bind_loc(prg.id, CG_SATTRIB_LOC_INSTANCE_MODEL);
+	bind_loc(prg.id, CG_SATTRIB_LOC_INSTANCE_MATERIAL);
+
+	if (retrievable) {
+		glProgramParameteri(prg.id, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+		cg_assert_gl();
+	}
+
+	glLinkProgram(prg.id);
+	cg_assert_gl();
+
+	if (!program_linked(prg.id)) {
+		char info_log[1024];
+		glGetProgramInfoLog(prg.id, 1024, NULL, info_log);
+		cg_error("Shader program linking error: %s\n", info_log);
+		cg_assert(0);
 	}
 
+	program_query(&prg);
+
 	for (size_t i = 0; i < builder->shaders.len; i++) {
 		unsigned int shader = builder->shaders.items[i];
 
-		glDeleteShader(shader);
-		cg_assert(!cg_check_gl());
-	}
+		glDeleteShader(shader);
+		cg_assert_gl();
+	}
+
+	return prg;
+}
+
+struct cg_shader_prg cg_shader_prg_builder_build(struct cg_shader_prg_builder *builder) {
+	return program_build(builder, false);
+}
+
+#define FNV_OFFSET 0xcbf29ce484222325ull
+#define FNV_PRIME 0x100000001b3ull
+
+static uint64_t hash_bytes(uint64_t hash, const void *data, size_t size) {
+	const unsigned char *bytes = data;
+
+	for (size_t i = 0; i < size; i++)
+		hash = (hash ^ bytes[i]) * FNV_PRIME;
+
+	return hash;
+}
+
+#define PROGRAM_BINARY_MAGIC "CGPB"
+#define PROGRAM_BINARY_VERSION 1
+
+// Followed by length bytes of the binary
+struct program_binary_header {
+	char magic[4];
+	uint32_t version;
+	// of the vendor, renderer and version strings of the driver that wrote it
+	uint64_t driver;
+	uint32_t format;
+	uint32_t length;
+};
+
+struct shader_variant {
+	uint64_t key;
+	struct cg_shader_prg prg;
+};
+
+// Every program built by cg_shader_prg_variant, by the hash of its sources and defines
+static struct {
+	const char *dir;
+	uint64_t driver;
+	struct CG_DA(struct shader_variant) variants;
+} shader_cache;
+
+void cg_set_shader_cache_dir(const char *dir) {
+	shader_cache.dir = dir;
+}
+
+static uint64_t shader_cache_driver(void) {
+	if (shader_cache.driver != 0)
+		return shader_cache.driver;
+
+	GLenum names[] = {GL_VENDOR, GL_RENDERER, GL_VERSION};
+	uint64_t hash = FNV_OFFSET;
+
+	for (size_t i = 0; i < CG_ARRAY_LEN(names); i++) {
+		const char *str = (const char*)glGetString(names[i]);
+		cg_assert_gl();
+
+		if (str != NULL)
+			hash = hash_bytes(hash, str, strlen(str) + 1);
+	}
+
+	shader_cache.driver = hash;
+	return hash;
+}
+
+// shader_cache.dir/<key>.cgp, NULL when there is no dir or the driver keeps no binaries
+static char *shader_cache_path(uint64_t key) {
+	if (shader_cache.dir == NULL || !GLEW_ARB_get_program_binary)
+		return NULL;
+
+	int num_formats;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &num_formats);
+	cg_assert_gl();
+
+	if (num_formats <= 0)
+		return NULL;
+
+	size_t len = strlen(shader_cache.dir) + 32;
+	char *path = malloc(len);
+	cg_assert(path != NULL);
+
+	snprintf(path, len, "%s/%016" PRIx64 ".cgp", shader_cache.dir, key);
+
+	return path;
+}
+
+// An unknown format would be a GL error, rather than a binary the driver rejects
+static bool program_binary_format_supported(GLenum format) {
+	int num_formats;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &num_formats);
+	cg_assert_gl();
+
+	int *formats = malloc(sizeof(*formats) * CG_MAX(num_formats, 1));
+	cg_assert(formats != NULL);
+
+	glGetIntegerv(GL_PROGRAM_BINARY_FORMATS, formats);
+	cg_assert_gl();
+
+	bool supported = false;
+	for (int i = 0; i < num_formats; i++)
+		supported |= (GLenum)formats[i] == format;
+
+	free(formats);
+
+	return supported;
+}
+
+/*
+ * Loads the program binary at path, failing when it is missing, was written by another
+ * driver or the driver rejects it, as it may after an update.
+ */
+static bool program_from_binary(const char *path, struct cg_shader_prg *prg) {
+	FILE *fp = fopen(path, "rb");
+	if (fp == NULL)
+		return false;
+
+	struct program_binary_header header;
+	bool ok = fread(&header, sizeof(header), 1, fp) == 1 &&
+		memcmp(header.magic, PROGRAM_BINARY_MAGIC, sizeof(header.magic)) == 0 &&
+		header.version == PROGRAM_BINARY_VERSION &&
+		header.driver == shader_cache_driver() &&
+		header.length > 0 &&
+		program_binary_format_supported(header.format);
+
+	void *binary = NULL;
+	if (ok) {
+		binary = malloc(header.length);
+		cg_assert(binary != NULL);
+
+		ok = fread(binary, 1, header.length, fp) == header.length;
+	}
+	fclose(fp);
+
+	if (ok) {
+		*prg = (struct cg_shader_prg){0};
+		prg->id = glCreateProgram();
+		cg_assert(prg->id != 0);
+
+		glProgramBinary(prg->id, header.format, binary, header.length);
+		cg_assert_gl();
+
+		ok = program_linked(prg->id);
+		if (ok) {
+			program_query(prg);
+			cg_info("Shader program loaded from %s\n", path);
+		} else {
+			cg_warn("Shader program binary %s was rejected, compiling it\n", path);
+
+			glDeleteProgram(prg->id);
+			cg_assert_gl();
+		}
+	}
+
+	free(binary);
+
+	return ok;
+}
+
+static bool program_write_binary(const char *path, unsigned int prg) {
+	int length;
+	glGetProgramiv(prg, GL_PROGRAM_BINARY_LENGTH, &length);
+	cg_assert_gl();
+
+	if (length <= 0)
+		return false;
+
+	void *binary = malloc(length);
+	cg_assert(binary != NULL);
+
+	GLenum format;
+	int written;
+	glGetProgramBinary(prg, length, &written, &format, binary);
+	cg_assert_gl();
+
+	struct program_binary_header header = {
+		.magic = PROGRAM_BINARY_MAGIC,
+		.version = PROGRAM_BINARY_VERSION,
+		.driver = shader_cache_driver(),
+		.format = format,
+		.length = written,
+	};
+
+	size_t tmp_len = strlen(path) + 5;
+	char *tmp_path = malloc(tmp_len);
+	cg_assert(tmp_path != NULL);
+	snprintf(tmp_path, tmp_len, "%s.tmp", path);
+
+	bool ok = false;
+	FILE *fp = fopen(tmp_path, "wb");
+	if (fp != NULL) {
+		ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+		ok &= fwrite(binary, 1, written, fp) == (size_t)written;
+		ok &= fclose(fp) == 0;
+		ok = ok && rename(tmp_path, path) == 0;
+	}
+
+	if (ok) {
+		cg_info("Shader program binary written to %s\n", path);
+	} else {
+		cg_warn("Could not write the shader program binary %s\n", path);
+		remove(tmp_path);
+	}
+
+	free(tmp_path);
+	free(binary);
+
+	return ok;
+}
+
+/*
+ * Adds the shader of src with a #define line for each of defines, put after the #version
+ * line as that one has to come first. version, when not NULL, replaces the one of src. A
+ * #line directive after them keeps the line numbers of the compile errors those of src.
+ */
+static void builder_add_variant(struct cg_shader_prg_builder *builder, const char *src,
+				size_t len, GLenum type, const char *version,
+				const char *const *defines, size_t num_defines) {
+	if (num_defines == 0 && version == NULL) {
+		cg_shader_prg_builder_add_shader(builder, src, len, type);
+		return;
+	}
+
+	size_t head = 0;
+	if (len >= 8 && strncmp(src, "#version", 8) == 0) {
+		const char *end = memchr(src, '\n', len);
+		head = end != NULL ? (size_t)(end - src) + 1 : len;
+	}
+
+	size_t size = len + 32;
+	if (version != NULL)
+		size += strlen(version) + 16;
+	for (size_t i = 0; i < num_defines; i++)
+		size += strlen(defines[i]) + 16;
+
+	char *variant = malloc(size);
+	cg_assert(variant != NULL);
+
+	size_t pos = 0;
+	if (version != NULL) {
+		pos += snprintf(variant, size, "#version %s\n", version);
+	} else {
+		memcpy(variant, src, head);
+		pos = head;
+
+		// a #version without a new line ends the source, so it needs one before the defines
+		if (head > 0 && variant[head - 1] != '\n')
+			variant[pos++] = '\n';
+	}
+
+	for (size_t i = 0; i < num_defines; i++)
+		pos += snprintf(&variant[pos], size - pos, "#define %s\n", defines[i]);
+
+	// sources without a #version get one from version, their first line is still 1
+	pos += snprintf(&variant[pos], size - pos, "#line %d\n", head > 0 ? 2 : 1);
+
+	memcpy(&variant[pos], src + head, len - head);
+	pos += len - head;
+
+	cg_shader_prg_builder_add_shader(builder, variant, pos, type);
+
+	free(variant);
+}
+
+// cg_shader_prg_variant with both shaders made of GLSL version, when not NULL
+static struct cg_shader_prg program_variant(const char *vert_src, int vert_len,
+					    const char *frag_src, int frag_len,
+					    const char *version,
+					    const char *const *defines, size_t num_defines) {
+	size_t vert_size = vert_len < 1 ? strlen(vert_src) : (size_t)vert_len;
+	size_t frag_size = frag_len < 1 ? strlen(frag_src) : (size_t)frag_len;
+
+	// the terminators keep the boundaries between the parts apart
+	uint64_t key = hash_bytes(FNV_OFFSET, vert_src, vert_size);
+	key = hash_bytes(key, "", 1);
+	key = hash_bytes(key, frag_src, frag_size);
+	key = hash_bytes(key, "", 1);
+	if (version != NULL)
+		key = hash_bytes(key, version, strlen(version) + 1);
+	for (size_t i = 0; i < num_defines; i++)
+		key = hash_bytes(key, defines[i], strlen(defines[i]) + 1);
+
+	for (size_t i = 0; i < shader_cache.variants.len; i++) {
+		if (shader_cache.variants.items[i].key == key)
+			return shader_cache.variants.items[i].prg;
+	}
+
+	struct cg_shader_prg prg;
+	char *path = shader_cache_path(key);
+
+	if (path == NULL || !program_from_binary(path, &prg)) {
+		struct cg_shader_prg_builder builder = {0};
+
+		builder_add_variant(&builder, vert_src, vert_size, GL_VERTEX_SHADER, version,
+				    defines, num_defines);
+		builder_add_variant(&builder, frag_src, frag_size, GL_FRAGMENT_SHADER, version,
+				    defines, num_defines);
+
+		prg = program_build(&builder, path != NULL);
+		free(builder.shaders.items);
+
+		if (path != NULL)
+			program_write_binary(path, prg.id);
+	}
+
+	free(path);
+
+	cg_da_append(&shader_cache.variants, ((struct shader_variant){key, prg}));
+
+	return prg;
+}
+
+struct cg_shader_prg cg_shader_prg_variant(const char *vert_src, int vert_len,
+					   const char *frag_src, int frag_len,
+					   const char *const *defines, size_t num_defines) {
+	return program_variant(vert_src, vert_len, frag_src, frag_len, NULL,
+			       defines, num_defines);
+}
+
+// Kept apart from the variants as these are asked for on every draw
+static struct {
+	struct cg_shader_prg plain;
+	struct cg_shader_prg instanced;
+} default_programs;
+
+static struct cg_shader_prg default_shader_prg(const char *vert_shader_path) {
+	size_t vert_shader_len;
+	const char *vert_shader_src = (char*)cg_bed_get(vert_shader_path, &vert_shader_len);
+	cg_assert(vert_shader_src != NULL);
+
+	size_t frag_shader_len;
+	const char *frag_shader_src = (char*)cg_bed_get("../resources/shaders/frag.glsl",
+							&frag_shader_len);
+	cg_assert(frag_shader_src != NULL);
+
+	/*
+	 * The bindless path needs GLSL 4.00, where the extension is there it is always built
+	 * in, textures without a handle still take the bound one.
+	 */
+	if (GLEW_ARB_bindless_texture) {
+		const char *defines[] = {"CG_BINDLESS_TEXTURES"};
+
+		return program_variant(vert_shader_src, vert_shader_len,
+				       frag_shader_src, frag_shader_len, "400 core",
+				       defines, CG_ARRAY_LEN(defines));
+	}
+
+	return program_variant(vert_shader_src, vert_shader_len,
+			       frag_shader_src, frag_shader_len, NULL, NULL, 0);
+}
+
+void cg_shader_prg_destroy(struct cg_shader_prg *prg) {
+	struct cg_gl_state *state = &cg_ctx.gl_state;
+
+	if (state->program == prg->id)
+		state->program = 0;
+
+	// The name may be reused by a new program, which has never seen the camera
+	if (prg->id < state->program_camera_generation.len)
+		state->program_camera_generation.items[prg->id] = 0;
+
+	// a variant is built again the next time it is asked for
+	for (size_t i = 0; i < shader_cache.variants.len; i++) {
+		struct shader_variant *variant = &shader_cache.variants.items[i];
+
+		if (variant->prg.id == prg->id) {
+			*variant = shader_cache.variants.items[--shader_cache.variants.len];
+			break;
+		}
+	}
+
+	if (default_programs.plain.id == prg->id)
+		default_programs.plain.id = 0;
+	if (default_programs.instanced.id == prg->id)
+		default_programs.instanced.id = 0;
+
+	glDeleteProgram(prg->id);
+	cg_assert_gl();
+
+	*prg = (struct cg_shader_prg){0};
+}
+
+struct cg_shader_prg cg_shader_prg_default() {
+	if (default_programs.plain.id == 0)
+		default_programs.plain = default_shader_prg("../resources/shaders/vert.glsl");
+
+	return default_programs.plain;
+}
+
+struct cg_shader_prg cg_shader_prg_default_instanced() {
+	if (default_programs.instanced.id == 0)
+		default_programs.instanced =
+			default_shader_prg("../resources/shaders/vert_instanced.glsl");
+
+	return default_programs.instanced;
+}
+
+static bool texture_arrays;
+static bool bindless_textures;
+
+void cg_set_texture_arrays(bool enable) {
+	texture_arrays = enable;
+}
+
+bool cg_set_bindless_textures(bool enable) {
+	bindless_textures = enable && GLEW_ARB_bindless_texture;
+
+	return bindless_textures;
+}
+
+// Once resident the texture parameters can no longer change, so this goes last
+static void texture_make_resident(struct cg_texture *tex) {
+	if (!bindless_textures)
+		return;
+
+	tex->handle = glGetTextureHandleARB(tex->gl_tex);
+	cg_assert_gl();
+
+	glMakeTextureHandleResidentARB(tex->handle);
+	cg_assert_gl();
+}
+
+static void texture_set_params(GLenum target, size_t num_levels, GLenum mag_filter) {
+	glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	cg_assert_gl();
+	glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	cg_assert_gl();
+	glTexParameteri(target, GL_TEXTURE_MIN_FILTER,
+			num_levels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+	cg_assert_gl();
+	glTexParameteri(target, GL_TEXTURE_MAG_FILTER, mag_filter);
+	cg_assert_gl();
+}
+
+static struct cg_texture texture_create_2d(const unsigned char *data, size_t width,
+					   size_t height, int internal_format, int format,
+					   GLenum mag_filter) {
+	struct cg_texture tex = { .type = CG_TEXTURE_2D };
+
+	glGenTextures(1, &tex.gl_tex);
+	cg_assert_gl();
+
+	state_bind_texture(cg_ctx.gl_state.active_texture_unit, GL_TEXTURE_2D, tex.gl_tex);
+
+	glTexImage2D(GL_TEXTURE_2D, 0, internal_format, width, height, 0, format, GL_UNSIGNED_BYTE,
+		     data);
+	cg_assert_gl();
+
+	glGenerateMipmap(GL_TEXTURE_2D);
+	cg_assert_gl();
+
+	// any level count above one asks for the mipmapped filter
+	texture_set_params(GL_TEXTURE_2D, 2, mag_filter);
+	texture_make_resident(&tex);
+
+	return tex;
+}
+
+struct cg_texture cg_texture_create_2d(const unsigned char *data, size_t width, size_t height,
+				       int internal_format, int format) {
+	return texture_create_2d(data, width, height, internal_format, format, GL_LINEAR);
+}
+
+struct cg_texture cg_texture_create_2d_array(const unsigned char *const *layers,
+					     size_t num_layers, size_t width, size_t height,
+					     int internal_format, int format) {
+	cg_assert(num_layers > 0);
+
+	struct cg_texture tex = { .type = CG_TEXTURE_2D_ARRAY };
+
+	glGenTextures(1, &tex.gl_tex);
+	cg_assert_gl();
+
+	state_bind_texture(cg_ctx.gl_state.active_texture_unit, GL_TEXTURE_2D_ARRAY, tex.gl_tex);
+
+	glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, internal_format, width, height, num_layers, 0, format,
+		     GL_UNSIGNED_BYTE, NULL);
+	cg_assert_gl();
+
+	for (size_t i = 0; i < num_layers; i++) {
+		glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, i, width, height, 1, format,
+				GL_UNSIGNED_BYTE, layers[i]);
+		cg_assert_gl();
+	}
+
+	glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+	cg_assert_gl();
+
+	texture_set_params(GL_TEXTURE_2D_ARRAY, 2, GL_LINEAR);
+	texture_make_resident(&tex);
+
+	return tex;
+}
+
+struct cg_texture cg_texture_create_2d_compressed(int format, size_t width, size_t height,
+						  const struct cg_texture_level *levels,
+						  size_t num_levels) {
+	cg_assert(num_levels > 0);
+
+	struct cg_texture tex = { .type = CG_TEXTURE_2D };
+
+	glGenTextures(1, &tex.gl_tex);
+	cg_assert_gl();
+
+	state_bind_texture(cg_ctx.gl_state.active_texture_unit, GL_TEXTURE_2D, tex.gl_tex);
+
+	for (size_t i = 0; i < num_levels; i++) {
+		glCompressedTexImage2D(GL_TEXTURE_2D, i, format, CG_MAX(width >> i, 1),
+				       CG_MAX(height >> i, 1), 0, levels[i].size, levels[i].data);
+		cg_assert_gl();
+	}
+
+	// the chain can stop before 1x1
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, num_levels - 1);
+	cg_assert_gl();
+
+	texture_set_params(GL_TEXTURE_2D, num_levels, GL_LINEAR);
+	texture_make_resident(&tex);
+
+	return tex;
+}
+
+struct texture_cache_entry {
+	char *path;
+	struct cg_texture tex;
+	size_t refs;
+};
+
+/*
+ * Textures loaded from files, so loading the same path again gives the same texture. Every
+ * load takes a reference and cg_texture_destroy only deletes the texture once the last one is
+ * dropped. Workers look it up as well, hence the lock.
+ */
+static struct {
+	SDL_SpinLock lock;
+	struct CG_DA(struct texture_cache_entry) entries;
+} texture_cache;
+
+// Takes a reference on the cached texture of path, if there is one
+static bool texture_cache_ref(const char *path, struct cg_texture *tex) {
+	bool found = false;
+
+	SDL_AtomicLock(&texture_cache.lock);
+
+	for (size_t i = 0; i < texture_cache.entries.len; i++) {
+		struct texture_cache_entry *entry = &texture_cache.entries.items[i];
+
+		if (strcmp(entry->path, path) == 0) {
+			entry->refs++;
+			*tex = entry->tex;
+			found = true;
+			break;
+		}
+	}
+
+	SDL_AtomicUnlock(&texture_cache.lock);
+
+	return found;
+}
+
+static void texture_cache_insert(const char *path, struct cg_texture tex) {
+	struct texture_cache_entry entry = {
+		.path = strdup(path),
+		.tex = tex,
+		.refs = 1,
+	};
+	cg_assert(entry.path != NULL);
+
+	SDL_AtomicLock(&texture_cache.lock);
+	cg_da_append(&texture_cache.entries, entry);
+	SDL_AtomicUnlock(&texture_cache.lock);
+}
+
+// Drops a reference, returns false while the texture is still used by other loads
+static bool texture_cache_unref(unsigned int gl_tex) {
+	bool last = true;
+
+	SDL_AtomicLock(&texture_cache.lock);
+
+	for (size_t i = 0; i < texture_cache.entries.len; i++) {
+		struct texture_cache_entry *entry = &texture_cache.entries.items[i];
+
+		if (entry->tex.gl_tex != gl_tex)
+			continue;
+
+		if (--entry->refs > 0) {
+			last = false;
+		} else {
+			free(entry->path);
+			*entry = texture_cache.entries.items[--texture_cache.entries.len];
+		}
+		break;
+	}
+
+	SDL_AtomicUnlock(&texture_cache.lock);
+
+	return last;
+}
+
+#define IMAGE_MAX_LEVELS 16
+
+struct image {
+	// where it was loaded from, the key in the texture cache
+	char *path;
+	// path was already loaded into texture, nothing else is set then
+	bool cached;
+	struct cg_texture texture;
+
+	unsigned char *pixels;
+	int width, height, channels;
+
+	/*
+	 * Compressed images are not decoded, the levels point into the file, which is kept until
+	 * image_free. compressed_format is 0 for the others.
+	 */
+	GLenum compressed_format;
+	size_t num_levels;
+	struct cg_texture_level levels[IMAGE_MAX_LEVELS];
+	unsigned char *file;
+	size_t file_size;
+};
+
+static bool image_loaded(const struct image *image) {
+	return image->cached || image->pixels != NULL;
+}
+
+static size_t compressed_block_size(GLenum format) {
+	switch (format) {
+		case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+		case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
+		case GL_COMPRESSED_RGB8_ETC2:
+			return 8;
+		default:
+			return 16;
+	}
+}
+
+static bool compressed_format_supported(GLenum format) {
+	switch (format) {
+		case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+		case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
+		case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+			return GLEW_EXT_texture_compression_s3tc;
+		case GL_COMPRESSED_RGBA_BPTC_UNORM:
+			return GLEW_ARB_texture_compression_bptc;
+		default:
+			return GLEW_ARB_ES3_compatibility;
+	}
+}
+
+/*
+ * Points the levels of a compressed image at data, each one right after the previous, as both
+ * DDS and KTX2 without supercompression can be read.
+ */
+static bool image_set_levels(struct image *image, const unsigned char *data, size_t size) {
+	size_t block_size = compressed_block_size(image->compressed_format);
+	size_t offset = 0;
+
+	for (size_t i = 0; i < image->num_levels; i++) {
+		size_t width = CG_MAX((size_t)image->width >> i, 1);
+		size_t height = CG_MAX((size_t)image->height >> i, 1);
+		size_t level_size = ((width + 3) / 4) * ((height + 3) / 4) * block_size;
+
+		if (level_size > size - offset)
+			return false;
+
+		image->levels[i] = (struct cg_texture_level){data + offset, level_size};
+		offset += level_size;
+	}
+
+	return true;
+}
+
+static uint32_t read_u32(const unsigned char *p) {
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint64_t read_u64(const unsigned char *p) {
+	return read_u32(p) | (uint64_t)read_u32(p + 4) << 32;
+}
+
+#define DDS_HEADER_SIZE 128
+#define DDS_DX10_HEADER_SIZE 20
+#define DDS_PIXEL_FORMAT_FOURCC 0x4
+#define DDS_CAPS2_CUBEMAP 0x200
+
+#define DXGI_FORMAT_BC1_UNORM 71
+#define DXGI_FORMAT_BC1_UNORM_SRGB 72
+#define DXGI_FORMAT_BC3_UNORM 77
+#define DXGI_FORMAT_BC3_UNORM_SRGB 78
+#define DXGI_FORMAT_BC7_UNORM 98
+#define DXGI_FORMAT_BC7_UNORM_SRGB 99
+
+/*
+ * The sRGB formats are read as linear ones, like the PNG and JPEG files are, so both kinds of
+ * texture look the same with the shaders there are.
+ */
+static GLenum dxgi_to_gl_format(uint32_t format) {
+	switch (format) {
+		case DXGI_FORMAT_BC1_UNORM:
+		case DXGI_FORMAT_BC1_UNORM_SRGB:
+			return GL_COMPRESSED_RGBA_S3TC_DXT1_EXT;
+		case DXGI_FORMAT_BC3_UNORM:
+		case DXGI_FORMAT_BC3_UNORM_SRGB:
+			return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+		case DXGI_FORMAT_BC7_UNORM:
+		case DXGI_FORMAT_BC7_UNORM_SRGB:
+			return GL_COMPRESSED_RGBA_BPTC_UNORM;
+		default:
+			return 0;
+	}
+}
+
+static bool image_from_dds(struct image *image, const unsigned char *file, size_t size) {
+	if (size < DDS_HEADER_SIZE)
+		return false;
+
+	image->height = read_u32(&file[12]);
+	image->width = read_u32(&file[16]);
+	image->num_levels = CG_MAX(read_u32(&file[28]), 1);
+
+	uint32_t pixel_format_flags = read_u32(&file[80]);
+	const unsigned char *fourcc = &file[84];
+
+	if (!(pixel_format_flags & DDS_PIXEL_FORMAT_FOURCC) ||
+	    read_u32(&file[112]) & DDS_CAPS2_CUBEMAP || image->num_levels > IMAGE_MAX_LEVELS)
+		return false;
+
+	size_t data_offset = DDS_HEADER_SIZE;
+
+	if (memcmp(fourcc, "DXT1", 4) == 0) {
+		image->compressed_format = GL_COMPRESSED_RGBA_S3TC_DXT1_EXT;
+	} else if (memcmp(fourcc, "DXT5", 4) == 0) {
+		image->compressed_format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+	} else if (memcmp(fourcc, "DX10", 4) == 0) {
+		if (size < DDS_HEADER_SIZE + DDS_DX10_HEADER_SIZE || read_u32(&file[140]) > 1)
+			return false;
+
+		image->compressed_format = dxgi_to_gl_format(read_u32(&file[128]));
+		data_offset += DDS_DX10_HEADER_SIZE;
+	}
+
+	return image->compressed_format != 0 &&
+	       image_set_levels(image, &file[data_offset], size - data_offset);
+}
+
+#define KTX2_HEADER_SIZE 80
+#define KTX2_LEVEL_SIZE 24
+
+static const unsigned char ktx2_identifier[12] = {
+	0xab, 'K', 'T', 'X', ' ', '2', '0', 0xbb, '\r', '\n', 0x1a, '\n',
+};
+
+#define VK_FORMAT_BC1_RGB_UNORM_BLOCK 131
+#define VK_FORMAT_BC1_RGB_SRGB_BLOCK 132
+#define VK_FORMAT_BC1_RGBA_UNORM_BLOCK 133
+#define VK_FORMAT_BC1_RGBA_SRGB_BLOCK 134
+#define VK_FORMAT_BC3_UNORM_BLOCK 137
+#define VK_FORMAT_BC3_SRGB_BLOCK 138
+#define VK_FORMAT_BC7_UNORM_BLOCK 145
+#define VK_FORMAT_BC7_SRGB_BLOCK 146
+#define VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK 147
+#define VK_FORMAT_ETC2_R8G8B8_SRGB_BLOCK 148
+#define VK_FORMAT_ETC2_R8G8B8A8_UNORM_BLOCK 151
+#define VK_FORMAT_ETC2_R8G8B8A8_SRGB_BLOCK 152
+
+static GLenum vk_to_gl_format(uint32_t format) {
+	switch (format) {
+		case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+		case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+			return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+		case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+		case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+			return GL_COMPRESSED_RGBA_S3TC_DXT1_EXT;
+		case VK_FORMAT_BC3_UNORM_BLOCK:
+		case VK_FORMAT_BC3_SRGB_BLOCK:
+			return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+		case VK_FORMAT_BC7_UNORM_BLOCK:
+		case VK_FORMAT_BC7_SRGB_BLOCK:
+			return GL_COMPRESSED_RGBA_BPTC_UNORM;
+		case VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK:
+		case VK_FORMAT_ETC2_R8G8B8_SRGB_BLOCK:
+			return GL_COMPRESSED_RGB8_ETC2;
+		case VK_FORMAT_ETC2_R8G8B8A8_UNORM_BLOCK:
+		case VK_FORMAT_ETC2_R8G8B8A8_SRGB_BLOCK:
+			return GL_COMPRESSED_RGBA8_ETC2_EAC;
+		default:
+			return 0;
+	}
+}
+
+// Only plain 2D KTX2 files without supercompression, the levels are found through the index
+static bool image_from_ktx2(struct image *image, const unsigned char *file, size_t size) {
+	if (size < KTX2_HEADER_SIZE)
+		return false;
+
+	image->compressed_format = vk_to_gl_format(read_u32(&file[12]));
+	image->width = read_u32(&file[20]);
+	image->height = read_u32(&file[24]);
+
+	uint32_t depth = read_u32(&file[28]);
+	uint32_t layers = read_u32(&file[32]);
+	uint32_t faces = read_u32(&file[36]);
+	uint32_t supercompression = read_u32(&file[44]);
+
+	image->num_levels = CG_MAX(read_u32(&file[40]), 1);
+
+	if (image->compressed_format == 0 || depth > 1 || layers > 1 || faces != 1 ||
+	    supercompression != 0 || image->num_levels > IMAGE_MAX_LEVELS ||
+	    size < KTX2_HEADER_SIZE + image->num_levels * KTX2_LEVEL_SIZE)
+		return false;
+
+	struct image expected = *image;
+	image_set_levels(&expected, file, SIZE_MAX);
+
+	for (size_t i = 0; i < image->num_levels; i++) {
+		const unsigned char *level = &file[KTX2_HEADER_SIZE + i * KTX2_LEVEL_SIZE];
+		uint64_t offset = read_u64(&level[0]);
+		uint64_t length = read_u64(&level[8]);
+
+		if (offset > size || length > size - offset || length != expected.levels[i].size)
+			return false;
+
+		image->levels[i] = (struct cg_texture_level){file + offset, length};
+	}
+
+	return true;
+}
+
+// Reads and decodes an image file, safe to call from any thread
+static bool image_decode(const char *file_path, struct image *image) {
+	cg_info("Loading file %s\n", file_path);
+
+	size_t file_size;
+	unsigned char *file = cg_file_read(file_path, &file_size);
+	if (file == NULL) {
+		cg_error("File %s nor found\n", file_path);
+		return false;
+	}
+
+	bool is_dds = file_size >= 4 && memcmp(file, "DDS ", 4) == 0;
+	bool is_ktx2 = file_size >= sizeof(ktx2_identifier) &&
+		       memcmp(file, ktx2_identifier, sizeof(ktx2_identifier)) == 0;
+
+	if (is_dds || is_ktx2) {
+		bool ok = is_dds ? image_from_dds(image, file, file_size)
+				 : image_from_ktx2(image, file, file_size);
+		if (!ok) {
+			cg_error("Unsupported or broken compressed texture %s\n", file_path);
+			cg_file_release(file, file_size);
+			return false;
+		}
+
+		image->file = file;
+		image->file_size = file_size;
+		image->pixels = file;
+
+		return true;
+	}
+
+	image->pixels = stbi_load_from_memory(file, file_size, &image->width, &image->height,
+					      &image->channels, 0);
+	cg_file_release(file, file_size);
+
+	if (image->pixels == NULL) {
+		cg_error("Could not decode %s: %s\n", file_path, stbi_failure_reason());
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Gets the image of a file ready for texture_from_image, without decoding it when the texture
+ * cache already has it. Safe to call from any thread.
+ */
+static bool image_load(const char *file_path, struct image *image) {
+	*image = (struct image){0};
+
+	image->path = strdup(file_path);
+	cg_assert(image->path != NULL);
+
+	image->cached = texture_cache_ref(file_path, &image->texture);
+	if (image->cached)
+		return true;
+
+	return image_decode(file_path, image);
+}
+
+static void image_free(struct image *image) {
+	if (image->file != NULL)
+		cg_file_release(image->file, image->file_size);
+	else
+		stbi_image_free(image->pixels);
+
+	free(image->path);
+
+	*image = (struct image){0};
+}
+
+// Format of the decoded pixels, used as the internal format as well
+static GLenum image_gl_format(const struct image *image) {
+	switch (image->channels) {
+		case 1:
+			return GL_RED;
+		case 2:
+			return GL_RG;
+		case 3:
+			return GL_RGB;
+		case 4:
+			return GL_RGBA;
+	}
+
+	cg_assert(0);
+	return 0;
+}
+
+static struct cg_texture texture_from_image(const struct image *image) {
+	if (image->cached)
+		return image->texture;
+
+	// loaded by someone else in the meantime
+	struct cg_texture tex;
+	if (texture_cache_ref(image->path, &tex))
+		return tex;
+
+	if (image->compressed_format != 0) {
+		if (!compressed_format_supported(image->compressed_format)) {
+			cg_error("%s uses a compressed format this GL does not support\n",
+				 image->path);
+			return cg_texture_default();
+		}
+
+		tex = cg_texture_create_2d_compressed(image->compressed_format, image->width,
+						      image->height, image->levels,
+						      image->num_levels);
+		texture_cache_insert(image->path, tex);
+
+		return tex;
+	}
+
+	GLenum format = image_gl_format(image);
+
+	tex = cg_texture_create_2d(image->pixels, image->width, image->height, format, format);
+	texture_cache_insert(image->path, tex);
+
+	return tex;
+}
+
+struct cg_texture cg_texture_from_file_2d(const char *file_path) {
+	struct image image;
+	cg_assert(image_load(file_path, &image));
+
+	struct cg_texture tex = texture_from_image(&image);
+
+	image_free(&image);
+
+	return tex;
+}
+
+static struct cg_texture default_tex;
+
+void cg_texture_destroy(struct cg_texture *tex) {
+	if (tex->gl_tex == 0)
+		return;
+
+	if (!texture_cache_unref(tex->gl_tex)) {
+		*tex = (struct cg_texture){0};
+		return;
+	}
+
+	for (size_t i = 0; i < CG_GL_STATE_TEXTURE_UNITS; i++) {
+		if (cg_ctx.gl_state.textures[i] == tex->gl_tex)
+			cg_ctx.gl_state.textures[i] = 0;
+	}
+
+	if (tex->handle != 0) {
+		glMakeTextureHandleNonResidentARB(tex->handle);
+		cg_assert_gl();
+	}
+
+	glDeleteTextures(1, &tex->gl_tex);
+	cg_assert_gl();
+
+	*tex = (struct cg_texture){0};
+}
+
+struct cg_texture cg_texture_default() {
+	if (default_tex.gl_tex == 0) {
+		unsigned char default_tex_data[DEFAULT_TEX_SIZE * 4 * DEFAULT_TEX_SIZE] = {0};
+
+		for (size_t y = 0; y < DEFAULT_TEX_SIZE; y++) {
+			for (size_t x = 0; x < DEFAULT_TEX_SIZE; x++) {
+				if ((x + y % 2) % 2 == 0) {
+					default_tex_data[(x + y * DEFAULT_TEX_SIZE) * 4 + 0] = 0xff;
+					default_tex_data[(x + y * DEFAULT_TEX_SIZE) * 4 + 1] = 0x00;
+					default_tex_data[(x + y * DEFAULT_TEX_SIZE) * 4 + 2] = 0xff;
+				}
+			}
+		}
+
+		default_tex = texture_create_2d(default_tex_data, DEFAULT_TEX_SIZE, DEFAULT_TEX_SIZE,
+						GL_RGBA, GL_RGBA, GL_NEAREST);
+	}
+
+	return default_tex;
+}
+
+struct cg_material cg_material_default() {
+	struct cg_material ret = {
+		.shader = cg_shader_prg_default(),
+		.enable_color = true,
+		.tex_diffuse = cg_texture_default(),
+	};
+
+	return ret;
+}
+struct cg_model cg_model_create(const struct cg_mesh *meshes, const size_t num_meshes,
+				const struct cg_material *materials, const size_t num_materials,
+				const size_t *mesh_to_material) {
+	struct cg_material default_material = cg_material_default();
+	size_t default_mesh_to_material[] = {0};
+
+	struct cg_model ret = {
+		.num_meshes = num_meshes,
+		.num_materials = num_materials,
+		.scale = (struct cg_vec3f){1, 1, 1},
+		.world_dirty = true,
+	};
+
+	if (materials == NULL) {
+		ret.num_materials = 1;
+		materials = &default_material;
+		mesh_to_material = default_mesh_to_material;
+	}
+
+	ret.meshes = malloc(ret.num_meshes * sizeof(*ret.meshes));
+	cg_assert(ret.meshes != NULL);
+	memcpy(ret.meshes, meshes, ret.num_meshes * sizeof(*ret.meshes));
+
+	ret.materials = malloc(ret.num_materials * sizeof(*ret.materials));
+	cg_assert(ret.materials != NULL);
+	memcpy(ret.materials, materials, ret.num_materials * sizeof(*ret.materials));
+
+	ret.mesh_to_material = malloc(ret.num_meshes * sizeof(*ret.mesh_to_material));
+	cg_assert(ret.mesh_to_material != NULL);
+	memcpy(ret.mesh_to_material, mesh_to_material, ret.num_meshes * sizeof(*ret.mesh_to_material));
+
+	struct cg_box bounding_box = ret.num_meshes > 0 ? ret.meshes[0].bounds : (struct cg_box){0};
+	for (size_t i = 1; i < ret.num_meshes; i++) {
+		struct cg_box *b = &ret.meshes[i].bounds;
+		bounding_box.min.x = CG_MIN(bounding_box.min.x, b->min.x);
+		bounding_box.max.x = CG_MAX(bounding_box.max.x, b->max.x);
+		bounding_box.min.y = CG_MIN(bounding_box.min.y, b->min.y);
+		bounding_box.max.y = CG_MAX(bounding_box.max.y, b->max.y);
+		bounding_box.min.z = CG_MIN(bounding_box.min.z, b->min.z);
+		bounding_box.max.z = CG_MAX(bounding_box.max.z, b->max.z);
+	}
+
+	ret.bounding_box = bounding_box;
+
+	return ret;
+}
+
+/*
+ * Materials of a model can share textures, or layers of one texture array, every use is
+ * cleared so it is only deleted once.
+ */
+static void model_texture_destroy(struct cg_model *model, struct cg_texture tex) {
+	if (tex.gl_tex == 0)
+		return;
+
+	GLuint gl_tex = tex.gl_tex;
+	cg_texture_destroy(&tex);
+
+	for (size_t i = 0; i < model->num_materials; i++) {
+		struct cg_material *m = &model->materials[i];
+		struct cg_texture *textures[] = {
+			&m->tex_ambient,
+			&m->tex_diffuse,
+			&m->tex_specular,
+			&m->tex_specular_highlight,
+			&m->tex_bump,
+			&m->tex_displacement,
+			&m->tex_alpha,
+		};
+
+		for (size_t j = 0; j < CG_ARRAY_LEN(textures); j++) {
+			if (textures[j]->gl_tex == gl_tex)
+				textures[j]->gl_tex = 0;
+		}
+	}
+}
+
+void cg_model_destroy(struct cg_model *model) {
+	for (size_t i = 0; i < model->num_meshes; i++)
+		cg_mesh_destroy(&model->meshes[i]);
+
+	for (size_t i = 0; i < model->num_materials; i++) {
+		struct cg_material *m = &model->materials[i];
+		struct cg_texture *textures[] = {
+			&m->tex_ambient,
+			&m->tex_diffuse,
+			&m->tex_specular,
+			&m->tex_specular_highlight,
+			&m->tex_bump,
+			&m->tex_displacement,
+			&m->tex_alpha,
+		};
+
+		for (size_t j = 0; j < CG_ARRAY_LEN(textures); j++) {
+			if (textures[j]->gl_tex != default_tex.gl_tex)
+				model_texture_destroy(model, *textures[j]);
+		}
+	}
+
+	free(model->meshes);
+	free(model->materials);
+	free(model->mesh_to_material);
+
+	*model = (struct cg_model){0};
+}
+
+struct file_view {
+	unsigned char *data;
+	size_t size;
+};
+
+// tinyobj never frees what it reads, ctx collects the files to release them after parsing
+static void tn_read_file_callback(void *ctx, const char *filename, int is_mtl,
+			          const char *obj_filename, char **buf, size_t *len) {
+	(void) is_mtl;
+	(void) obj_filename;
+
+	struct CG_DA(struct file_view) *files = ctx;
+
+	*len = 0;
+	*buf = (char*)cg_file_read(filename, len);
+
+	if (*buf != NULL)
+		cg_da_append(files, ((struct file_view){(unsigned char*)*buf, *len}));
+}
+
+// Path of a texture named by a model file, relative to the model's directory
+static char *texture_path(const char *model_path, const char *name) {
+	const char *dir_end = strrchr(model_path, '/');
+	const char *name_dir_end = strrchr(name, '/');
+
+	size_t model_dir_len = dir_end == NULL ? 0 : dir_end - model_path + 1;
+
+	// names with a directory that does not go up are taken as they are
+	if (name_dir_end != NULL) {
+		size_t name_dir_len = name_dir_end - name;
+		bool goes_up = false;
+
+		for (size_t i = 0; i + 1 < name_dir_len; i++)
+			goes_up |= name[i] == '.' && name[i + 1] == '.';
+
+		if (!goes_up)
+			model_dir_len = 0;
+	}
+
+	size_t len = model_dir_len + strlen(name) + 1;
+	char *path = malloc(len);
+	cg_assert(path != NULL);
+
+	snprintf(path, len, "%.*s%s", (int)model_dir_len, model_path, name);
+
+	return path;
+}
+
+struct welded_mesh {
+	size_t num_verts;
+	float *verts;
+	float *normals;
+	float *uvs;
+	int *indices;
+};
+
+static size_t hash_vertex_index(tinyobj_vertex_index_t idx) {
+	size_t hash = (unsigned int)idx.v_idx * 73856093u;
+	hash ^= (unsigned int)idx.vt_idx * 19349663u;
+	hash ^= (unsigned int)idx.vn_idx * 83492791u;
+	return hash;
+}
+
+/*
+ * Collapse the face corners that share the same (v_idx, vt_idx, vn_idx) triple into a single
+ * vertex, building the compact attribute arrays and the index buffer that references them.
+ */
+static struct welded_mesh weld_faces(const tinyobj_attrib_t *attrib,
+				     const tinyobj_vertex_index_t *faces,
+				     const size_t num_indices) {
+	struct welded_mesh w = {0};
+
+	size_t table_len = 1;
+	while (table_len < num_indices * 2)
+		table_len *= 2;
+
+	int *table = malloc(sizeof(*table) * table_len);
+	cg_assert(table != NULL);
+	memset(table, -1, sizeof(*table) * table_len);
+
+	tinyobj_vertex_index_t *keys = malloc(sizeof(*keys) * num_indices);
+	cg_assert(keys != NULL);
+
+	w.verts = malloc(sizeof(*w.verts) * num_indices * 3);
+	cg_assert(w.verts != NULL);
+	w.indices = malloc(sizeof(*w.indices) * num_indices);
+	cg_assert(w.indices != NULL);
+
+	if (attrib->num_normals != 0) {
+		w.normals = malloc(sizeof(*w.normals) * num_indices * 3);
+		cg_assert(w.normals != NULL);
+	}
+
+	if (attrib->num_texcoords != 0) {
+		w.uvs = malloc(sizeof(*w.uvs) * num_indices * 2);
+		cg_assert(w.uvs != NULL);
+	}
+
+	for (size_t i = 0; i < num_indices; i++) {
+		tinyobj_vertex_index_t idx = faces[i];
+		size_t slot = hash_vertex_index(idx) & (table_len - 1);
+
+		while (table[slot] != -1) {
+			tinyobj_vertex_index_t *key = &keys[table[slot]];
+			if (key->v_idx == idx.v_idx && key->vt_idx == idx.vt_idx &&
+			    key->vn_idx == idx.vn_idx)
+				break;
+			slot = (slot + 1) & (table_len - 1);
+		}
+
+		if (table[slot] == -1) {
+			size_t v = w.num_verts++;
+			table[slot] = v;
+			keys[v] = idx;
+
+			memcpy(&w.verts[v * 3], &attrib->vertices[idx.v_idx * 3],
+			       sizeof(*w.verts) * 3);
+
+			if (w.normals != NULL)
+				memcpy(&w.normals[v * 3], &attrib->normals[idx.vn_idx * 3],
+				       sizeof(*w.normals) * 3);
+
+			if (w.uvs != NULL)
+				memcpy(&w.uvs[v * 2], &attrib->texcoords[idx.vt_idx * 2],
+				       sizeof(*w.uvs) * 2);
+		}
+
+		w.indices[i] = table[slot];
+	}
+
+	free(keys);
+	free(table);
+
+	return w;
+}
+
+enum material_texture {
+	MATERIAL_TEX_AMBIENT,
+	MATERIAL_TEX_DIFFUSE,
+	MATERIAL_TEX_SPECULAR,
+	MATERIAL_TEX_SPECULAR_HIGHLIGHT,
+	MATERIAL_TEX_BUMP,
+	MATERIAL_TEX_DISPLACEMENT,
+	MATERIAL_TEX_ALPHA,
+	MATERIAL_TEX_SIZE,
+};
+
+/*
+ * What a model file says about a material, texture names are relative to it and NULL when
+ * the material has none.
+ */
+struct material_desc {
+	struct cg_vec3f color_ambient;
+	struct cg_vec3f color_diffuse;
+	struct cg_vec3f color_specular;
+	struct cg_vec3f color_transmittance;
+	struct cg_vec3f color_emission;
+	float specular_exponent;
+	float index_of_refraction;
+	float opacity;
+
+	char *textures[MATERIAL_TEX_SIZE];
+};
+
+static struct material_desc material_desc_from_obj(const tinyobj_material_t *tn_material) {
+	return (struct material_desc) {
+		.color_ambient = cg_vec3f_from_array(tn_material->ambient),
+		.color_diffuse = cg_vec3f_from_array(tn_material->diffuse),
+		.color_specular = cg_vec3f_from_array(tn_material->specular),
+		.color_transmittance = cg_vec3f_from_array(tn_material->transmittance),
+		.color_emission = cg_vec3f_from_array(tn_material->emission),
+		.specular_exponent = tn_material->shininess,
+		.index_of_refraction = tn_material->ior,
+		.opacity = tn_material->dissolve,
+		.textures = {
+			[MATERIAL_TEX_AMBIENT] = tn_material->ambient_texname,
+			[MATERIAL_TEX_DIFFUSE] = tn_material->diffuse_texname,
+			[MATERIAL_TEX_SPECULAR] = tn_material->specular_texname,
+			[MATERIAL_TEX_SPECULAR_HIGHLIGHT] = tn_material->specular_highlight_texname,
+			[MATERIAL_TEX_BUMP] = tn_material->bump_texname,
+			[MATERIAL_TEX_DISPLACEMENT] = tn_material->displacement_texname,
+			[MATERIAL_TEX_ALPHA] = tn_material->alpha_texname,
+		},
+	};
+}
+
+
+/*
+ * A mesh ready to be uploaded: vertices interleaved and indices packed as the buffers hold
+ * them. The CPU side copies go to the mesh, which keeps what cg_set_mesh_cpu_data asks for.
+ */
+struct mesh_data {
+	enum cg_vertex_format vertex_format;
+	// bit per enum cg_shader_attrib_loc stored in the vertices
+	unsigned int attribs;
+	size_t num_verts;
+	const unsigned char *vertices;
+
+	GLenum index_type;
+	// of the first level of detail, indices holds every level
+	size_t num_indices;
+	const unsigned char *indices;
+
+	size_t num_lods;
+	struct cg_mesh_lod lods[CG_MESH_MAX_LODS];
+
+	struct cg_box bounds;
+	size_t material;
+
+	float *verts;
+	float *normals;
+	float *uvs;
+	int *cpu_indices;
+
+	// vertices and indices were allocated, instead of pointing into a cooked file
+	bool owned;
+};
+
+struct material_data {
+	// cg_material_default is used instead
+	bool is_default;
+	// the texture names are owned
+	struct material_desc desc;
+	// index into the model's images for every texture, NO_IMAGE where there is none
+	size_t images[MATERIAL_TEX_SIZE];
+};
+
+#define NO_IMAGE SIZE_MAX
+
+/*
+ * Everything a model file produces before it reaches the GL, so it can be built on any
+ * thread and then uploaded in small steps, see model_upload_step.
+ */
+struct model_data {
+	size_t num_meshes;
+	struct mesh_data *meshes;
+
+	size_t num_materials;
+	struct material_data *materials;
+
+	// the different textures of the materials, see image_loaded for the ones that failed
+	struct image *images;
+	size_t num_images;
+
+	// the cooked file the meshes point into, NULL when loaded from the source
+	unsigned char *mapping;
+	size_t mapping_size;
+};
+
+static size_t mesh_data_total_indices(const struct mesh_data *mesh) {
+	const struct cg_mesh_lod *last = &mesh->lods[mesh->num_lods - 1];
+
+	return mesh->num_indices == 0 ? 0 : last->first_index + last->num_indices;
+}
+
+static void model_data_free(struct model_data *data) {
+	for (size_t i = 0; i < data->num_meshes; i++) {
+		struct mesh_data *mesh = &data->meshes[i];
+
+		if (mesh->owned) {
+			free((void *)mesh->vertices);
+			free((void *)mesh->indices);
+		}
+
+		free(mesh->verts);
+		free(mesh->normals);
+		free(mesh->uvs);
+		free(mesh->cpu_indices);
+	}
+
+	for (size_t i = 0; i < data->num_materials; i++) {
+		struct material_data *material = &data->materials[i];
+
+		for (size_t j = 0; j < MATERIAL_TEX_SIZE; j++)
+			free(material->desc.textures[j]);
+	}
+
+	for (size_t i = 0; i < data->num_images; i++)
+		image_free(&data->images[i]);
+
+	if (data->mapping != NULL)
+		munmap(data->mapping, data->mapping_size);
+
+	free(data->meshes);
+	free(data->materials);
+	free(data->images);
+
+	*data = (struct model_data){0};
+}
+
+/*
+ * Takes ownership of the arrays, which must be allocated, interleaving the vertices and
+ * building the levels of detail.
+ */
+static struct mesh_data mesh_data_create(float *verts, size_t num_verts,
+					 int *indices, size_t num_indices,
+					 float *normals, float *uvs,
+					 enum cg_vertex_format format) {
+	struct mesh_data mesh = {
+		.vertex_format = format,
+		.num_verts = num_verts,
+		.num_indices = num_indices,
+		.num_lods = 1,
+		.lods = {{0, num_indices}},
+		.verts = verts,
+		.normals = normals,
+		.uvs = uvs,
+		.cpu_indices = indices,
+		.owned = true,
+	};
+
+	find_coord_min_max(verts, num_verts,
+			   &mesh.bounds.min.x, &mesh.bounds.max.x,
+			   &mesh.bounds.min.y, &mesh.bounds.max.y,
+			   &mesh.bounds.min.z, &mesh.bounds.max.z);
+
+	struct cg_mesh layout = {
+		.num_verts = num_verts,
+		.verts = verts,
+		.normals = normals,
+		.uvs = uvs,
+	};
+	mesh.attribs = mesh_attribs(&layout);
+
+	size_t stride;
+	long offsets[CG_SATTRIB_LOC_SIZE];
+	mesh.vertices = interleave_vertices(&layout, format, &stride, offsets);
+
+	int max_index = 0;
+	for (size_t i = 0; i < num_indices; i++)
+		max_index = CG_MAX(max_index, indices[i]);
+
+	mesh.index_type = max_index <= UINT16_MAX ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+
+	size_t total_indices = num_indices;
+	int *all_indices = indices;
+	if (mesh_lods > 1 && num_indices > 0)
+		all_indices = build_lods(indices, num_indices, verts, num_verts,
+					 mesh.lods, &mesh.num_lods, &total_indices);
+
+	mesh.indices = pack_indices(all_indices, total_indices, mesh.index_type);
+
+	if (all_indices != indices)
+		free(all_indices);
+
+	return mesh;
+}
+
+/*
+ * Cooked models are a binary image of what loading a model file produces: the vertex and
+ * index buffers exactly as uploaded, LOD ranges included, bounds and the material table.
+ * Loading one maps the file and hands the blobs straight to glBufferData.
+ *
+ * Layout: header, mesh records, material records, NUL terminated strings, then the blobs,
+ * each aligned to COOKED_ALIGNMENT. Offsets are from the start of the file.
+ */
+#define COOKED_MAGIC "CGMC"
+#define COOKED_VERSION 1
+#define COOKED_ALIGNMENT 16
+
+#define COOKED_MATERIAL_DEFAULT (1 << 0)
+
+struct cooked_header {
+	char magic[4];
+	uint32_t version;
+
+	// the source file it was cooked from, any change makes the cooked file stale
+	uint64_t source_size;
+	int64_t source_mtime_sec;
+	int64_t source_mtime_nsec;
+
+	// levels of detail asked for when it was cooked, see cg_set_mesh_lods
+	uint32_t mesh_lods;
+
+	uint32_t num_meshes;
+	uint32_t num_materials;
+	uint32_t pad;
+};
+
+struct cooked_mesh {
+	uint32_t vertex_format;
+	// bit per enum cg_shader_attrib_loc stored in the vertices
+	uint32_t attribs;
+	uint32_t index_type;
+	uint32_t material;
+
+	uint64_t num_verts;
+	uint64_t vertices_offset;
+	// of the first level of detail, the index blob holds all of them
+	uint64_t num_indices;
+	uint64_t indices_offset;
+
+	struct cg_box bounds;
+
+	uint32_t num_lods;
+	uint32_t pad;
+	struct {
+		uint64_t first_index;
+		uint64_t num_indices;
+	} lods[CG_MESH_MAX_LODS];
+};
+
+struct cooked_material {
+	struct cg_vec3f color_ambient;
+	struct cg_vec3f color_diffuse;
+	struct cg_vec3f color_specular;
+	struct cg_vec3f color_transmittance;
+	struct cg_vec3f color_emission;
+	float specular_exponent;
+	float index_of_refraction;
+	float opacity;
+
+	uint32_t flags;
+	uint32_t pad;
+	// offsets of the texture names, 0 for none
+	uint64_t textures[MATERIAL_TEX_SIZE];
+};
+
+static const char *model_cache_dir;
+
+void cg_set_model_cache_dir(const char *dir) {
+	model_cache_dir = dir;
+}
+
+// model_cache_dir/<file name>.<hash of the path>.cgm, so equal names in other dirs differ
+static char *model_cache_path(const char *file_path) {
+	if (model_cache_dir == NULL)
+		return NULL;
+
+	uint64_t hash = hash_bytes(FNV_OFFSET, file_path, strlen(file_path));
+
+	const char *name = strrchr(file_path, '/');
+	name = name == NULL ? file_path : name + 1;
+
+	size_t len = strlen(model_cache_dir) + strlen(name) + 32;
+	char *path = malloc(len);
+	cg_assert(path != NULL);
+
+	snprintf(path, len, "%s/%s.%016" PRIx64 ".cgm", model_cache_dir, name, hash);
+
+	return path;
+}
+
+struct cooked_file CG_DA(unsigned char);
+
+// Grows the file by size zeroed bytes, returning where they start
+static size_t cooked_reserve(struct cooked_file *file, size_t size) {
+	if (file->len + size > file->capacity) {
+		file->capacity = CG_MAX(file->capacity * CG_DA_EXPAND_FACTOR, file->len + size);
+		file->items = realloc(file->items, file->capacity);
+		cg_assert(file->items != NULL);
+	}
+
+	size_t offset = file->len;
+	memset(&file->items[offset], 0, size);
+	file->len += size;
+
+	return offset;
+}
+
+static size_t cooked_append(struct cooked_file *file, const void *data, size_t size) {
+	size_t offset = cooked_reserve(file, size);
+	memcpy(&file->items[offset], data, size);
+
+	return offset;
+}
+
+// Appends data at the next COOKED_ALIGNMENT boundary
+static uint64_t cooked_append_aligned(struct cooked_file *file, const void *data, size_t size) {
+	cooked_reserve(file, (COOKED_ALIGNMENT - file->len % COOKED_ALIGNMENT) % COOKED_ALIGNMENT);
+
+	return cooked_append(file, data, size);
+}
+
+/*
+ * Writes the model data as cooked to path. Written to a temporary file first, so a crash
+ * never leaves a truncated cooked file behind.
+ */
+static bool model_data_write_cooked(const char *path, const struct stat *source,
+				    const struct model_data *data) {
+	struct cooked_file file = {0};
+
+	struct cooked_header header = {
+		.magic = COOKED_MAGIC,
+		.version = COOKED_VERSION,
+		.source_size = source->st_size,
+		.source_mtime_sec = source->st_mtim.tv_sec,
+		.source_mtime_nsec = source->st_mtim.tv_nsec,
+		.mesh_lods = mesh_lods,
+		.num_meshes = data->num_meshes,
+		.num_materials = data->num_materials,
+	};
+	cooked_append(&file, &header, sizeof(header));
+
+	size_t meshes_offset = cooked_reserve(&file, data->num_meshes * sizeof(struct cooked_mesh));
+	size_t materials_offset = cooked_reserve(&file, data->num_materials *
+						 sizeof(struct cooked_material));
+
+	for (size_t i = 0; i < data->num_materials; i++) {
+		const struct material_data *material = &data->materials[i];
+		const struct material_desc *desc = &material->desc;
+
+		struct cooked_material cooked = {
+			.color_ambient = desc->color_ambient,
+			.color_diffuse = desc->color_diffuse,
+			.color_specular = desc->color_specular,
+			.color_transmittance = desc->color_transmittance,
+			.color_emission = desc->color_emission,
+			.specular_exponent = desc->specular_exponent,
+			.index_of_refraction = desc->index_of_refraction,
+			.opacity = desc->opacity,
+			.flags = material->is_default ? COOKED_MATERIAL_DEFAULT : 0,
+		};
+
+		for (size_t j = 0; j < MATERIAL_TEX_SIZE; j++) {
+			if (desc->textures[j] != NULL)
+				cooked.textures[j] = cooked_append(&file, desc->textures[j],
+								   strlen(desc->textures[j]) + 1);
+		}
+
+		memcpy(&file.items[materials_offset + i * sizeof(cooked)], &cooked, sizeof(cooked));
+	}
+
+	for (size_t i = 0; i < data->num_meshes; i++) {
+		const struct mesh_data *mesh = &data->meshes[i];
+
+		struct cooked_mesh cooked = {
+			.vertex_format = mesh->vertex_format,
+			.attribs = mesh->attribs,
+			.index_type = mesh->index_type,
+			.material = mesh->material,
+			.num_verts = mesh->num_verts,
+			.num_indices = mesh->num_indices,
+			.bounds = mesh->bounds,
+			.num_lods = mesh->num_lods,
+		};
+
+		for (size_t j = 0; j < mesh->num_lods; j++) {
+			cooked.lods[j].first_index = mesh->lods[j].first_index;
+			cooked.lods[j].num_indices = mesh->lods[j].num_indices;
+		}
+
+		long offsets[CG_SATTRIB_LOC_SIZE];
+		size_t stride = vertex_layout(mesh->vertex_format, mesh->attribs, offsets);
+
+		cooked.vertices_offset = cooked_append_aligned(&file, mesh->vertices,
+							       stride * mesh->num_verts);
+		cooked.indices_offset = cooked_append_aligned(&file, mesh->indices,
+							      mesh_data_total_indices(mesh) *
+							      index_size(mesh->index_type));
+
+		memcpy(&file.items[meshes_offset + i * sizeof(cooked)], &cooked, sizeof(cooked));
+	}
+
+	size_t tmp_len = strlen(path) + 5;
+	char *tmp_path = malloc(tmp_len);
+	cg_assert(tmp_path != NULL);
+	snprintf(tmp_path, tmp_len, "%s.tmp", path);
+
+	bool ok = false;
+	FILE *fp = fopen(tmp_path, "wb");
+	if (fp != NULL) {
+		ok = fwrite(file.items, 1, file.len, fp) == file.len;
+		ok &= fclose(fp) == 0;
+		ok = ok && rename(tmp_path, path) == 0;
+	}
+
+	if (ok) {
+		cg_info("Cooked model written to %s\n", path);
+	} else {
+		cg_warn("Could not write the cooked model %s\n", path);
+		remove(tmp_path);
+	}
+
+	free(tmp_path);
+	free(file.items);
+
+	return ok;
+}
+
+static bool cooked_range_valid(size_t file_size, uint64_t offset, uint64_t size) {
+	return offset <= file_size && size <= file_size - offset;
+}
+
+static const char *cooked_string(const unsigned char *data, size_t size, uint64_t offset) {
+	if (offset == 0 || offset >= size || memchr(data + offset, '\0', size - offset) == NULL)
+		return NULL;
+
+	return (const char *)data + offset;
+}
+
+static bool cooked_mesh_valid(const struct cooked_mesh *cooked, size_t size,
+			      size_t num_materials) {
+	if (cooked->vertex_format >= CG_VERTEX_FORMAT_SIZE ||
+	    !(cooked->attribs & 1u << CG_SATTRIB_LOC_VERTEX_POSITION) ||
+	    (cooked->index_type != GL_UNSIGNED_SHORT && cooked->index_type != GL_UNSIGNED_INT) ||
+	    cooked->material >= num_materials ||
+	    cooked->num_lods == 0 || cooked->num_lods > CG_MESH_MAX_LODS)
+		return false;
+
+	long offsets[CG_SATTRIB_LOC_SIZE];
+	size_t stride = vertex_layout(cooked->vertex_format, cooked->attribs, offsets);
+	if (!cooked_range_valid(size, cooked->vertices_offset, stride * cooked->num_verts))
+		return false;
+
+	if (cooked->num_indices == 0)
+		return true;
+
+	uint64_t total = 0;
+	for (size_t i = 0; i < cooked->num_lods; i++)
+		total = CG_MAX(total, cooked->lods[i].first_index + cooked->lods[i].num_indices);
+
+	return cooked->lods[0].num_indices == cooked->num_indices &&
+		cooked_range_valid(size, cooked->indices_offset,
+				   total * index_size(cooked->index_type));
+}
+
+
+static struct mesh_data mesh_data_from_cooked(const struct cooked_mesh *cooked,
+					      const unsigned char *file) {
+	struct mesh_data mesh = {
+		.vertex_format = cooked->vertex_format,
+		.attribs = cooked->attribs,
+		.num_verts = cooked->num_verts,
+		.vertices = file + cooked->vertices_offset,
+		.index_type = cooked->index_type,
+		.num_indices = cooked->num_indices,
+		.indices = file + cooked->indices_offset,
+		.num_lods = cooked->num_lods,
+		.bounds = cooked->bounds,
+		.material = cooked->material,
+	};
+
+	for (size_t i = 0; i < mesh.num_lods; i++) {
+		mesh.lods[i].first_index = cooked->lods[i].first_index;
+		mesh.lods[i].num_indices = cooked->lods[i].num_indices;
+	}
+
+	if (mesh_cpu_data == CG_MESH_CPU_DATA_NONE)
+		return mesh;
+
+	// only the geometry can be recovered from the packed vertices
+	long offsets[CG_SATTRIB_LOC_SIZE];
+	size_t stride = vertex_layout(mesh.vertex_format, mesh.attribs, offsets);
+
+	mesh.verts = malloc(sizeof(*mesh.verts) * mesh.num_verts * 3);
+	cg_assert(mesh.verts != NULL);
+
+	for (size_t i = 0; i < mesh.num_verts; i++)
+		memcpy(&mesh.verts[i * 3],
+		       mesh.vertices + i * stride + offsets[CG_SATTRIB_LOC_VERTEX_POSITION],
+		       sizeof(float) * 3);
+
+	if (mesh.num_indices == 0)
+		return mesh;
+
+	mesh.cpu_indices = malloc(sizeof(*mesh.cpu_indices) * mesh.num_indices);
+	cg_assert(mesh.cpu_indices != NULL);
+
+	for (size_t i = 0; i < mesh.num_indices; i++) {
+		if (mesh.index_type == GL_UNSIGNED_SHORT) {
+			unsigned short index;
+			memcpy(&index, mesh.indices + i * sizeof(index), sizeof(index));
+			mesh.cpu_indices[i] = index;
+		} else {
+			unsigned int index;
+			memcpy(&index, mesh.indices + i * sizeof(index), sizeof(index));
+			mesh.cpu_indices[i] = index;
+		}
+	}
+
+	return mesh;
+}
+
+/*
+ * Loads the cooked model at path, failing when it is missing, stale or not a valid cooked
+ * file, in which case the source has to be loaded instead. The meshes point into the
+ * mapping of the file, which data keeps until it is freed.
+ */
+static bool model_data_from_cooked(const char *path, const struct stat *source,
+				   struct model_data *data) {
+	int fd = open(path, O_RDONLY);
+	if (fd == -1)
+		return false;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(struct cooked_header)) {
+		close(fd);
+		return false;
+	}
+
+	size_t size = st.st_size;
+	unsigned char *file = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (file == MAP_FAILED)
+		return false;
+
+	struct cooked_header header;
+	memcpy(&header, file, sizeof(header));
+
+	size_t meshes_offset = sizeof(header);
+	size_t materials_offset = meshes_offset + header.num_meshes * sizeof(struct cooked_mesh);
+
+	bool valid = memcmp(header.magic, COOKED_MAGIC, sizeof(header.magic)) == 0 &&
+		header.version == COOKED_VERSION &&
+		header.source_size == (uint64_t)source->st_size &&
+		header.source_mtime_sec == source->st_mtim.tv_sec &&
+		header.source_mtime_nsec == source->st_mtim.tv_nsec &&
+		header.mesh_lods == mesh_lods &&
+		cooked_range_valid(size, meshes_offset,
+				   header.num_meshes * sizeof(struct cooked_mesh)) &&
+		cooked_range_valid(size, materials_offset,
+				   header.num_materials * sizeof(struct cooked_material));
+
+	const struct cooked_mesh *cooked_meshes = (const void *)(file + meshes_offset);
+	const struct cooked_material *cooked_materials = (const void *)(file + materials_offset);
+
+	for (size_t i = 0; valid && i < header.num_meshes; i++)
+		valid = cooked_mesh_valid(&cooked_meshes[i], size, header.num_materials);
+
+	if (!valid) {
+		cg_info("Cooked model %s is stale, cooking it again\n", path);
+		munmap(file, size);
+		return false;
+	}
+
+	*data = (struct model_data) {
+		.num_meshes = header.num_meshes,
+		.meshes = calloc(header.num_meshes, sizeof(*data->meshes)),
+		.num_materials = header.num_materials,
+		.materials = calloc(header.num_materials, sizeof(*data->materials)),
+		.mapping = file,
+		.mapping_size = size,
+	};
+	cg_assert((data->meshes || !data->num_meshes) && (data->materials || !data->num_materials));
+
+	for (size_t i = 0; i < header.num_meshes; i++)
+		data->meshes[i] = mesh_data_from_cooked(&cooked_meshes[i], file);
+
+	for (size_t i = 0; i < header.num_materials; i++) {
+		const struct cooked_material *cooked = &cooked_materials[i];
+		struct material_data *material = &data->materials[i];
+
+		material->is_default = cooked->flags & COOKED_MATERIAL_DEFAULT;
+		material->desc = (struct material_desc) {
+			.color_ambient = cooked->color_ambient,
+			.color_diffuse = cooked->color_diffuse,
+			.color_specular = cooked->color_specular,
+			.color_transmittance = cooked->color_transmittance,
+			.color_emission = cooked->color_emission,
+			.specular_exponent = cooked->specular_exponent,
+			.index_of_refraction = cooked->index_of_refraction,
+			.opacity = cooked->opacity,
+		};
+
+		for (size_t j = 0; j < MATERIAL_TEX_SIZE; j++) {
+			const char *name = cooked_string(file, size, cooked->textures[j]);
+
+			if (name != NULL) {
+				material->desc.textures[j] = strdup(name);
+				cg_assert(material->desc.textures[j] != NULL);
+			}
+		}
+	}
+
+	cg_info("Cooked model loaded from %s\n", path);
+
+	return true;
+}
+
+// Parses an OBJ file, normalizing its positions to a unit sized box around the origin
+static bool model_data_from_obj(const char *file_path, struct model_data *data) {
+	tinyobj_attrib_t tn_attrib = {0};
+	tinyobj_attrib_init(&tn_attrib);
+	tinyobj_shape_t *tn_shapes;
+	size_t tn_num_shapes;
+	tinyobj_material_t *tn_materials;
+	size_t tn_num_materials;
+
+	struct CG_DA(struct file_view) files = {0};
+	int ret = tinyobj_parse_obj(&tn_attrib, &tn_shapes, &tn_num_shapes,
+				    &tn_materials, &tn_num_materials,
+				    file_path, tn_read_file_callback, &files,
+				    0);
+
+	for (size_t i = 0; i < files.len; i++)
+		cg_file_release(files.items[i].data, files.items[i].size);
+	free(files.items);
+
+	if (ret != TINYOBJ_SUCCESS) {
+		cg_error("Could not parse %s\n", file_path);
+		return false;
+	}
+
+	float x_min, x_max;
+	float y_min, y_max;
+	float z_min, z_max;
+	find_coord_min_max(tn_attrib.vertices, tn_attrib.num_vertices,
+			   &x_min, &x_max,
+			   &y_min, &y_max,
+			   &z_min, &z_max);
+
+	float x_size = x_max - x_min;
+	float y_size = y_max - y_min;
+	float z_size = z_max - z_min;
+
+	for (size_t i = 0; i < tn_attrib.num_vertices * 3; i += 3) {
+		float *x = &tn_attrib.vertices[i + 0];
+		float *y = &tn_attrib.vertices[i + 1];
+		float *z = &tn_attrib.vertices[i + 2];
+
+		*x = (*x - x_size / 2 - x_min) / x_size;
+		*y = (*y - y_size / 2 - y_min) / x_size;
+		*z = (*z - z_size / 2 - z_min) / x_size;
+	}
+
+	*data = (struct model_data) {
+		.num_meshes = tn_num_shapes,
+		.meshes = calloc(tn_num_shapes, sizeof(*data->meshes)),
+		.num_materials = tn_num_materials,
+		// room for the default material
+		.materials = calloc(tn_num_materials + 1, sizeof(*data->materials)),
+	};
+	cg_assert((data->meshes || !tn_num_shapes) && data->materials);
+
+	for (size_t i = 0;  i < tn_num_shapes; i++) {
+		size_t num_indices = tn_shapes[i].length * 3;
+		size_t indices_offset = tn_shapes[i].face_offset * 3;
+		struct welded_mesh w = weld_faces(&tn_attrib, tn_attrib.faces + indices_offset,
+						  num_indices);
+
+		// the welded arrays were sized for the worst case
+		w.verts = realloc(w.verts, sizeof(*w.verts) * CG_MAX(w.num_verts, 1) * 3);
+		if (w.normals != NULL)
+			w.normals = realloc(w.normals, sizeof(*w.normals) * CG_MAX(w.num_verts, 1) * 3);
+		if (w.uvs != NULL)
+			w.uvs = realloc(w.uvs, sizeof(*w.uvs) * CG_MAX(w.num_verts, 1) * 2);
+
+		data->meshes[i] = mesh_data_create(w.verts, w.num_verts, w.indices, num_indices,
+						   w.normals, w.uvs, CG_VERTEX_FORMAT_FLOAT);
+
+		int mesh_to_mat = tn_attrib.material_ids[tn_shapes[i].face_offset];
+		if (mesh_to_mat == -1) {
+			mesh_to_mat = tn_num_materials;
+			data->num_materials = tn_num_materials + 1;
+			data->materials[mesh_to_mat].is_default = true;
+		}
+
+		data->meshes[i].material = mesh_to_mat;
+	}
+
+	for (size_t i = 0;  i < tn_num_materials; i++) {
+		struct material_desc *desc = &data->materials[i].desc;
+
+		*desc = material_desc_from_obj(&tn_materials[i]);
+
+		for (size_t j = 0; j < MATERIAL_TEX_SIZE; j++) {
+			if (desc->textures[j] != NULL) {
+				desc->textures[j] = strdup(desc->textures[j]);
+				cg_assert(desc->textures[j] != NULL);
+			}
+		}
+	}
+
+	tinyobj_attrib_free(&tn_attrib);
+	tinyobj_shapes_free(tn_shapes, tn_num_shapes);
+	tinyobj_materials_free(tn_materials, tn_num_materials);
+
+	return true;
+}
+
+struct images_decode {
+	char **paths;
+	struct image *images;
+};
+
+static void images_decode_job(size_t i, void *arg) {
+	struct images_decode *decode = arg;
+
+	image_load(decode->paths[i], &decode->images[i]);
+}
+
+/*
+ * Gathers the textures of all the materials, the ones that resolve to the same file only
+ * once, and decodes them in parallel.
+ */
+static void model_data_decode_textures(const char *model_path, struct model_data *data) {
+	struct CG_DA(char *) paths = {0};
+
+	for (size_t i = 0; i < data->num_materials; i++) {
+		struct material_data *material = &data->materials[i];
+
+		for (size_t j = 0; j < MATERIAL_TEX_SIZE; j++) {
+			material->images[j] = NO_IMAGE;
+
+			if (material->desc.textures[j] == NULL)
+				continue;
+
+			char *path = texture_path(model_path, material->desc.textures[j]);
+
+			size_t k;
+			for (k = 0; k < paths.len; k++) {
+				if (strcmp(paths.items[k], path) == 0)
+					break;
+			}
+
+			if (k == paths.len)
+				cg_da_append(&paths, path);
+			else
+				free(path);
+
+			material->images[j] = k;
+		}
+	}
+
+	data->num_images = paths.len;
+	data->images = calloc(CG_MAX(paths.len, 1), sizeof(*data->images));
+	cg_assert(data->images != NULL);
+
+	struct images_decode decode = {
+		.paths = paths.items,
+		.images = data->images,
+	};
+	cg_jobs_parallel_for(paths.len, images_decode_job, &decode);
+
+	for (size_t i = 0; i < paths.len; i++)
+		free(paths.items[i]);
+	free(paths.items);
+}
+
+/*
+ * Everything of loading a model that does not touch the GL: reading the cooked copy or
+ * parsing the source and cooking it, then decoding the textures. Safe to call from any
+ * thread.
+ */
+static bool model_data_load(const char *file_path, struct model_data *data) {
+	struct stat source;
+
+	// sources that are not plain files, like the ones from a bed callback, are not cached
+	char *cache_path = model_cache_path(file_path);
+	if (cache_path != NULL && stat(file_path, &source) != 0) {
+		free(cache_path);
+		cache_path = NULL;
+	}
+
+	if (cache_path == NULL || !model_data_from_cooked(cache_path, &source, data)) {
+		if (!model_data_from_obj(file_path, data)) {
+			free(cache_path);
+			return false;
+		}
+
+		if (cache_path != NULL)
+			model_data_write_cooked(cache_path, &source, data);
+	}
+
+	free(cache_path);
+
+	model_data_decode_textures(file_path, data);
+
+	return true;
+}
+
+static struct cg_mesh mesh_from_data(struct mesh_data *data) {
+	struct cg_mesh mesh = {
+		.num_verts = data->num_verts,
+		.num_indices = data->num_indices,
+		.index_type = data->index_type,
+		.bounds = data->bounds,
+		.interleaved = true,
+		.vertex_format = data->vertex_format,
+		.num_lods = data->num_lods,
+	};
+	memcpy(mesh.lods, data->lods, sizeof(mesh.lods));
+
+	long offsets[CG_SATTRIB_LOC_SIZE];
+	size_t stride = vertex_layout(data->vertex_format, data->attribs, offsets);
+
+	size_t num_indices = mesh.num_indices != 0 ? mesh_data_total_indices(data) : 0;
+
+	if (!mesh_upload_arena(&mesh, data->attribs, data->vertices, data->indices, num_indices)) {
+		mesh_upload_vertices(&mesh, data->vertices, stride, offsets);
+		mesh_upload_element_buffer(&mesh, num_indices != 0 ? data->indices : NULL,
+					   num_indices);
+	}
+
+	mesh.verts = data->verts;
+	mesh.indices = data->cpu_indices;
+	mesh.normals = data->normals;
+	mesh.num_normals = data->normals != NULL ? mesh.num_verts : 0;
+	mesh.uvs = data->uvs;
+	mesh.num_uvs = data->uvs != NULL ? mesh.num_verts : 0;
+
+	data->verts = data->normals = data->uvs = NULL;
+	data->cpu_indices = NULL;
+
+	mesh_release_cpu_data(&mesh);
+
+	return mesh;
+}
+
+static struct cg_material material_from_data(const struct material_data *data,
+					     const struct cg_texture *images) {
+	if (data->is_default)
+		return cg_material_default();
+
+	const struct material_desc *desc = &data->desc;
+	struct cg_material m = {0};
+
+	m.shader = cg_shader_prg_default();
+
+	m.color_ambient = desc->color_ambient;
+	m.color_diffuse = desc->color_diffuse;
+	m.color_specular = desc->color_specular;
+	m.color_transmittance = desc->color_transmittance;
+	m.color_emission = desc->color_emission;
+
+	m.specular_exponent = desc->specular_exponent;
+	m.index_of_refraction = desc->index_of_refraction;
+	m.opacity = desc->opacity;
+	m.transparent = m.opacity < 1.0f || desc->textures[MATERIAL_TEX_ALPHA] != NULL;
+
+	m.enable_color = true;
+
+	struct cg_texture *textures[MATERIAL_TEX_SIZE] = {
+		[MATERIAL_TEX_AMBIENT] = &m.tex_ambient,
+		[MATERIAL_TEX_DIFFUSE] = &m.tex_diffuse,
+		[MATERIAL_TEX_SPECULAR] = &m.tex_specular,
+		[MATERIAL_TEX_SPECULAR_HIGHLIGHT] = &m.tex_specular_highlight,
+		[MATERIAL_TEX_BUMP] = &m.tex_bump,
+		[MATERIAL_TEX_DISPLACEMENT] = &m.tex_displacement,
+		[MATERIAL_TEX_ALPHA] = &m.tex_alpha,
+	};
+
+	for (size_t i = 0; i < MATERIAL_TEX_SIZE; i++) {
+		if (data->images[i] != NO_IMAGE)
+			*textures[i] = images[data->images[i]];
+	}
+
+	return m;
+}
+
+// Upload of a model_data, one mesh, texture or material at a time
+struct model_upload {
+	struct model_data data;
+	size_t step;
+
+	struct cg_mesh *meshes;
+	struct cg_texture *textures;
+	struct cg_material *materials;
+	size_t *mesh_to_material;
+};
+
+static bool image_packable(const struct image *image) {
+	return !image->cached && image->pixels != NULL && image->compressed_format == 0;
+}
+
+/*
+ * Uploads the decoded images of the same size and format into the layers of one texture
+ * array each. The layers are owned by the model, like its other textures, so they are not
+ * added to the texture cache.
+ */
+static void model_upload_pack_images(struct model_upload *upload) {
+	struct model_data *data = &upload->data;
+
+	const unsigned char **layers = malloc(sizeof(*layers) * data->num_images);
+	size_t *members = malloc(sizeof(*members) * data->num_images);
+	cg_assert(layers != NULL && members != NULL);
+
+	for (size_t i = 0; i < data->num_images; i++) {
+		const struct image *first = &data->images[i];
+
+		if (!image_packable(first) || upload->textures[i].gl_tex != 0)
+			continue;
+
+		size_t num_layers = 0;
+		for (size_t j = i; j < data->num_images; j++) {
+			const struct image *image = &data->images[j];
+
+			if (image_packable(image) && upload->textures[j].gl_tex == 0 &&
+			    image->width == first->width && image->height == first->height &&
+			    image->channels == first->channels) {
+				layers[num_layers] = image->pixels;
+				members[num_layers++] = j;
+			}
+		}
+
+		if (num_layers < 2)
+			continue;
+
+		GLenum format = image_gl_format(first);
+		struct cg_texture array = cg_texture_create_2d_array(layers, num_layers,
+								     first->width, first->height,
+								     format, format);
+
+		for (size_t j = 0; j < num_layers; j++) {
+			upload->textures[members[j]] = array;
+			upload->textures[members[j]].layer = j;
+		}
+	}
+
+	free(layers);
+	free(members);
+}
+
+// Uploads the next mesh, texture or material, returns true once model holds the finished model
+static bool model_upload_step(struct model_upload *upload, struct cg_model *model) {
+	struct model_data *data = &upload->data;
+
+	if (upload->step == 0) {
+		upload->meshes = malloc(sizeof(*upload->meshes) * CG_MAX(data->num_meshes, 1));
+		upload->materials = malloc(sizeof(*upload->materials) *
+					   CG_MAX(data->num_materials, 1));
+		upload->mesh_to_material = malloc(sizeof(*upload->mesh_to_material) *
+						  CG_MAX(data->num_meshes, 1));
+		upload->textures = calloc(CG_MAX(data->num_images, 1), sizeof(*upload->textures));
+		cg_assert(upload->meshes && upload->materials && upload->mesh_to_material &&
+			  upload->textures);
+	}
+
+	size_t step = upload->step++;
+
+	if (step < data->num_meshes) {
+		upload->meshes[step] = mesh_from_data(&data->meshes[step]);
+		upload->mesh_to_material[step] = data->meshes[step].material;
+		return false;
+	}
+
+	step -= data->num_meshes;
+	if (step < data->num_images) {
+		if (step == 0 && texture_arrays)
+			model_upload_pack_images(upload);
+
+		if (upload->textures[step].gl_tex == 0 && image_loaded(&data->images[step]))
+			upload->textures[step] = texture_from_image(&data->images[step]);
+		image_free(&data->images[step]);
+		return false;
+	}
+
+	step -= data->num_images;
+	if (step < data->num_materials) {
+		upload->materials[step] = material_from_data(&data->materials[step],
+							     upload->textures);
+		return false;
+	}
+
+	*model = cg_model_create(upload->meshes, data->num_meshes,
+				 data->num_materials > 0 ? upload->materials : NULL,
+				 data->num_materials, upload->mesh_to_material);
+
+	free(upload->meshes);
+	free(upload->textures);
+	free(upload->materials);
+	free(upload->mesh_to_material);
+	model_data_free(data);
+
+	*upload = (struct model_upload){0};
+
+	return true;
+}
+
+struct cg_model cg_model_from_obj_file(const char *file_path) {
+	cg_assert(file_path != NULL);
+
+	struct model_upload upload = {0};
+	cg_assert(model_data_load(file_path, &upload.data));
+
+	struct cg_model model;
+	while (!model_upload_step(&upload, &model))
+		;
+
+	return model;
+}
+
+#define DEFAULT_UPLOAD_BUDGET 2.0
+
+enum load_kind {
+	LOAD_TEXTURE,
+	LOAD_MODEL,
+};
+
+struct cg_load {
+	enum load_kind kind;
+	char *path;
+
+	// enum cg_load_status, polled without taking the lock
+	SDL_atomic_t status;
+	// the worker is done with it, guarded by loads.lock
+	bool loaded;
+
+	struct image image;
+	struct model_upload upload;
+
+	struct cg_texture texture;
+	struct cg_model model;
+};
+
+/*
+ * Workers read, decode and parse, then queue the loads in uploads. The render thread then
+ * takes them in order and does their GL part a step at a time.
+ */
+static struct {
+	SDL_mutex *lock;
+	SDL_cond *loaded;
+
+	struct CG_DA(struct cg_load *) uploads;
+
+	double budget;
+} loads = {
+	.budget = DEFAULT_UPLOAD_BUDGET,
+};
+
+void cg_set_upload_budget(double ms) {
+	loads.budget = ms;
+}
+
+static void load_job(void *arg) {
+	struct cg_load *load = arg;
+
+	bool ok = load->kind == LOAD_TEXTURE ? image_load(load->path, &load->image)
+					     : model_data_load(load->path, &load->upload.data);
+
+	SDL_LockMutex(loads.lock);
+
+	load->loaded = true;
+	if (ok) {
+		cg_da_append(&loads.uploads, load);
+	} else {
+		image_free(&load->image);
+		SDL_AtomicSet(&load->status, CG_LOAD_FAILED);
+	}
+
+	SDL_CondBroadcast(loads.loaded);
+	SDL_UnlockMutex(loads.lock);
+}
+
+static struct cg_load *load_submit(enum load_kind kind, const char *file_path) {
+	cg_assert(file_path != NULL);
+
+	if (loads.lock == NULL) {
+		loads.lock = SDL_CreateMutex();
+		loads.loaded = SDL_CreateCond();
+		cg_assert(loads.lock != NULL && loads.loaded != NULL);
+	}
+
+	struct cg_load *load = calloc(1, sizeof(*load));
+	cg_assert(load != NULL);
+
+	load->kind = kind;
+	load->path = strdup(file_path);
+	cg_assert(load->path != NULL);
+	SDL_AtomicSet(&load->status, CG_LOAD_PENDING);
+
+	cg_jobs_submit(load_job, load);
+
+	return load;
+}
+
+struct cg_load *cg_texture_load_async(const char *file_path) {
+	return load_submit(LOAD_TEXTURE, file_path);
+}
+
+struct cg_load *cg_model_load_async(const char *file_path) {
+	return load_submit(LOAD_MODEL, file_path);
+}
+
+enum cg_load_status cg_load_poll(const struct cg_load *load) {
+	return SDL_AtomicGet((SDL_atomic_t *)&load->status);
+}
+
+// Uploads a part of a load, once it is all there it leaves the upload queue and is done
+static bool load_upload_step(struct cg_load *load) {
+	bool done = true;
+
+	if (load->kind == LOAD_TEXTURE) {
+		load->texture = texture_from_image(&load->image);
+		image_free(&load->image);
+	} else {
+		done = model_upload_step(&load->upload, &load->model);
+	}
+
+	if (!done)
+		return false;
+
+	SDL_LockMutex(loads.lock);
+
+	for (size_t i = 0; i < loads.uploads.len; i++) {
+		if (loads.uploads.items[i] == load) {
+			memmove(&loads.uploads.items[i], &loads.uploads.items[i + 1],
+				(loads.uploads.len - i - 1) * sizeof(*loads.uploads.items));
+			loads.uploads.len--;
+			break;
+		}
+	}
+
+	SDL_UnlockMutex(loads.lock);
+
+	SDL_AtomicSet(&load->status, CG_LOAD_DONE);
+
+	return true;
+}
+
+/*
+ * Uploads the loads the workers finished until the budget is spent. At least one step is
+ * taken every call, so loads keep moving with any budget.
+ */
+static void loads_upload(void) {
+	if (loads.lock == NULL)
+		return;
+
+	CG_PROFILE_SCOPE("async uploads");
+
+	uint64_t start = SDL_GetPerformanceCounter();
+	double ticks_per_ms = SDL_GetPerformanceFrequency() / 1000.0;
+
+	while (true) {
+		SDL_LockMutex(loads.lock);
+		struct cg_load *load = loads.uploads.len > 0 ? loads.uploads.items[0] : NULL;
+		SDL_UnlockMutex(loads.lock);
+
+		if (load == NULL)
+			break;
+
+		load_upload_step(load);
+
+		if ((SDL_GetPerformanceCounter() - start) / ticks_per_ms >= loads.budget)
+			break;
+	}
+}
+
+void cg_load_wait(struct cg_load *load) {
+	SDL_LockMutex(loads.lock);
+	while (!load->loaded)
+		SDL_CondWait(loads.loaded, loads.lock);
+	SDL_UnlockMutex(loads.lock);
+
+	while (cg_load_poll(load) == CG_LOAD_PENDING)
+		load_upload_step(load);
+}
+
+static void load_destroy(struct cg_load *load) {
+	free(load->path);
+	free(load);
+}
+
+struct cg_texture cg_load_take_texture(struct cg_load *load) {
+	cg_assert(load->kind == LOAD_TEXTURE);
+
+	cg_load_wait(load);
+
+	struct cg_texture texture = cg_load_poll(load) == CG_LOAD_DONE ? load->texture
+								      : cg_texture_default();
+	load_destroy(load);
+
+	return texture;
+}
+
+struct cg_model cg_load_take_model(struct cg_load *load) {
+	cg_assert(load->kind == LOAD_MODEL);
+
+	cg_load_wait(load);
+
+	struct cg_model model = load->model;
+	load_destroy(load);
+
+	return model;
+}
+
+void cg_model_set_position(struct cg_model *model, struct cg_vec3f position) {
+	model->position = position;
+	model->world_dirty = true;
+}
+
+void cg_model_move(struct cg_model *model, struct cg_vec3f ds) {
+	model->position = cg_vec3f_add(model->position, ds);
+	model->world_dirty = true;
+}
+
+void cg_model_set_rotation(struct cg_model *model, struct cg_vec3f rotation) {
+	model->rotation = rotation;
+	model->world_dirty = true;
+}
+
+void cg_model_rotate(struct cg_model *model, struct cg_vec3f dr) {
+	model->rotation = cg_vec3f_add(model->rotation, dr);
+	model->world_dirty = true;
+}
+
+void cg_model_set_scale(struct cg_model *model, struct cg_vec3f scale) {
+	model->scale = scale;
+	model->world_dirty = true;
+}
+
+void cg_model_scale(struct cg_model *model, struct cg_vec3f ds) {
+	model->scale = cg_vec3f_mul(model->scale, ds);
+	model->world_dirty = true;
+}
+
+const struct cg_mat4f *cg_model_get_world_matrix(struct cg_model *model) {
+	if (model->world_dirty) {
+		model->world_matrix = cg_mat4f_model(model->position, model->scale,
+						     model->rotation);
+		model->world_dirty = false;
+	}
+
+	return &model->world_matrix;
+}
+
+struct cg_box cg_model_get_bounding_box(struct cg_model *model) {
+	return cg_box_transform(model->bounding_box, cg_model_get_world_matrix(model));
+}
+
+// std140 layout of the cg_frame block
+struct frame_block {
+	struct cg_mat4f view;
+	struct cg_mat4f projection;
+	struct cg_mat4f view_projection;
+	float camera_pos[4];
+	float time;
+	float pad[3];
+};
+
+// std140 layout of a cg_material of the cg_materials block
+struct material_block {
+	// rgb and opacity
+	float diffuse[4];
+	// rgb and specular exponent
+	float ambient[4];
+	// rgb and index of refraction
+	float specular[4];
+	float emission[4];
+	// 1 when there is a diffuse texture, its layer or -1 if it is not an array
+	int32_t diffuse_tex[4];
+	// bindless handle of the diffuse texture, low and high halves, 0 when it is bound instead
+	uint32_t diffuse_handle[4];
+};
+
+// materials a cg_materials block sees at once, the array size in the shaders
+#define MATERIALS_PER_BLOCK 128
+
+struct material_slot {
+	const struct cg_material *material;
+	size_t index;
+};
+
+/*
+ * The uniform buffers behind the cg_frame and cg_materials blocks. The materials of the queued
+ * draws are gathered once per flush, each one only once, and a draw then only sets the index
+ * of its material inside the MATERIALS_PER_BLOCK window bound at the time.
+ */
+static struct {
+	unsigned int frame_ubo;
+	unsigned long frame_camera_generation;
+	float time;
+
+	unsigned int materials_ubo;
+	size_t materials_capacity;
+	// first material of the bound window, SIZE_MAX when there is none
+	size_t window;
+
+	struct CG_DA(struct material_block) materials;
+	// open addressing table from the material to its index in materials
+	struct material_slot *slots;
+	size_t slots_capacity;
+} blocks = {
+	.window = SIZE_MAX,
+};
+
+static void frame_block_upload(void) {
+	if (blocks.frame_ubo == 0) {
+		blocks.frame_ubo = gen_buffer();
+
+		glBindBufferBase(GL_UNIFORM_BUFFER, CG_UBO_BINDING_FRAME, blocks.frame_ubo);
+		cg_assert_gl();
+	}
+
+	struct frame_block frame = {
+		.view = cg_ctx.view_matrix,
+		.projection = cg_ctx.projection_matrix,
+		.view_projection = cg_mat4f_multiply(cg_ctx.view_matrix, cg_ctx.projection_matrix),
+		.camera_pos = {cg_ctx.camera_pos.x, cg_ctx.camera_pos.y, cg_ctx.camera_pos.z, 1.0f},
+		.time = blocks.time,
+	};
+
+	glBindBuffer(GL_UNIFORM_BUFFER, blocks.frame_ubo);
+	cg_assert_gl();
+
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(frame), &frame, GL_STREAM_DRAW);
+	cg_assert_gl();
+
+	blocks.frame_camera_generation = cg_ctx.gl_state.camera_generation;
+	cg_ctx.frame_stats.uniform_uploads++;
+}
+
+static void frame_block_begin(void) {
+	blocks.time = SDL_GetTicks() / 1000.0f;
+	frame_block_upload();
+}
+
+// The camera can still move after cg_start_render wrote the block
+static void frame_block_update(void) {
+	if (blocks.frame_camera_generation != cg_ctx.gl_state.camera_generation)
+		frame_block_upload();
+	else
+		cg_ctx.gl_state.calls_avoided++;
+}
+
+static struct material_block material_block_from(const struct cg_material *material) {
+	const struct cg_texture *diffuse = &material->tex_diffuse;
+
+	return (struct material_block){
+		.diffuse = {material->color_diffuse.x, material->color_diffuse.y,
+			    material->color_diffuse.z, material->opacity},
+		.ambient = {material->color_ambient.x, material->color_ambient.y,
+			    material->color_ambient.z, material->specular_exponent},
+		.specular = {material->color_specular.x, material->color_specular.y,
+			     material->color_specular.z, material->index_of_refraction},
+		.emission = {material->color_emission.x, material->color_emission.y,
+			     material->color_emission.z, 0.0f},
+		.diffuse_tex = {diffuse->gl_tex != 0,
+				diffuse->type == CG_TEXTURE_2D_ARRAY ? (int32_t)diffuse->layer : -1},
+		.diffuse_handle = {diffuse->handle & 0xffffffff, diffuse->handle >> 32},
+	};
+}
+
+// Sizes the buffer to hold count materials, rounded up to whole windows
+static void materials_reserve(size_t count) {
+	size_t capacity = (count + MATERIALS_PER_BLOCK - 1) / MATERIALS_PER_BLOCK *
+			  MATERIALS_PER_BLOCK;
+	capacity = CG_MAX(capacity, MATERIALS_PER_BLOCK);
+
+	if (blocks.materials_ubo == 0) {
+		blocks.materials_ubo = gen_buffer();
+
+		int alignment;
+		glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+		cg_assert_gl();
+		cg_assert(MATERIALS_PER_BLOCK * sizeof(struct material_block) % alignment == 0);
+	}
+
+	glBindBuffer(GL_UNIFORM_BUFFER, blocks.materials_ubo);
+	cg_assert_gl();
+
+	if (capacity > blocks.materials_capacity) {
+		glBufferData(GL_UNIFORM_BUFFER, capacity * sizeof(struct material_block), NULL,
+			     GL_STREAM_DRAW);
+		cg_assert_gl();
+
+		blocks.materials_capacity = capacity;
+		blocks.window = SIZE_MAX;
+	}
+}
+
+static size_t hash_pointer(const void *p) {
+	return ((uintptr_t)p >> 4) * 0x9e3779b97f4a7c15ull;
+}
+
+// Index of the material in the gathered ones, adding it the first time it is seen
+static size_t materials_gather(const struct cg_material *material) {
+	size_t mask = blocks.slots_capacity - 1;
+
+	for (size_t i = hash_pointer(material) & mask;; i = (i + 1) & mask) {
+		struct material_slot *slot = &blocks.slots[i];
+
+		if (slot->material == material)
+			return slot->index;
+
+		if (slot->material == NULL) {
+			slot->material = material;
+			slot->index = blocks.materials.len;
+			cg_da_append(&blocks.materials, material_block_from(material));
 
-	return prg;
+			return slot->index;
+		}
+	}
 }
 
-struct cg_shader_prg cg_shader_prg_default() {
-	static struct cg_shader_prg default_shader_prg = {0};
+// Gathers the materials of the queued items and uploads them
+static void materials_upload(struct draw_item *items, size_t count) {
+	size_t capacity = 16;
+	while (capacity < count * 2)
+		capacity *= 2;
+
+	if (capacity > blocks.slots_capacity) {
+		free(blocks.slots);
+		blocks.slots = malloc(sizeof(*blocks.slots) * capacity);
+		cg_assert(blocks.slots != NULL);
+		blocks.slots_capacity = capacity;
+	}
+	memset(blocks.slots, 0, sizeof(*blocks.slots) * blocks.slots_capacity);
 
-	if (default_shader_prg.id == 0) {
-		struct cg_shader_prg_builder builder = {0};
+	blocks.materials.len = 0;
+	for (size_t i = 0; i < count; i++)
+		items[i].material_index = materials_gather(items[i].material);
 
-		size_t vert_shader_len;
-		const char *vert_shader_src = (char*)cg_bed_get("../resources/shaders/vert.glsl",
-								   &vert_shader_len);
-		cg_assert(vert_shader_src != NULL);
+	if (blocks.materials.len == 0)
+		return;
 
-		cg_shader_prg_builder_add_shader(&builder,
-						 vert_shader_src,
-						 vert_shader_len,
-						 GL_VERTEX_SHADER);
+	materials_reserve(blocks.materials.len);
 
-		size_t frag_shader_len;
-		const char *frag_shader_src = (char*)cg_bed_get("../resources/shaders/frag.glsl",
-								&frag_shader_len);
-		cg_assert(frag_shader_src != NULL);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, blocks.materials.len * sizeof(struct material_block),
+			blocks.materials.items);
+	cg_assert_gl();
+	cg_ctx.frame_stats.uniform_uploads++;
+}
 
-		cg_shader_prg_builder_add_shader(&builder,
-						 frag_shader_src,
-						 frag_shader_len,
-						 GL_FRAGMENT_SHADER);
+// Binds the window holding the material, returns its index inside the window
+static int materials_bind(size_t index) {
+	size_t window = index / MATERIALS_PER_BLOCK * MATERIALS_PER_BLOCK;
 
-		default_shader_prg = cg_shader_prg_builder_build(&builder);
+	if (blocks.window != window) {
+		glBindBufferRange(GL_UNIFORM_BUFFER, CG_UBO_BINDING_MATERIALS, blocks.materials_ubo,
+				  window * sizeof(struct material_block),
+				  MATERIALS_PER_BLOCK * sizeof(struct material_block));
+		cg_assert_gl();
+		blocks.window = window;
+	} else {
+		cg_ctx.gl_state.calls_avoided++;
 	}
 
-	return default_shader_prg;
+	return index - window;
 }
 
-struct cg_texture cg_texture_create_2d(const unsigned char *data, size_t width, size_t height,
-				       int internal_format, int format) {
-	struct cg_texture tex = { .type = CG_TEXTURE_2D };
+// Draws outside of the queue have no gathered material, theirs is written at the start
+static size_t materials_write_single(const struct cg_material *material) {
+	struct material_block block = material_block_from(material);
 
-	glGenTextures(1, &tex.gl_tex);
-	cg_assert(!cg_check_gl());
+	materials_reserve(1);
 
-	glBindTexture(GL_TEXTURE_2D, tex.gl_tex);
-	cg_assert(!cg_check_gl());
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(block), &block);
+	cg_assert_gl();
+	cg_ctx.frame_stats.uniform_uploads++;
 
-	glTexImage2D(GL_TEXTURE_2D, 0, internal_format, width, height, 0, format, GL_UNSIGNED_BYTE,
-		     data);
-	cg_assert(!cg_check_gl());
+	return 0;
+}
 
-	glGenerateMipmap(GL_TEXTURE_2D);
-	cg_assert(!cg_check_gl());
+/*
+ * Sets up the material for shader. Programs with the cg_materials block get the index of the
+ * material, index being SIZE_MAX for the ones not gathered, and read a bindless texture from
+ * the block. The others get its colors and handle through the loose uniforms. Textures
+ * without a handle are bound either way.
+ */
+static void state_use_material(const struct cg_shader_prg *shader,
+			       const struct cg_material *material, size_t index) {
+	struct cg_frame_stats *stats = &cg_ctx.frame_stats;
+
+	const struct cg_texture *diffuse = &material->tex_diffuse;
+	bool array = diffuse->type == CG_TEXTURE_2D_ARRAY;
+	int sampler_loc = shader->uniform_locs[array ? CG_SUNIFORM_DIFFUSE_TEXTURE_ARRAY
+						     : CG_SUNIFORM_DIFFUSE_TEXTURE];
+	bool textured = diffuse->gl_tex != 0 && sampler_loc != -1;
+
+	if (shader->material_block) {
+		if (index == SIZE_MAX)
+			index = materials_write_single(material);
+
+		int window_index = materials_bind(index);
+
+		// the instanced programs read it from the instance_material attribute
+		if (shader->uniform_locs[CG_SUNIFORM_MATERIAL_INDEX] != -1) {
+			glUniform1i(shader->uniform_locs[CG_SUNIFORM_MATERIAL_INDEX], window_index);
+			stats->uniform_uploads++;
+		} else {
+			glVertexAttribI1i(CG_SATTRIB_LOC_INSTANCE_MATERIAL, window_index);
+		}
+		cg_assert_gl();
+	} else if (textured) {
+		glUniform1i(shader->uniform_locs[CG_SUNIFORM_DIFFUSE_TEXTURE_PROVIDED], 1);
+		glUniform1i(shader->uniform_locs[CG_SUNIFORM_DIFFUSE_TEXTURE_LAYER],
+			    array ? (int)diffuse->layer : -1);
+		cg_assert_gl();
+		stats->uniform_uploads += 2;
+	} else {
+		glUniform1i(shader->uniform_locs[CG_SUNIFORM_DIFFUSE_TEXTURE_PROVIDED], 0);
+		glUniform3f(shader->uniform_locs[CG_SUNIFORM_DIFFUSE_COLOR],
+			    material->color_diffuse.x,
+			    material->color_diffuse.y,
+			    material->color_diffuse.z);
+		cg_assert_gl();
+		stats->uniform_uploads += 2;
+	}
 
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	cg_assert(!cg_check_gl());
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-	cg_assert(!cg_check_gl());
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-	cg_assert(!cg_check_gl());
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	cg_assert(!cg_check_gl());
+	if (!textured)
+		return;
 
-	return tex;
+	if (diffuse->handle == 0) {
+		state_bind_texture(array ? 1 : 0, array ? GL_TEXTURE_2D_ARRAY : GL_TEXTURE_2D,
+				   diffuse->gl_tex);
+	} else if (!shader->material_block) {
+		glUniformHandleui64ARB(sampler_loc, diffuse->handle);
+		cg_assert_gl();
+		stats->uniform_uploads++;
+	}
 }
 
-struct cg_texture cg_texture_from_file_2d(const char *file_path) {
-	cg_info("Loading file %s\n", file_path);
-	size_t file_size;
-	unsigned char *file = cg_ctx.file_read(file_path, &file_size);
-	if (file == NULL) {
-		cg_error("File %s nor found\n", file_path);
+// Uploads the view and projection matrices to programs without the cg_frame block
+static void state_use_camera(const struct cg_shader_prg *shader) {
+	if (shader->frame_block) {
+		frame_block_update();
+		return;
 	}
-	cg_assert(file != NULL);
-
-	int width, height, channels;
-	unsigned char *data = stbi_load_from_memory(file, file_size, &width, &height, &channels, 0);
-	cg_assert(data != NULL);
 
-	int internal_format = -1;
-	int format = -1;
+	if (state_camera_outdated(shader->id)) {
+		glUniformMatrix4fv(shader->uniform_locs[CG_SUNIFORM_MATRIX_VIEW],
+				   1, false, cg_ctx.view_matrix.d);
+		cg_assert_gl();
 
-	switch (channels) {
-		case 1:
-			internal_format = GL_RED;
-			format = GL_RED;
-			break;
-		case 2:
-			internal_format = GL_RG;
-			format = GL_RG;
-			break;
-		case 3:
-			internal_format = GL_RGB;
-			format = GL_RGB;
-			break;
-		case 4:
-			internal_format = GL_RGBA;
-			format = GL_RGBA;
-			break;
+		glUniformMatrix4fv(shader->uniform_locs[CG_SUNIFORM_MATRIX_PROJECTION],
+				   1, false, cg_ctx.projection_matrix.d);
+		cg_assert_gl();
+		cg_ctx.frame_stats.uniform_uploads += 2;
 	}
+}
 
-	cg_assert(internal_format != -1);
-	cg_assert(format != -1);
+// Points the instance_model attribute of the bound vertex array to the transforms at offset
+static void bind_instance_transforms(unsigned int buffer, size_t offset) {
+	glBindBuffer(GL_ARRAY_BUFFER, buffer);
+	cg_assert_gl();
 
-	struct cg_texture tex = cg_texture_create_2d(data, width, height, internal_format, format);
+	// A mat4 attribute takes one location per column
+	for (size_t col = 0; col < 4; col++) {
+		unsigned int loc = CG_SATTRIB_LOC_INSTANCE_MODEL + col;
 
-	stbi_image_free(data);
+		glVertexAttribPointer(loc, 4, GL_FLOAT, GL_FALSE, sizeof(struct cg_mat4f),
+				      (void*)(offset + col * 4 * sizeof(float)));
+		cg_assert_gl();
 
-	return tex;
+		glVertexAttribDivisor(loc, 1);
+		cg_assert_gl();
+
+		glEnableVertexAttribArray(loc);
+		cg_assert_gl();
+	}
 }
 
-struct cg_texture cg_texture_default() {
-	static struct cg_texture default_tex = {0};
+static void draw_mesh(const struct draw_item *item) {
+	const struct cg_mesh *mesh = item->mesh;
+	const struct cg_material *material = item->material;
+	const struct cg_shader_prg *shader = &item->shader;
 
-	if (default_tex.gl_tex == 0) {
-		unsigned char default_tex_data[DEFAULT_TEX_SIZE * 4 * DEFAULT_TEX_SIZE] = {0};
+	state_use_program(shader->id);
 
-		for (size_t y = 0; y < DEFAULT_TEX_SIZE; y++) {
-			for (size_t x = 0; x < DEFAULT_TEX_SIZE; x++) {
-				if ((x + y % 2) % 2 == 0) {
-					default_tex_data[(x + y * DEFAULT_TEX_SIZE) * 4 + 0] = 0xff;
-					default_tex_data[(x + y * DEFAULT_TEX_SIZE) * 4 + 1] = 0x00;
-					default_tex_data[(x + y * DEFAULT_TEX_SIZE) * 4 + 2] = 0xff;
-				}
-			}
-		}
+	struct cg_frame_stats *stats = &cg_ctx.frame_stats;
 
-		default_tex = cg_texture_create_2d(default_tex_data,
-						   DEFAULT_TEX_SIZE, DEFAULT_TEX_SIZE,
-						   GL_RGBA, GL_RGBA);
-		glBindTexture(GL_TEXTURE_2D, default_tex.gl_tex);
-		cg_assert(!cg_check_gl());
-		cg_assert(!cg_check_gl());
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-		cg_assert(!cg_check_gl());
+	if (item->instance_count == 0) {
+		glUniformMatrix4fv(shader->uniform_locs[CG_SUNIFORM_MATRIX_MODEL],
+				   1, false, item->model_matrix.d);
+		cg_assert_gl();
+		stats->uniform_uploads++;
 	}
 
-	return default_tex;
-}
-
-struct cg_material cg_material_default() {
-	struct cg_material ret = {
-		.shader = cg_shader_prg_default(),
-		.enable_color = true,
-		.tex_diffuse = cg_texture_default(),
-	};
+	state_use_camera(shader);
+	state_use_material(shader, material, item->material_index);
 
-	return ret;
-}
-static void find_coord_min_max(const float *vertices, const size_t vert_len,
-			       float *x_min, float *x_max,
-			       float *y_min, float *y_max,
-			       float *z_min, float *z_max) {
-	*x_min = vertices[0];
-	*x_max = vertices[0];
-	*y_min = vertices[1];
-	*y_max = vertices[1];
-	*z_min = vertices[2];
-	*z_max = vertices[2];
+	state_bind_vao(mesh->vao);
 
-	for (size_t i = 0; i < vert_len; i += 1) {
-		*x_min = CG_MIN(vertices[i * 3 + 0], *x_min);
-		*x_max = CG_MAX(vertices[i * 3 + 0], *x_max);
-		*y_min = CG_MIN(vertices[i * 3 + 1], *y_min);
-		*y_max = CG_MAX(vertices[i * 3 + 1], *y_max);
-		*z_min = CG_MIN(vertices[i * 3 + 2], *z_min);
-		*z_max = CG_MAX(vertices[i * 3 + 2], *z_max);
-	}
-}
+	const struct cg_mesh_lod *lod = &mesh->lods[CG_MIN(item->lod, mesh->num_lods - 1)];
+	void *first_index = (void*)((mesh->base_index + lod->first_index) *
+				    index_size(mesh->index_type));
 
+	size_t num_elements = mesh->num_indices == 0 ? mesh->num_verts : lod->num_indices;
+	size_t num_instances = CG_MAX(item->instance_count, 1);
 
-struct cg_model cg_model_create(const struct cg_mesh *meshes, const size_t num_meshes,
-				const struct cg_material *materials, const size_t num_materials,
-				const size_t *mesh_to_material) {
-	struct cg_material default_material = cg_material_default();
-	size_t default_mesh_to_material[] = {0};
+	stats->draw_calls++;
+	stats->instances += num_instances;
+	stats->triangles += num_elements / 3 * num_instances;
 
-	struct cg_model ret = {
-		.num_meshes = num_meshes,
-		.num_materials = num_materials,
-		.scale = (struct cg_vec3f){1, 1, 1},
-	};
+	if (item->instance_count == 0) {
+		if (mesh->num_indices == 0)
+			glDrawArrays(GL_TRIANGLES, mesh->base_vertex, mesh->num_verts);
+		else
+			glDrawElementsBaseVertex(GL_TRIANGLES, lod->num_indices, mesh->index_type,
+						 first_index, mesh->base_vertex);
 
-	if (materials == NULL) {
-		ret.num_materials = 1;
-		materials = &default_material;
-		mesh_to_material = default_mesh_to_material;
+		cg_assert_gl();
+		return;
 	}
 
-	ret.meshes = malloc(ret.num_meshes * sizeof(*ret.meshes));
-	cg_assert(ret.meshes != NULL);
-	memcpy(ret.meshes, meshes, ret.num_meshes * sizeof(*ret.meshes));
+	bind_instance_transforms(instance_range.buffer, instance_range.offset +
+				 item->instance_offset * sizeof(struct cg_mat4f));
 
-	ret.materials = malloc(ret.num_materials * sizeof(*ret.materials));
-	cg_assert(ret.materials != NULL);
-	memcpy(ret.materials, materials, ret.num_materials * sizeof(*ret.materials));
+	// a multi draw may have left the material array of the arena enabled
+	if (mesh->arena != NULL) {
+		glDisableVertexAttribArray(CG_SATTRIB_LOC_INSTANCE_MATERIAL);
+		cg_assert_gl();
+	}
 
-	ret.mesh_to_material = malloc(ret.num_meshes * sizeof(*ret.mesh_to_material));
-	cg_assert(ret.mesh_to_material != NULL);
-	memcpy(ret.mesh_to_material, mesh_to_material, ret.num_meshes * sizeof(*ret.mesh_to_material));
+	if (mesh->num_indices == 0)
+		glDrawArraysInstanced(GL_TRIANGLES, mesh->base_vertex, mesh->num_verts,
+				      item->instance_count);
+	else
+		glDrawElementsInstancedBaseVertex(GL_TRIANGLES, lod->num_indices, mesh->index_type,
+						  first_index, item->instance_count,
+						  mesh->base_vertex);
 
-	struct cg_box bounding_box = {0};
-	for (size_t i = 0; i < ret.num_meshes; i++) {
-		float x_min, x_max;
-		float y_min, y_max;
-		float z_min, z_max;
-		find_coord_min_max(ret.meshes[i].verts, ret.meshes[i].num_verts,
-				   &x_min, &x_max,
-				   &y_min, &y_max,
-				   &z_min, &z_max);
-		bounding_box.min.x = CG_MIN(bounding_box.min.x, x_min);
-		bounding_box.max.x = CG_MAX(bounding_box.max.x, x_max);
-		bounding_box.min.y = CG_MIN(bounding_box.min.y, y_min);
-		bounding_box.max.y = CG_MAX(bounding_box.max.y, y_max);
-		bounding_box.min.z = CG_MIN(bounding_box.min.z, z_min);
-		bounding_box.max.z = CG_MAX(bounding_box.max.z, z_max);
-	}
+	cg_assert_gl();
+}
 
-	ret.bounding_box = bounding_box;
+// Items the multi draw path takes, the indexed arena meshes drawn with the default programs
+static bool draw_item_batchable(const struct draw_item *item) {
+	if (!multi_draw || item->mesh->arena == NULL || item->mesh->num_indices == 0)
+		return false;
 
-	return ret;
+	unsigned int id = item->shader.id;
+	return id == cg_shader_prg_default().id || id == cg_shader_prg_default_instanced().id;
 }
 
-static void tn_read_file_callback(void *ctx, const char *filename, int is_mtl,
-			          const char *obj_filename, char **buf, size_t *len) {
-	(void) ctx;
-	(void) is_mtl;
-	(void) obj_filename;
+// Texture the item has bound to draw, 0 when it has none or it is bindless
+static unsigned int draw_item_bound_texture(const struct draw_item *item) {
+	const struct cg_texture *diffuse = &item->material->tex_diffuse;
 
-	*buf = (char*)cg_ctx.file_read(filename, len);
+	return diffuse->handle != 0 ? 0 : diffuse->gl_tex;
 }
 
-static struct cg_texture load_tex_relative(const char *model_path, const char *image_path) {
-	char *dir_end = strrchr(model_path, '/');
-	if (dir_end != NULL) {
-		char *image_dir_end = strrchr(image_path, '/');
-		if (image_dir_end != NULL) {
-			*image_dir_end = '\0';
-			if (strstr(image_path, "..") == NULL) {
-				return cg_texture_from_file_2d(image_path);
-			}
-			*image_dir_end = '/';
-		}
+/*
+ * Whether b can go in the same multi draw as a, which needs the same bound state. Bindless
+ * handles come from the material block, so they do not get in the way.
+ */
+static bool draw_items_batch(const struct draw_item *a, const struct draw_item *b) {
+	return draw_item_batchable(b) && a->mesh->vao == b->mesh->vao && a->fill == b->fill &&
+	       draw_item_bound_texture(a) == draw_item_bound_texture(b) &&
+	       a->material_index / MATERIALS_PER_BLOCK == b->material_index / MATERIALS_PER_BLOCK;
+}
+
+// DrawElementsIndirectCommand
+struct draw_command {
+	uint32_t count;
+	uint32_t instance_count;
+	uint32_t first_index;
+	int32_t base_vertex;
+	uint32_t base_instance;
+};
 
-		int model_dir_len;
+static struct {
+	struct CG_DA(struct draw_command) commands;
+	struct CG_DA(struct cg_mat4f) transforms;
+	struct CG_DA(int32_t) materials;
+} batch;
 
-		if (dir_end == NULL) {
-			model_dir_len = 0;
+/*
+ * Draws the run of items at the start of items that can share a multi draw, returning how
+ * many it took, 0 when no run of at least two starts there. Every item is a command, and its
+ * instances find their transform and material index through the base instance of it.
+ */
+static size_t draw_batch(const struct draw_item *items, size_t count,
+			 const struct cg_mat4f *instances) {
+	const struct draw_item *first = &items[0];
+
+	if (!draw_item_batchable(first))
+		return 0;
+
+	size_t len = 1;
+	while (len < count && draw_items_batch(first, &items[len]))
+		len++;
+
+	if (len < 2)
+		return 0;
+
+	struct cg_frame_stats *stats = &cg_ctx.frame_stats;
+
+	batch.commands.len = 0;
+	batch.transforms.len = 0;
+	batch.materials.len = 0;
+
+	for (size_t i = 0; i < len; i++) {
+		const struct draw_item *item = &items[i];
+		const struct cg_mesh *mesh = item->mesh;
+		const struct cg_mesh_lod *lod = &mesh->lods[CG_MIN(item->lod, mesh->num_lods - 1)];
+		size_t num_instances = CG_MAX(item->instance_count, 1);
+
+		cg_da_append(&batch.commands, ((struct draw_command){
+			.count = lod->num_indices,
+			.instance_count = num_instances,
+			.first_index = mesh->base_index + lod->first_index,
+			.base_vertex = mesh->base_vertex,
+			.base_instance = batch.transforms.len,
+		}));
+
+		if (item->instance_count == 0) {
+			cg_da_append(&batch.transforms, item->model_matrix);
 		} else {
-			model_dir_len  = dir_end - model_path + 1;
+			for (size_t j = 0; j < item->instance_count; j++)
+				cg_da_append(&batch.transforms, instances[item->instance_offset + j]);
 		}
 
-		char *abs_image_path = calloc(model_dir_len + strlen(image_path) + 1, sizeof(char));
-		sprintf(abs_image_path, "%.*s%s", model_dir_len, model_path, image_path);
+		// all of them are in the window of the first one
+		int32_t material = item->material_index % MATERIALS_PER_BLOCK;
+		for (size_t j = 0; j < num_instances; j++)
+			cg_da_append(&batch.materials, material);
 
-		struct cg_texture ret = cg_texture_from_file_2d(abs_image_path);
+		stats->instances += num_instances;
+		stats->triangles += lod->num_indices / 3 * num_instances;
+	}
 
-		free(abs_image_path);
+	struct cg_shader_prg shader = cg_shader_prg_default_instanced();
 
-		return ret;
+	state_use_program(shader.id);
+	state_use_camera(&shader);
+	state_use_material(&shader, first->material, first->material_index);
+	state_bind_vao(first->mesh->vao);
 
-	} else {
-		return cg_texture_from_file_2d(image_path);
-	}
-}
+	struct cg_stream_range transforms = cg_stream_upload(batch.transforms.items,
+							     sizeof(struct cg_mat4f) *
+							     batch.transforms.len,
+							     sizeof(struct cg_mat4f));
+	struct cg_stream_range materials = cg_stream_upload(batch.materials.items,
+							    sizeof(int32_t) * batch.materials.len,
+							    sizeof(int32_t));
+	struct cg_stream_range commands = cg_stream_upload(batch.commands.items,
+							   sizeof(struct draw_command) * len,
+							   sizeof(uint32_t));
 
-struct cg_model cg_model_from_obj_file(const char *file_path) {
-	cg_assert(file_path != NULL);
+	bind_instance_transforms(transforms.buffer, transforms.offset);
 
-	tinyobj_attrib_t tn_attrib = {0};
-	tinyobj_attrib_init(&tn_attrib);
-	tinyobj_shape_t *tn_shapes;
-	size_t tn_num_shapes;
-	tinyobj_material_t *tn_materials;
-	size_t tn_num_materials;
-	int ret = tinyobj_parse_obj(&tn_attrib, &tn_shapes, &tn_num_shapes,
-				    &tn_materials, &tn_num_materials,
-				    file_path, tn_read_file_callback, NULL,
-				    0);
-	cg_assert(ret == TINYOBJ_SUCCESS);
+	glBindBuffer(GL_ARRAY_BUFFER, materials.buffer);
+	cg_assert_gl();
 
-	float x_min, x_max;
-	float y_min, y_max;
-	float z_min, z_max;
-	find_coord_min_max(tn_attrib.vertices, tn_attrib.num_vertices,
-			   &x_min, &x_max,
-			   &y_min, &y_max,
-			   &z_min, &z_max);
+	glVertexAttribIPointer(CG_SATTRIB_LOC_INSTANCE_MATERIAL, 1, GL_INT, sizeof(int32_t),
+			       (void*)materials.offset);
+	cg_assert_gl();
 
-	float x_size = x_max - x_min;
-	float y_size = y_max - y_min;
-	float z_size = z_max - z_min;
+	glVertexAttribDivisor(CG_SATTRIB_LOC_INSTANCE_MATERIAL, 1);
+	cg_assert_gl();
 
-	for (size_t i = 0; i < tn_attrib.num_vertices * 3; i += 3) {
-		float *x = &tn_attrib.vertices[i + 0];
-		float *y = &tn_attrib.vertices[i + 1];
-		float *z = &tn_attrib.vertices[i + 2];
+	glEnableVertexAttribArray(CG_SATTRIB_LOC_INSTANCE_MATERIAL);
+	cg_assert_gl();
 
-		*x = (*x - x_size / 2 - x_min) / x_size;
-		*y = (*y - y_size / 2 - y_min) / x_size;
-		*z = (*z - z_size / 2 - z_min) / x_size;
-	}
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commands.buffer);
+	cg_assert_gl();
 
-	float *ex_verts = tn_attrib.num_vertices == 0 ? NULL : malloc(sizeof(*ex_verts) *
-								      tn_attrib.num_faces * 3);
-	float *ex_uvs = tn_attrib.num_texcoords == 0 ? NULL : malloc(sizeof(*ex_uvs) *
-								     tn_attrib.num_faces * 2);
-	float *ex_norms = tn_attrib.num_normals == 0 ? NULL : malloc(sizeof(*ex_uvs) *
-								     tn_attrib.num_faces * 3);
+	glMultiDrawElementsIndirect(GL_TRIANGLES, first->mesh->index_type,
+				    (void*)commands.offset, len, 0);
+	cg_assert_gl();
 
-	for (size_t i = 0; i < tn_attrib.num_faces; i++) {
-		if (ex_verts != NULL) {
-			ex_verts[i * 3 + 0] = tn_attrib.vertices[tn_attrib.faces[i].v_idx * 3 + 0];
-			ex_verts[i * 3 + 1] = tn_attrib.vertices[tn_attrib.faces[i].v_idx * 3 + 1];
-			ex_verts[i * 3 + 2] = tn_attrib.vertices[tn_attrib.faces[i].v_idx * 3 + 2];
-		}
+	stats->draw_calls++;
 
-		if (ex_uvs != NULL) {
-			ex_uvs[i * 2 + 0] = tn_attrib.texcoords[tn_attrib.faces[i].vt_idx * 2 + 0];
-			ex_uvs[i * 2 + 1] = tn_attrib.texcoords[tn_attrib.faces[i].vt_idx * 2 + 1];
-		}
+	return len;
+}
 
-		if (ex_norms != NULL) {
-			ex_norms[i * 3 + 0] = tn_attrib.normals[tn_attrib.faces[i].vn_idx * 3 + 0];
-			ex_norms[i * 3 + 1] = tn_attrib.normals[tn_attrib.faces[i].vn_idx * 3 + 1];
-			ex_norms[i * 3 + 2] = tn_attrib.normals[tn_attrib.faces[i].vn_idx * 3 + 2];
-		}
-	}
+static struct {
+	bool disabled;
 
-	struct CG_DA(struct cg_mesh) meshes = {0};
+	unsigned long camera_generation;
+	struct cg_frustum frustum;
 
-	size_t *mesh_to_material = calloc(tn_num_shapes, sizeof(*mesh_to_material));
+	struct CG_DA(struct cg_mat4f) visible_instances;
+} culling;
 
-	for (size_t i = 0;  i < tn_num_shapes; i++) {
-		mesh_to_material[i] = i;
+void cg_set_frustum_culling(bool enable) {
+	culling.disabled = !enable;
+}
+
+bool cg_get_frustum_culling(void) {
+	return !culling.disabled;
+}
+
+const struct cg_frustum *cg_view_frustum(void) {
+	if (culling.camera_generation != cg_ctx.gl_state.camera_generation) {
+		struct cg_mat4f view_projection = cg_mat4f_multiply(cg_ctx.view_matrix,
+								    cg_ctx.projection_matrix);
+		culling.frustum = cg_frustum_from_matrix(&view_projection);
+		culling.camera_generation = cg_ctx.gl_state.camera_generation;
 	}
 
-	bool add_default_material = false;
+	return &culling.frustum;
+}
 
-	for (size_t i = 0;  i < tn_num_shapes; i++) {
-		size_t num_indices = tn_shapes[i].length * 3;
-		size_t indices_offset = tn_shapes[i].face_offset * 3;
-		struct cg_mesh m = cg_mesh_create(ex_verts + indices_offset * 3, num_indices,
-						  NULL, 0,
-						  ex_norms + indices_offset * 3, num_indices,
-						  ex_uvs + indices_offset * 2, num_indices);
-		cg_da_append(&meshes, m);
+bool cg_model_is_visible(const struct cg_model *model, const struct cg_mat4f *world) {
+	if (culling.disabled)
+		return true;
 
-		int mesh_to_mat = tn_attrib.material_ids[tn_shapes[i].face_offset];
-		if (mesh_to_mat == -1) {
-			add_default_material = true;
-			mesh_to_mat = tn_num_materials;
-		}
+	struct cg_box box = cg_box_transform(model->bounding_box, world);
 
-		mesh_to_material[i] = mesh_to_mat;
+	if (!cg_frustum_test_box(cg_view_frustum(), box)) {
+		cg_ctx.frame_stats.culled++;
+		return false;
 	}
 
-	struct CG_DA(struct cg_material) materials = {0};
+	cg_ctx.frame_stats.visible++;
+	return true;
+}
 
-	for (size_t i = 0;  i < tn_num_materials; i++) {
-		struct cg_material m = {0};
-
-		m.shader = cg_shader_prg_default();
-
-		m.color_ambient = cg_vec3f_from_array(tn_materials[i].ambient);
-		m.color_diffuse = cg_vec3f_from_array(tn_materials[i].diffuse);
-		m.color_specular = cg_vec3f_from_array(tn_materials[i].specular);
-		m.color_transmittance = cg_vec3f_from_array(tn_materials[i].transmittance);
-		m.color_emission = cg_vec3f_from_array(tn_materials[i].emission);
-
-		m.specular_exponent = tn_materials[i].shininess;
-		m.index_of_refraction = tn_materials[i].ior;
-		m.opacity = tn_materials[i].dissolve;
-
-		m.enable_color = true;
-
-		if (tn_materials[i].ambient_texname)
-			m.tex_ambient = load_tex_relative(file_path,
-							  tn_materials[i].ambient_texname);
-		if (tn_materials[i].diffuse_texname)
-			m.tex_diffuse = load_tex_relative(file_path,
-							  tn_materials[i].diffuse_texname);
-		if (tn_materials[i].specular_texname)
-			m.tex_specular = load_tex_relative(file_path,
-							   tn_materials[i].specular_texname);
-		if (tn_materials[i].specular_highlight_texname)
-			m.tex_specular_highlight =
-				load_tex_relative(file_path,
-						  tn_materials[i].specular_highlight_texname);
-		if (tn_materials[i].bump_texname)
-			m.tex_bump = load_tex_relative(file_path, tn_materials[i].bump_texname);
-		if (tn_materials[i].displacement_texname)
-			m.tex_displacement =
-				load_tex_relative(file_path, tn_materials[i].displacement_texname);
-		if (tn_materials[i].alpha_texname)
-			m.tex_alpha = load_tex_relative(file_path, tn_materials[i].alpha_texname);
-
-		cg_da_append(&materials, m);
-	}
-
-	if (add_default_material) {
-		cg_da_append(&materials, cg_material_default());
-	}
-
-	struct cg_model model = cg_model_create(meshes.items, meshes.len,
-						materials.items, materials.len, mesh_to_material);
-
-	free(materials.items);
-	free(mesh_to_material);
-	free(meshes.items);
-	free(ex_verts);
-	free(ex_uvs);
-	free(ex_norms);
-	tinyobj_attrib_free(&tn_attrib);
-	tinyobj_shapes_free(tn_shapes, tn_num_shapes);
-	tinyobj_materials_free(tn_materials, tn_num_materials);
+// fraction the projected size has to pass a threshold by to leave the current level
+#define LOD_HYSTERESIS 0.1f
 
-	return model;
-}
+static float lod_threshold = 0.25f;
 
-void cg_model_set_position(struct cg_model *model, struct cg_vec3f position) {
-	model->position = position;
-}
+void cg_set_lod_threshold(float threshold) {
+	cg_assert(threshold > 0);
 
-void cg_model_move(struct cg_model *model, struct cg_vec3f ds) {
-	model->position = cg_vec3f_add(model->position, ds);
+	lod_threshold = threshold;
 }
 
-void cg_model_set_rotation(struct cg_model *model, struct cg_vec3f rotation) {
-	model->rotation = rotation;
-}
+static size_t lod_for_size(float size, size_t num_lods) {
+	size_t lod = 0;
 
-void cg_model_rotate(struct cg_model *model, struct cg_vec3f dr) {
-	model->rotation = cg_vec3f_add(model->rotation, dr);
-}
+	for (float threshold = lod_threshold; lod + 1 < num_lods && size < threshold;
+	     threshold /= 2)
+		lod++;
 
-void cg_model_set_scale(struct cg_model *model, struct cg_vec3f scale) {
-	model->scale = scale;
+	return lod;
 }
 
-void cg_model_scale(struct cg_model *model, struct cg_vec3f ds) {
-	model->scale = cg_vec3f_mul(model->scale, ds);
-}
+size_t cg_model_select_lod(const struct cg_model *model, const struct cg_mat4f *world,
+			   size_t current) {
+	size_t num_lods = 1;
+	for (size_t i = 0; i < model->num_meshes; i++)
+		num_lods = CG_MAX(num_lods, model->meshes[i].num_lods);
 
-struct cg_box cg_model_get_bounding_box(struct cg_model *model) {
-	struct cg_box ret = {0};
+	if (num_lods == 1)
+		return 0;
 
-	struct cg_mat4f m = cg_mat4f_model(model->position, model->scale, model->rotation);
-	ret.min = cg_vec3f_mat4f_multiply(model->bounding_box.min, m);
-	ret.max = cg_vec3f_mat4f_multiply(model->bounding_box.max, m);
+	struct cg_box box = cg_box_transform(model->bounding_box, world);
+	struct cg_vec3f extent = cg_vec3f_sub(box.max, box.min);
+	struct cg_vec3f center = cg_vec3f_add(box.min, cg_vec3f_mul(extent,
+								    (struct cg_vec3f){0.5, 0.5, 0.5}));
+	struct cg_vec3f to_camera = cg_vec3f_sub(center, cg_ctx.camera_pos);
 
-	return ret;
+	float radius = sqrtf(cg_vec3f_dot(extent, extent)) / 2;
+	float distance = sqrtf(cg_vec3f_dot(to_camera, to_camera));
+
+	// inside the bounds, or a projection without perspective
+	if (distance <= radius || cg_ctx.projection_matrix.d[m(2, 3)] == 0)
+		return 0;
+
+	// 1 / tan(fov / 2), scales the size at distance 1 to the half height of the view
+	float focal = cg_ctx.projection_matrix.d[m(1, 1)];
+	float size = radius * focal / distance;
+
+	size_t lod = lod_for_size(size, num_lods);
+	if (lod > current)
+		lod = CG_MAX(current, lod_for_size(size * (1 + LOD_HYSTERESIS), num_lods));
+	else if (lod < current)
+		lod = CG_MIN(current, lod_for_size(size * (1 - LOD_HYSTERESIS), num_lods));
+
+	return lod;
 }
 
 void cg_model_draw(struct cg_model *model) {
+	const struct cg_mat4f *m = cg_model_get_world_matrix(model);
+
+	if (!cg_model_is_visible(model, m))
+		return;
+
+	model->lod = cg_model_select_lod(model, m, model->lod);
+	cg_model_draw_lod(model, m, model->lod);
+}
+
+void cg_model_draw_transformed(struct cg_model *model, const struct cg_mat4f *m) {
+	cg_model_draw_lod(model, m, 0);
+}
+
+void cg_model_draw_lod(struct cg_model *model, const struct cg_mat4f *m, size_t lod) {
 	for (size_t i = 0; i < model->num_meshes; i++) {
-		struct cg_material *material = &model->materials[model->mesh_to_material[i]];
-		struct cg_shader_prg *shader = &material->shader;
-		struct cg_mat4f m = cg_mat4f_model(model->position, model->scale, model->rotation);
-
-		glUseProgram(material->shader.id);
-		cg_assert(!cg_check_gl());
-
-		glUniformMatrix4fv(material->shader.uniform_locs[CG_SUNIFORM_MATRIX_MODEL],
-				   1, false, m.d);
-		cg_assert(!cg_check_gl());
-
-		glUniformMatrix4fv(material->shader.uniform_locs[CG_SUNIFORM_MATRIX_VIEW],
-				1, false, cg_ctx.view_matrix.d);
-		cg_assert(!cg_check_gl());
-
-		glUniformMatrix4fv(material->shader.uniform_locs[CG_SUNIFORM_MATRIX_PROJECTION],
-				1, false, cg_ctx.projection_matrix.d);
-		cg_assert(!cg_check_gl());
-
-		if (material->tex_diffuse.gl_tex != 0 &&
-		    shader->uniform_locs[CG_SUNIFORM_DIFFUSE_TEXTURE] != -1) {
-			glUniform1i(shader->uniform_locs[CG_SUNIFORM_DIFFUSE_TEXTURE_PROVIDED], 1);
-			glUniform1i(shader->uniform_locs[CG_SUNIFORM_DIFFUSE_TEXTURE], 0);
-			cg_assert(!cg_check_gl());
-			glActiveTexture(GL_TEXTURE0);
-			cg_assert(!cg_check_gl());
-			glBindTexture(GL_TEXTURE_2D, material->tex_diffuse.gl_tex);
-			cg_assert(!cg_check_gl());
-		} else {
-			glUniform1i(shader->uniform_locs[CG_SUNIFORM_DIFFUSE_TEXTURE_PROVIDED], 0);
-			glUniform3f(material->shader.uniform_locs[CG_SUNIFORM_DIFFUSE_COLOR],
-				    material->color_diffuse.x,
-				    material->color_diffuse.y,
-				    material->color_diffuse.z);
-			cg_assert(!cg_check_gl());
+		struct draw_item item = {
+			.mesh = &model->meshes[i],
+			.material = &model->materials[model->mesh_to_material[i]],
+			.model_matrix = *m,
+			.lod = lod,
+			.fill = cg_ctx.fill,
+			.material_index = SIZE_MAX,
+		};
+		item.shader = item.material->shader;
+
+		if (!render_queue.recording) {
+			draw_mesh(&item);
+			continue;
 		}
 
-		struct cg_mesh *mesh = &model->meshes[i];
-		glBindVertexArray(mesh->vao);
-		cg_assert(!cg_check_gl());
+		item.key = draw_item_key(&item, view_depth(m));
+		cg_da_append(&render_queue.items, item);
+	}
+}
 
-		if (mesh->indices == NULL)
-			glDrawArrays(GL_TRIANGLES, 0, mesh->num_verts);
-		else
-			glDrawElements(GL_TRIANGLES, mesh->num_indices, GL_UNSIGNED_INT, 0);
+void cg_model_draw_instanced(struct cg_model *model, const struct cg_mat4f *transforms,
+			     size_t count) {
+	if (!culling.disabled) {
+		culling.visible_instances.len = 0;
+		for (size_t i = 0; i < count; i++) {
+			if (cg_model_is_visible(model, &transforms[i]))
+				cg_da_append(&culling.visible_instances, transforms[i]);
+		}
 
-		cg_assert(!cg_check_gl());
+		transforms = culling.visible_instances.items;
+		count = culling.visible_instances.len;
 	}
-}
 
-static struct cg_mesh mesh_cube() {
-	static bool created = false;
-	static float box_verts[8 * 3];
+	if (count == 0)
+		return;
 
-	if (!created) {
-		created = true;
+	size_t instance_offset = 0;
+	if (render_queue.recording) {
+		instance_offset = render_queue.instances.len;
+		for (size_t i = 0; i < count; i++)
+			cg_da_append(&render_queue.instances, transforms[i]);
+	} else {
+		upload_instances(transforms, count);
+	}
 
-		for (size_t z = 0; z <= 1; z++) {
-			for (size_t y = 0; y <= 1; y++) {
-				for (size_t x = 0; x <= 1; x++) {
-					size_t index = z * 4 * 3 + y * 3 * 2 + x * 3;
-					box_verts[index + 0] = x - 0.5;
-					box_verts[index + 1] = y - 0.5;
-					box_verts[index + 2] = z - 0.5;
-				}
-			}
+	for (size_t i = 0; i < model->num_meshes; i++) {
+		struct draw_item item = {
+			.mesh = &model->meshes[i],
+			.material = &model->materials[model->mesh_to_material[i]],
+			.instance_offset = instance_offset,
+			.instance_count = count,
+			.fill = cg_ctx.fill,
+			.material_index = SIZE_MAX,
+		};
+
+		item.shader = item.material->shader;
+		if (!item.shader.instanced)
+			item.shader = cg_shader_prg_default_instanced();
+
+		if (!render_queue.recording) {
+			draw_mesh(&item);
+			continue;
 		}
 
+		item.key = draw_item_key(&item, view_depth(&transforms[0]));
+		cg_da_append(&render_queue.items, item);
 	}
+}
+
+#define DEBUG_LINE_COLOR ((struct cg_vec3f){1.0, 0.0, 0.0})
+
+static struct {
+	unsigned int vao;
+	struct CG_DA(struct cg_vec3f) verts;
+} debug_lines;
 
+/*
+ * Draws every line accumulated since the last flush with a single GL_LINES call, using the
+ * default shader program with a flat color.
+ */
+static void debug_lines_flush(void) {
+	if (debug_lines.verts.len == 0)
+		return;
 
-	static int box_indices[6 * 2 * 3] = {
-		0, 1, 2,
-		2, 1, 3,
+	if (debug_lines.vao == 0) {
+		debug_lines.vao = gen_vertex_array();
 
-		4, 5, 6,
-		6, 5, 7,
+		state_bind_vao(debug_lines.vao);
 
-		2, 6, 3,
-		6, 7, 3,
+		glEnableVertexAttribArray(CG_SATTRIB_LOC_VERTEX_POSITION);
+		cg_assert_gl();
+	} else {
+		state_bind_vao(debug_lines.vao);
+	}
 
-		0, 1, 4,
-		4, 5, 1,
+	// the lines land somewhere else in the stream buffer every flush
+	struct cg_stream_range range = cg_stream_upload(debug_lines.verts.items,
+							sizeof(*debug_lines.verts.items) *
+							debug_lines.verts.len,
+							sizeof(float));
 
-		1, 3, 7,
-		5, 1, 7,
+	glBindBuffer(GL_ARRAY_BUFFER, range.buffer);
+	cg_assert_gl();
 
-		0, 6, 2,
-		0, 4, 6,
+	glVertexAttribPointer(CG_SATTRIB_LOC_VERTEX_POSITION, 3, GL_FLOAT, GL_FALSE,
+			      sizeof(*debug_lines.verts.items), (void*)range.offset);
+	cg_assert_gl();
+
+	struct cg_shader_prg shader = cg_shader_prg_default();
+	struct cg_mat4f identity = cg_mat4f_identity();
+	struct cg_material material = {
+		.color_diffuse = DEBUG_LINE_COLOR,
+		.opacity = 1.0f,
 	};
 
-	return cg_mesh_create(box_verts, CG_ARRAY_LEN(box_verts) / 3,
-			      box_indices, CG_ARRAY_LEN(box_indices),
-			      NULL, 0,
-			      NULL, 0);
-}
+	state_use_program(shader.id);
 
-void cg_model_draw_bounding_box(struct cg_model *model) {
-	struct cg_box bounding_box = model->bounding_box;
+	glUniformMatrix4fv(shader.uniform_locs[CG_SUNIFORM_MATRIX_MODEL], 1, false, identity.d);
+	cg_assert_gl();
+	cg_ctx.frame_stats.uniform_uploads++;
+
+	state_use_camera(&shader);
+	state_use_material(&shader, &material, SIZE_MAX);
 
-	struct cg_material material = cg_material_default();
-	material.tex_diffuse = (struct cg_texture){0};
-	material.color_diffuse = (struct cg_vec3f){1.0, 0.0, 0.0};
+	glDrawArrays(GL_LINES, 0, debug_lines.verts.len);
+	cg_assert_gl();
+	cg_ctx.frame_stats.draw_calls++;
 
-	struct cg_mesh cube_mesh = mesh_cube();
-	struct cg_model box = cg_model_create(&cube_mesh, 1, &material, 1, (size_t[]){0});
+	debug_lines.verts.len = 0;
+}
 
-	struct cg_vec3f sizes = cg_vec3f_sub(bounding_box.max, bounding_box.min);
+void cg_model_draw_bounding_box(struct cg_model *model) {
+	// corners of the box are indexed by their (x, y, z) bits, 0 for min and 1 for max
+	static const size_t box_edges[12][2] = {
+		{0, 1}, {2, 3}, {4, 5}, {6, 7},
+		{0, 2}, {1, 3}, {4, 6}, {5, 7},
+		{0, 4}, {1, 5}, {2, 6}, {3, 7},
+	};
 
-	cg_model_set_scale(&box, sizes);
+	struct cg_box box = model->bounding_box;
+	const struct cg_mat4f *m = cg_model_get_world_matrix(model);
+
+	struct cg_vec3f corners[8];
+	for (size_t i = 0; i < CG_ARRAY_LEN(corners); i++) {
+		struct cg_vec3f corner = {
+			.x = i & 1 ? box.max.x : box.min.x,
+			.y = i & 2 ? box.max.y : box.min.y,
+			.z = i & 4 ? box.max.z : box.min.z,
+		};
+		corners[i] = cg_vec3f_transform(corner, m);
+	}
 
-	cg_model_move(&box, model->position);
-	cg_model_scale(&box, model->scale);
-	cg_model_rotate(&box, model->rotation);
+	for (size_t i = 0; i < CG_ARRAY_LEN(box_edges); i++) {
+		cg_da_append(&debug_lines.verts, corners[box_edges[i][0]]);
+		cg_da_append(&debug_lines.verts, corners[box_edges[i][1]]);
+	}
 
-	bool fill = cg_get_fill();
-	cg_set_fill(false);
-	cg_model_draw(&box);
-	cg_set_fill(fill);
+	if (!render_queue.recording)
+		debug_lines_flush();
 }
 
+// What moving 0.1 every frame gave at 60 fps
+#define CAMERA_DEFAULT_SPEED 6.0f
+
 struct cg_camera cg_camera_create(const struct cg_vec3f pos,
 				  const float fov,
 				  const float near_plane,
@@ -867,6 +4679,7 @@ struct cg_camera cg_camera_create(const struct cg_vec3f pos,
 
 	float_t depth = near_plane - far_plane;
 
+	cg_ctx.gl_state.camera_generation++;
 	cg_ctx.projection_matrix = (struct cg_mat4f) {{
 		1.0 / (tanf(fov / 2) * aspect), 0.0, 0.0, 0.0,
 		0.0, 1.0 / tanf(fov / 2), 0.0 , 0.0,
@@ -874,9 +4687,13 @@ struct cg_camera cg_camera_create(const struct cg_vec3f pos,
 		0.0, 0.0, -1.0, 0.0,
 	}};
 
+	cg_ctx.camera_pos = pos;
+
 	return (struct cg_camera) {
 		.pos = pos,
 		.rotation = cg_mat4f_identity(),
+		.view_dirty = true,
+		.speed = CAMERA_DEFAULT_SPEED,
 		.fov = fov,
 		.near_plane = near_plane,
 		.far_plane = far_plane,
@@ -885,18 +4702,19 @@ struct cg_camera cg_camera_create(const struct cg_vec3f pos,
 
 void cg_camera_update_FPS(struct cg_camera *camera) {
 	struct cg_vec3f ds = {0};
+	float step = camera->speed * cg_delta_time();
 
 	if (cg_keycode_is_down(CG_KEY_W))
-		ds.z -= 0.1;
+		ds.z -= step;
 
 	if (cg_keycode_is_down(CG_KEY_S))
-		ds.z += 0.1;
+		ds.z += step;
 
 	if (cg_keycode_is_down(CG_KEY_A))
-		ds.x -= 0.1;
+		ds.x -= step;
 
 	if (cg_keycode_is_down(CG_KEY_D))
-		ds.x += 0.1;
+		ds.x += step;
 
 	struct cg_vec2f rel_pos = cg_mouse_rel_pos();
 
@@ -906,17 +4724,63 @@ void cg_camera_update_FPS(struct cg_camera *camera) {
 	rel_pos.x *= 10.0;
 	rel_pos.y *= 10.0;
 
-	camera->rotation = cg_mat4f_multiply(cg_mat4f_rotate_y(rel_pos.x), camera->rotation);
-	camera->rotation = cg_mat4f_multiply(camera->rotation, cg_mat4f_rotate_x(rel_pos.y));
+	if (rel_pos.x != 0 || rel_pos.y != 0) {
+		camera->rotation = cg_mat4f_multiply(cg_mat4f_rotate_y(rel_pos.x),
+						     camera->rotation);
+		camera->rotation = cg_mat4f_multiply(camera->rotation,
+						     cg_mat4f_rotate_x(rel_pos.y));
+		camera->view_dirty = true;
+	}
+
+	if (ds.x != 0 || ds.y != 0 || ds.z != 0) {
+		float pitch, yaw, roll;
+		cg_mat4f_rotation_to_angles(camera->rotation, &pitch, &yaw, &roll);
+		ds = cg_vec3f_mat4f_multiply(ds, cg_mat4f_rotate_y(yaw));
+		camera->pos = cg_vec3f_add(camera->pos, ds);
+		camera->view_dirty = true;
+	}
+
+	// a still camera keeps the view matrix, and so the uploaded uniforms, untouched
+	if (!camera->view_dirty)
+		return;
 
-	float pitch, yaw, roll;
-	cg_mat4f_rotation_to_angles(camera->rotation, &pitch, &yaw, &roll);
-	ds = cg_vec3f_mat4f_multiply(ds, cg_mat4f_rotate_y(yaw));
-	camera->pos = cg_vec3f_add(camera->pos, ds);
+	camera->view_dirty = false;
 
 	struct cg_mat4f translation = cg_mat4f_translate(-camera->pos.x,
 							 -camera->pos.y,
 							 -camera->pos.z);
 
+	cg_ctx.gl_state.camera_generation++;
 	cg_ctx.view_matrix = cg_mat4f_multiply(translation, camera->rotation);
+	cg_ctx.camera_pos = camera->pos;
+}
+
+struct cg_ray cg_camera_screen_ray(const struct cg_vec2f pos) {
+	struct cg_mat4f view_projection = cg_mat4f_multiply(cg_ctx.view_matrix,
+							    cg_ctx.projection_matrix);
+	struct cg_mat4f inverse;
+	if (!cg_mat4f_inverse(&inverse, &view_projection))
+		return (struct cg_ray){0};
+
+	float x = 2.0f * pos.x / cg_ctx.window.width - 1.0f;
+	float y = 1.0f - 2.0f * pos.y / cg_ctx.window.height;
+
+	// unproject the points on the near and far clip planes under the window position
+	struct cg_vec3f points[2];
+	for (size_t i = 0; i < CG_ARRAY_LEN(points); i++) {
+		float z = i == 0 ? -1.0f : 1.0f;
+		const float *d = inverse.d;
+
+		float w = x * d[m(0, 3)] + y * d[m(1, 3)] + z * d[m(2, 3)] + d[m(3, 3)];
+		points[i] = (struct cg_vec3f) {
+			(x * d[m(0, 0)] + y * d[m(1, 0)] + z * d[m(2, 0)] + d[m(3, 0)]) / w,
+			(x * d[m(0, 1)] + y * d[m(1, 1)] + z * d[m(2, 1)] + d[m(3, 1)]) / w,
+			(x * d[m(0, 2)] + y * d[m(1, 2)] + z * d[m(2, 2)] + d[m(3, 2)]) / w,
+		};
+	}
+
+	return (struct cg_ray) {
+		.origin = points[0],
+		.dir = cg_vec3f_sub(points[1], points[0]),
+	};
 }
@@ -8,12 +8,284 @@
 
 #include <SDL.h>
 
+#include <GL/glew.h>
+
 #include "cg_core.h"
 #include "cg_input.h"
 #include "cg_math.h"
+#include "cg_util.h"
 
 extern struct cg_contex cg_ctx;
 
+// One slot is kept empty to tell a full queue from an empty one
+#define INPUT_QUEUE_SIZE 1024
+
+static const enum cg_keycode scancode_to_cg_kc[SDL_NUM_SCANCODES] = {
+	[SDL_SCANCODE_A] = CG_KEY_A,
+	[SDL_SCANCODE_B] = CG_KEY_B,
+	[SDL_SCANCODE_C] = CG_KEY_C,
+	[SDL_SCANCODE_D] = CG_KEY_D,
+	[SDL_SCANCODE_E] = CG_KEY_E,
+	[SDL_SCANCODE_F] = CG_KEY_F,
+	[SDL_SCANCODE_G] = CG_KEY_G,
+	[SDL_SCANCODE_H] = CG_KEY_H,
+	[SDL_SCANCODE_I] = CG_KEY_I,
+	[SDL_SCANCODE_J] = CG_KEY_J,
+	[SDL_SCANCODE_K] = CG_KEY_K,
+	[SDL_SCANCODE_L] = CG_KEY_L,
+	[SDL_SCANCODE_M] = CG_KEY_M,
+	[SDL_SCANCODE_N] = CG_KEY_N,
+	[SDL_SCANCODE_O] = CG_KEY_O,
+	[SDL_SCANCODE_P] = CG_KEY_P,
+	[SDL_SCANCODE_Q] = CG_KEY_Q,
+	[SDL_SCANCODE_R] = CG_KEY_R,
+	[SDL_SCANCODE_S] = CG_KEY_S,
+	[SDL_SCANCODE_T] = CG_KEY_T,
+	[SDL_SCANCODE_U] = CG_KEY_U,
+	[SDL_SCANCODE_V] = CG_KEY_V,
+	[SDL_SCANCODE_W] = CG_KEY_W,
+	[SDL_SCANCODE_X] = CG_KEY_X,
+	[SDL_SCANCODE_Y] = CG_KEY_Y,
+	[SDL_SCANCODE_Z] = CG_KEY_Z,
+	[SDL_SCANCODE_UP] = CG_KEY_UP,
+	[SDL_SCANCODE_DOWN] = CG_KEY_DOWN,
+	[SDL_SCANCODE_LEFT] = CG_KEY_LEFT,
+	[SDL_SCANCODE_RIGHT] = CG_KEY_RIGHT,
+	[SDL_SCANCODE_0] = CG_KEY_0,
+	[SDL_SCANCODE_1] = CG_KEY_1,
+	[SDL_SCANCODE_2] = CG_KEY_2,
+	[SDL_SCANCODE_3] = CG_KEY_3,
+	[SDL_SCANCODE_4] = CG_KEY_4,
+	[SDL_SCANCODE_5] = CG_KEY_5,
+	[SDL_SCANCODE_6] = CG_KEY_6,
+	[SDL_SCANCODE_7] = CG_KEY_7,
+	[SDL_SCANCODE_8] = CG_KEY_8,
+	[SDL_SCANCODE_9] = CG_KEY_9,
+	[SDL_SCANCODE_F1] = CG_KEY_F1,
+	[SDL_SCANCODE_F2] = CG_KEY_F2,
+	[SDL_SCANCODE_F3] = CG_KEY_F3,
+	[SDL_SCANCODE_F4] = CG_KEY_F4,
+	[SDL_SCANCODE_F5] = CG_KEY_F5,
+	[SDL_SCANCODE_F6] = CG_KEY_F6,
+	[SDL_SCANCODE_F7] = CG_KEY_F7,
+	[SDL_SCANCODE_F8] = CG_KEY_F8,
+	[SDL_SCANCODE_F9] = CG_KEY_F9,
+	[SDL_SCANCODE_F10] = CG_KEY_F10,
+	[SDL_SCANCODE_F11] = CG_KEY_F11,
+	[SDL_SCANCODE_F12] = CG_KEY_F12,
+	[SDL_SCANCODE_ESCAPE] = CG_KEY_ESCAPE,
+	[SDL_SCANCODE_RETURN] = CG_KEY_ENTER,
+	[SDL_SCANCODE_TAB] = CG_KEY_TAB,
+	[SDL_SCANCODE_BACKSPACE] = CG_KEY_BACKSPACE,
+	[SDL_SCANCODE_SPACE] = CG_KEY_SPACE,
+	[SDL_SCANCODE_MINUS] = CG_KEY_MINUS,
+	[SDL_SCANCODE_EQUALS] = CG_KEY_EQUALS,
+	[SDL_SCANCODE_LEFTBRACKET] = CG_KEY_LEFT_BRACKET,
+	[SDL_SCANCODE_RIGHTBRACKET] = CG_KEY_RIGHT_BRACKET,
+	[SDL_SCANCODE_BACKSLASH] = CG_KEY_BACKSLASH,
+	[SDL_SCANCODE_SEMICOLON] = CG_KEY_SEMICOLON,
+	[SDL_SCANCODE_APOSTROPHE] = CG_KEY_APOSTROPHE,
+	[SDL_SCANCODE_GRAVE] = CG_KEY_GRAVE,
+	[SDL_SCANCODE_COMMA] = CG_KEY_COMMA,
+	[SDL_SCANCODE_PERIOD] = CG_KEY_PERIOD,
+	[SDL_SCANCODE_SLASH] = CG_KEY_SLASH,
+	[SDL_SCANCODE_CAPSLOCK] = CG_KEY_CAPS_LOCK,
+	[SDL_SCANCODE_PRINTSCREEN] = CG_KEY_PRINT_SCREEN,
+	[SDL_SCANCODE_SCROLLLOCK] = CG_KEY_SCROLL_LOCK,
+	[SDL_SCANCODE_PAUSE] = CG_KEY_PAUSE,
+	[SDL_SCANCODE_INSERT] = CG_KEY_INSERT,
+	[SDL_SCANCODE_HOME] = CG_KEY_HOME,
+	[SDL_SCANCODE_PAGEUP] = CG_KEY_PAGE_UP,
+	[SDL_SCANCODE_DELETE] = CG_KEY_DELETE,
+	[SDL_SCANCODE_END] = CG_KEY_END,
+	[SDL_SCANCODE_PAGEDOWN] = CG_KEY_PAGE_DOWN,
+	[SDL_SCANCODE_NUMLOCKCLEAR] = CG_KEY_NUM_LOCK,
+	[SDL_SCANCODE_KP_DIVIDE] = CG_KEY_KP_DIVIDE,
+	[SDL_SCANCODE_KP_MULTIPLY] = CG_KEY_KP_MULTIPLY,
+	[SDL_SCANCODE_KP_MINUS] = CG_KEY_KP_MINUS,
+	[SDL_SCANCODE_KP_PLUS] = CG_KEY_KP_PLUS,
+	[SDL_SCANCODE_KP_ENTER] = CG_KEY_KP_ENTER,
+	[SDL_SCANCODE_KP_PERIOD] = CG_KEY_KP_PERIOD,
+	[SDL_SCANCODE_KP_0] = CG_KEY_KP_0,
+	[SDL_SCANCODE_KP_1] = CG_KEY_KP_1,
+	[SDL_SCANCODE_KP_2] = CG_KEY_KP_2,
+	[SDL_SCANCODE_KP_3] = CG_KEY_KP_3,
+	[SDL_SCANCODE_KP_4] = CG_KEY_KP_4,
+	[SDL_SCANCODE_KP_5] = CG_KEY_KP_5,
+	[SDL_SCANCODE_KP_6] = CG_KEY_KP_6,
+	[SDL_SCANCODE_KP_7] = CG_KEY_KP_7,
+	[SDL_SCANCODE_KP_8] = CG_KEY_KP_8,
+	[SDL_SCANCODE_KP_9] = CG_KEY_KP_9,
+	[SDL_SCANCODE_LCTRL] = CG_KEY_LEFT_CTRL,
+	[SDL_SCANCODE_LSHIFT] = CG_KEY_LEFT_SHIFT,
+	[SDL_SCANCODE_LALT] = CG_KEY_LEFT_ALT,
+	[SDL_SCANCODE_LGUI] = CG_KEY_LEFT_SUPER,
+	[SDL_SCANCODE_RCTRL] = CG_KEY_RIGHT_CTRL,
+	[SDL_SCANCODE_RSHIFT] = CG_KEY_RIGHT_SHIFT,
+	[SDL_SCANCODE_RALT] = CG_KEY_RIGHT_ALT,
+	[SDL_SCANCODE_RGUI] = CG_KEY_RIGHT_SUPER,
+	[SDL_SCANCODE_APPLICATION] = CG_KEY_MENU,
+};
+
+/*
+ * Single producer single consumer ring, events[tail..head) are queued. Only the producer
+ * moves head and only the consumer moves tail, SDL's atomics order the event writes before
+ * the index that publishes them.
+ */
+static struct {
+	struct cg_input_event events[INPUT_QUEUE_SIZE];
+	SDL_atomic_t head;
+	SDL_atomic_t tail;
+} queue;
+
+static struct {
+	bool threaded;
+
+	// events of the frame
+	struct CG_DA(struct cg_input_event) events;
+} input;
+
+static bool queue_push(const struct cg_input_event *event) {
+	int head = SDL_AtomicGet(&queue.head);
+	int next = (head + 1) % INPUT_QUEUE_SIZE;
+
+	if (next == SDL_AtomicGet(&queue.tail))
+		return false;
+
+	queue.events[head] = *event;
+	SDL_AtomicSet(&queue.head, next);
+
+	return true;
+}
+
+static bool queue_pop(struct cg_input_event *event) {
+	int tail = SDL_AtomicGet(&queue.tail);
+
+	if (tail == SDL_AtomicGet(&queue.head))
+		return false;
+
+	*event = queue.events[tail];
+	SDL_AtomicSet(&queue.tail, (tail + 1) % INPUT_QUEUE_SIZE);
+
+	return true;
+}
+
+static void input_apply(const struct cg_input_event *event) {
+	switch (event->type) {
+		case CG_INPUT_QUIT:
+			cg_ctx.window_should_close = true;
+			break;
+
+		case CG_INPUT_RESIZE:
+			glViewport(0, 0, event->resize.width, event->resize.height);
+			cg_ctx.window.width = event->resize.width;
+			cg_ctx.window.height = event->resize.height;
+			break;
+
+		case CG_INPUT_KEY_DOWN:
+			cg_ctx.keys[event->key.code] = true;
+			break;
+
+		case CG_INPUT_KEY_UP:
+			cg_ctx.keys[event->key.code] = false;
+			break;
+
+		case CG_INPUT_MOUSE_MOTION:
+			cg_ctx.mouse_pos = event->motion.pos;
+			cg_ctx.mouse_rel_pos.x += event->motion.rel.x;
+			cg_ctx.mouse_rel_pos.y += event->motion.rel.y;
+			break;
+	}
+
+	cg_da_append(&input.events, *event);
+}
+
+static void input_drain(void) {
+	struct cg_input_event event;
+
+	while (queue_pop(&event))
+		input_apply(&event);
+}
+
+// Returns false for the events cg does not track
+static bool sdl2_to_cg_event(const SDL_Event *e, struct cg_input_event *event) {
+	*event = (struct cg_input_event){.timestamp = e->common.timestamp};
+
+	switch (e->type) {
+		case SDL_QUIT:
+			event->type = CG_INPUT_QUIT;
+			return true;
+
+		// also sent along with SDL_WINDOWEVENT_RESIZED, on any size change
+		case SDL_WINDOWEVENT:
+			if (e->window.event != SDL_WINDOWEVENT_SIZE_CHANGED)
+				return false;
+
+			event->type = CG_INPUT_RESIZE;
+			event->resize.width = e->window.data1;
+			event->resize.height = e->window.data2;
+			return true;
+
+		case SDL_KEYDOWN:
+		case SDL_KEYUP:;
+			SDL_Scancode scancode = e->key.keysym.scancode;
+			if (scancode >= SDL_NUM_SCANCODES || scancode_to_cg_kc[scancode] == CG_KEY_UNKNOWN)
+				return false;
+
+			event->type = e->type == SDL_KEYDOWN ? CG_INPUT_KEY_DOWN : CG_INPUT_KEY_UP;
+			event->key.code = scancode_to_cg_kc[scancode];
+			event->key.repeat = e->key.repeat;
+			return true;
+
+		case SDL_MOUSEMOTION:
+			event->type = CG_INPUT_MOUSE_MOTION;
+			event->motion.pos = (struct cg_vec2f){e->motion.x, e->motion.y};
+			event->motion.rel = (struct cg_vec2f){e->motion.xrel, e->motion.yrel};
+			return true;
+	}
+
+	return false;
+}
+
+void cg_input_pump(void) {
+	SDL_Event e;
+
+	while (SDL_PollEvent(&e)) {
+		struct cg_input_event event;
+		if (!sdl2_to_cg_event(&e, &event))
+			continue;
+
+		while (!queue_push(&event)) {
+			// pumping on the consuming thread, nobody else would make room
+			if (!input.threaded)
+				input_drain();
+			else
+				SDL_Delay(1);
+		}
+	}
+}
+
+// Call it before the pumping thread starts, or after it stops
+void cg_set_threaded_input(bool threaded) {
+	input.threaded = threaded;
+}
+
+void cg_input_update(void) {
+	input.events.len = 0;
+	cg_ctx.mouse_rel_pos = (struct cg_vec2f){0};
+
+	// there are no events without a window
+	if (!input.threaded && !cg_ctx.window.headless)
+		cg_input_pump();
+
+	input_drain();
+}
+
+const struct cg_input_event *cg_input_events(size_t *count) {
+	*count = input.events.len;
+	return input.events.items;
+}
+
 bool cg_keycode_is_down(enum cg_keycode code) {
 	return cg_ctx.keys[code];
 }
@@ -23,7 +295,5 @@ struct cg_vec2f cg_mouse_pos() {
 }
 
 struct cg_vec2f cg_mouse_rel_pos() {
-	struct cg_vec2f res = cg_ctx.mouse_rel_pos;
-	cg_ctx.mouse_rel_pos = (struct cg_vec2f){0};
-	return res;
+	return cg_ctx.mouse_rel_pos;
 }
@@ -0,0 +1,207 @@
+/*
+ * Copyright Arthur Grillo (c) 2024
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#include <stdbool.h>
+#include <string.h>
+
+#include <SDL2/SDL.h>
+
+#include "cg_jobs.h"
+#include "cg_util.h"
+
+struct job {
+	cg_job_func_t func;
+	void *arg;
+};
+
+/*
+ * FIFO of the jobs waiting for a worker, the pending ones are items[head..len). Both go back
+ * to 0 whenever it empties, so the array only grows to the largest backlog.
+ */
+static struct {
+	SDL_mutex *lock;
+	SDL_cond *wake;
+	SDL_cond *idle;
+
+	struct CG_DA(struct job) queue;
+	size_t head;
+	// jobs taken by a worker and not finished yet
+	size_t running;
+	bool quit;
+
+	size_t num_threads;
+	SDL_Thread **threads;
+} jobs;
+
+static int worker_main(void *data) {
+	(void) data;
+
+	SDL_LockMutex(jobs.lock);
+
+	while (true) {
+		while (jobs.head == jobs.queue.len && !jobs.quit)
+			SDL_CondWait(jobs.wake, jobs.lock);
+
+		if (jobs.head == jobs.queue.len)
+			break;
+
+		struct job job = jobs.queue.items[jobs.head++];
+		if (jobs.head == jobs.queue.len)
+			jobs.head = jobs.queue.len = 0;
+		jobs.running++;
+
+		SDL_UnlockMutex(jobs.lock);
+		job.func(job.arg);
+		SDL_LockMutex(jobs.lock);
+
+		jobs.running--;
+		if (jobs.running == 0 && jobs.head == jobs.queue.len)
+			SDL_CondBroadcast(jobs.idle);
+	}
+
+	SDL_UnlockMutex(jobs.lock);
+
+	return 0;
+}
+
+static void jobs_start(void) {
+	if (jobs.threads != NULL)
+		return;
+
+	jobs.lock = SDL_CreateMutex();
+	jobs.wake = SDL_CreateCond();
+	jobs.idle = SDL_CreateCond();
+	cg_assert(jobs.lock != NULL && jobs.wake != NULL && jobs.idle != NULL);
+
+	jobs.quit = false;
+	jobs.num_threads = CG_MAX(SDL_GetCPUCount() - 1, 1);
+	jobs.threads = malloc(sizeof(*jobs.threads) * jobs.num_threads);
+	cg_assert(jobs.threads != NULL);
+
+	for (size_t i = 0; i < jobs.num_threads; i++) {
+		jobs.threads[i] = SDL_CreateThread(worker_main, "cg worker", NULL);
+		cg_assert(jobs.threads[i] != NULL);
+	}
+
+	cg_info("Started %zu job threads\n", jobs.num_threads);
+}
+
+void cg_jobs_submit(cg_job_func_t func, void *arg) {
+	jobs_start();
+
+	SDL_LockMutex(jobs.lock);
+	cg_da_append(&jobs.queue, ((struct job){func, arg}));
+	SDL_CondSignal(jobs.wake);
+	SDL_UnlockMutex(jobs.lock);
+}
+
+size_t cg_jobs_num_threads(void) {
+	jobs_start();
+
+	return jobs.num_threads;
+}
+
+struct parallel_for {
+	size_t count;
+	cg_job_range_func_t func;
+	void *arg;
+
+	SDL_atomic_t next;
+
+	// helpers that are still running, guarded by the job lock
+	size_t helpers;
+};
+
+static void parallel_for_run(struct parallel_for *pf) {
+	while (true) {
+		size_t i = SDL_AtomicAdd(&pf->next, 1);
+		if (i >= pf->count)
+			break;
+
+		pf->func(i, pf->arg);
+	}
+}
+
+static void parallel_for_helper(void *arg) {
+	struct parallel_for *pf = arg;
+
+	parallel_for_run(pf);
+
+	SDL_LockMutex(jobs.lock);
+	pf->helpers--;
+	SDL_CondBroadcast(jobs.idle);
+	SDL_UnlockMutex(jobs.lock);
+}
+
+/*
+ * The caller works through the range as well, so it finishes even when every worker is busy,
+ * and once it runs out of items it takes back the helpers no worker picked up yet. It then
+ * only waits for the helpers still running their last item.
+ */
+void cg_jobs_parallel_for(size_t count, cg_job_range_func_t func, void *arg) {
+	if (count == 0)
+		return;
+
+	struct parallel_for pf = {
+		.count = count,
+		.func = func,
+		.arg = arg,
+	};
+
+	size_t helpers = CG_MIN(cg_jobs_num_threads(), count - 1);
+
+	SDL_LockMutex(jobs.lock);
+	pf.helpers = helpers;
+	for (size_t i = 0; i < helpers; i++)
+		cg_da_append(&jobs.queue, ((struct job){parallel_for_helper, &pf}));
+	SDL_CondBroadcast(jobs.wake);
+	SDL_UnlockMutex(jobs.lock);
+
+	parallel_for_run(&pf);
+
+	SDL_LockMutex(jobs.lock);
+
+	size_t len = jobs.head;
+	for (size_t i = jobs.head; i < jobs.queue.len; i++) {
+		struct job *job = &jobs.queue.items[i];
+
+		if (job->func == parallel_for_helper && job->arg == &pf)
+			pf.helpers--;
+		else
+			jobs.queue.items[len++] = *job;
+	}
+	jobs.queue.len = len;
+	if (jobs.head == jobs.queue.len)
+		jobs.head = jobs.queue.len = 0;
+
+	while (pf.helpers > 0)
+		SDL_CondWait(jobs.idle, jobs.lock);
+
+	SDL_UnlockMutex(jobs.lock);
+}
+
+void cg_jobs_shutdown(void) {
+	if (jobs.threads == NULL)
+		return;
+
+	SDL_LockMutex(jobs.lock);
+	jobs.quit = true;
+	SDL_CondBroadcast(jobs.wake);
+	SDL_UnlockMutex(jobs.lock);
+
+	for (size_t i = 0; i < jobs.num_threads; i++)
+		SDL_WaitThread(jobs.threads[i], NULL);
+
+	free(jobs.threads);
+	free(jobs.queue.items);
+	SDL_DestroyCond(jobs.idle);
+	SDL_DestroyCond(jobs.wake);
+	SDL_DestroyMutex(jobs.lock);
+
+	memset(&jobs, 0, sizeof(jobs));
+}
@@ -13,6 +13,24 @@
 #include "cg_math.h"
 #include "cg_util.h"
 
+/*
+ * The SIMD kernels are picked at compile time from the target flags, so building with
+ * -march=native (or -mavx) selects the widest one available. Define CG_MATH_NO_SIMD to force
+ * the scalar code.
+ */
+#if !defined(CG_MATH_NO_SIMD) && defined(__AVX__)
+#define CG_MATH_AVX
+#include <immintrin.h>
+#elif !defined(CG_MATH_NO_SIMD) && (defined(__SSE__) || defined(_M_X64))
+#define CG_MATH_SSE
+#include <xmmintrin.h>
+#elif !defined(CG_MATH_NO_SIMD) && defined(__ARM_NEON)
+#define CG_MATH_NEON
+#include <arm_neon.h>
+#endif
+
+extern inline struct cg_vec3f cg_vec3f_from_array(const float *array);
+
 struct cg_vec3f cg_vec3f_add(const struct cg_vec3f a, const struct cg_vec3f b) {
 	return (struct cg_vec3f) {
 		.x = a.x + b.x,
@@ -45,6 +63,10 @@ struct cg_vec3f cg_vec3f_cross(const struct cg_vec3f a, const struct cg_vec3f b)
 	};
 }
 
+float cg_vec3f_dot(const struct cg_vec3f a, const struct cg_vec3f b) {
+	return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
 struct cg_vec3f cg_vec3f_normal(const struct cg_vec3f a) {
 	float magnitude = sqrtf(a.x * a.x + a.y * a.y + a.z * a.z);
 
@@ -142,38 +164,194 @@ struct cg_mat4f cg_mat4f_rotate_z(float angle) {
 	return ret;
 }
 
+/*
+ * Computes T * S * Rz * Ry * Rx directly, which is what multiplying out the individual
+ * matrices gives, without the four full matrix products.
+ */
 struct cg_mat4f cg_mat4f_model(const struct cg_vec3f translation,
 			       const struct cg_vec3f scale,
 			       const struct cg_vec3f rotation) {
+	float sx = sinf(rotation.x), cx = cosf(rotation.x);
+	float sy = sinf(rotation.y), cy = cosf(rotation.y);
+	float sz = sinf(rotation.z), cz = cosf(rotation.z);
+
+	struct cg_mat4f ret = {
+		.d[m(0, 0)] = scale.x * cz * cy,
+		.d[m(1, 0)] = scale.x * (cz * sy * sx - sz * cx),
+		.d[m(2, 0)] = scale.x * (cz * sy * cx + sz * sx),
+		.d[m(3, 0)] = translation.x,
+
+		.d[m(0, 1)] = scale.y * sz * cy,
+		.d[m(1, 1)] = scale.y * (sz * sy * sx + cz * cx),
+		.d[m(2, 1)] = scale.y * (sz * sy * cx - cz * sx),
+		.d[m(3, 1)] = translation.y,
+
+		.d[m(0, 2)] = scale.z * -sy,
+		.d[m(1, 2)] = scale.z * cy * sx,
+		.d[m(2, 2)] = scale.z * cy * cx,
+		.d[m(3, 2)] = translation.z,
+
+		.d[m(3, 3)] = 1.0f,
+	};
 
-	struct cg_mat4f ret = cg_mat4f_identity();
-	ret = cg_mat4f_multiply(ret, cg_mat4f_rotate_x(rotation.x));
-	ret = cg_mat4f_multiply(ret, cg_mat4f_rotate_y(rotation.y));
-	ret = cg_mat4f_multiply(ret, cg_mat4f_rotate_z(rotation.z));
-	ret = cg_mat4f_multiply(ret, cg_mat4f_scale(scale.x,
-						    scale.y,
-						    scale.z));
-	ret = cg_mat4f_multiply(ret, cg_mat4f_translate(translation.x,
-							translation.y,
-							translation.z));
 	return ret;
 }
 
-struct cg_mat4f cg_mat4f_multiply(const struct cg_mat4f a, const struct cg_mat4f b) {
-	struct cg_mat4f ret = { 0 };
+/*
+ * Row r of the result is the sum of the rows of a weighted by the elements of row r of b,
+ * which maps directly onto a broadcast and a multiply-add per row.
+ */
+static inline void mat4f_multiply(struct cg_mat4f *ret,
+				  const struct cg_mat4f *a, const struct cg_mat4f *b) {
+#if defined(CG_MATH_AVX)
+	__m256 a0 = _mm256_broadcast_ps((const __m128 *)&a->d[0]);
+	__m256 a1 = _mm256_broadcast_ps((const __m128 *)&a->d[4]);
+	__m256 a2 = _mm256_broadcast_ps((const __m128 *)&a->d[8]);
+	__m256 a3 = _mm256_broadcast_ps((const __m128 *)&a->d[12]);
+
+	// two rows of the result at a time, matrices are only 16 byte aligned so unaligned accesses
+	for (size_t row = 0; row < 4; row += 2) {
+		__m256 b01 = _mm256_loadu_ps(&b->d[row * 4]);
+
+		__m256 r = _mm256_mul_ps(_mm256_permute_ps(b01, 0x00), a0);
+		r = _mm256_add_ps(r, _mm256_mul_ps(_mm256_permute_ps(b01, 0x55), a1));
+		r = _mm256_add_ps(r, _mm256_mul_ps(_mm256_permute_ps(b01, 0xaa), a2));
+		r = _mm256_add_ps(r, _mm256_mul_ps(_mm256_permute_ps(b01, 0xff), a3));
+
+		_mm256_storeu_ps(&ret->d[row * 4], r);
+	}
+#elif defined(CG_MATH_SSE)
+	__m128 a0 = _mm_load_ps(&a->d[0]);
+	__m128 a1 = _mm_load_ps(&a->d[4]);
+	__m128 a2 = _mm_load_ps(&a->d[8]);
+	__m128 a3 = _mm_load_ps(&a->d[12]);
+
+	for (size_t row = 0; row < 4; row++) {
+		const float *b_row = &b->d[row * 4];
+
+		__m128 r = _mm_mul_ps(_mm_set1_ps(b_row[0]), a0);
+		r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(b_row[1]), a1));
+		r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(b_row[2]), a2));
+		r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(b_row[3]), a3));
+
+		_mm_store_ps(&ret->d[row * 4], r);
+	}
+#elif defined(CG_MATH_NEON)
+	float32x4_t a0 = vld1q_f32(&a->d[0]);
+	float32x4_t a1 = vld1q_f32(&a->d[4]);
+	float32x4_t a2 = vld1q_f32(&a->d[8]);
+	float32x4_t a3 = vld1q_f32(&a->d[12]);
+
+	for (size_t row = 0; row < 4; row++) {
+		const float *b_row = &b->d[row * 4];
+
+		float32x4_t r = vmulq_n_f32(a0, b_row[0]);
+		r = vmlaq_n_f32(r, a1, b_row[1]);
+		r = vmlaq_n_f32(r, a2, b_row[2]);
+		r = vmlaq_n_f32(r, a3, b_row[3]);
+
+		vst1q_f32(&ret->d[row * 4], r);
+	}
+#else
+	struct cg_mat4f tmp = { 0 };
 
 	for (size_t row = 0; row < 4; row++) {
 		for (size_t col = 0; col < 4; col++) {
 			for (size_t i  = 0; i < 4; i++) {
-				ret.d[m(col, row)] += a.d[m(col, i)] * b.d[m(i, row)];
+				tmp.d[m(col, row)] += a->d[m(col, i)] * b->d[m(i, row)];
 			}
 		}
 	}
 
+	*ret = tmp;
+#endif
+}
+
+struct cg_mat4f cg_mat4f_multiply(const struct cg_mat4f a, const struct cg_mat4f b) {
+	struct cg_mat4f ret;
+
+	mat4f_multiply(&ret, &a, &b);
+
 	return ret;
 }
 
+// Cofactor expansion over 2x2 sub determinants of the top and bottom halves
+bool cg_mat4f_inverse(struct cg_mat4f *ret, const struct cg_mat4f *mat) {
+	const float *a = mat->d;
+
+	float s0 = a[0] * a[5] - a[4] * a[1];
+	float s1 = a[0] * a[6] - a[4] * a[2];
+	float s2 = a[0] * a[7] - a[4] * a[3];
+	float s3 = a[1] * a[6] - a[5] * a[2];
+	float s4 = a[1] * a[7] - a[5] * a[3];
+	float s5 = a[2] * a[7] - a[6] * a[3];
+
+	float c5 = a[10] * a[15] - a[14] * a[11];
+	float c4 = a[9] * a[15] - a[13] * a[11];
+	float c3 = a[9] * a[14] - a[13] * a[10];
+	float c2 = a[8] * a[15] - a[12] * a[11];
+	float c1 = a[8] * a[14] - a[12] * a[10];
+	float c0 = a[8] * a[13] - a[12] * a[9];
+
+	float det = s0 * c5 - s1 * c4 + s2 * c3 + s3 * c2 - s4 * c1 + s5 * c0;
+	if (det == 0.0f)
+		return false;
+
+	float inv = 1.0f / det;
+	float *d = ret->d;
+
+	d[0] = (a[5] * c5 - a[6] * c4 + a[7] * c3) * inv;
+	d[1] = (-a[1] * c5 + a[2] * c4 - a[3] * c3) * inv;
+	d[2] = (a[13] * s5 - a[14] * s4 + a[15] * s3) * inv;
+	d[3] = (-a[9] * s5 + a[10] * s4 - a[11] * s3) * inv;
+
+	d[4] = (-a[4] * c5 + a[6] * c2 - a[7] * c1) * inv;
+	d[5] = (a[0] * c5 - a[2] * c2 + a[3] * c1) * inv;
+	d[6] = (-a[12] * s5 + a[14] * s2 - a[15] * s1) * inv;
+	d[7] = (a[8] * s5 - a[10] * s2 + a[11] * s1) * inv;
+
+	d[8] = (a[4] * c4 - a[5] * c2 + a[7] * c0) * inv;
+	d[9] = (-a[0] * c4 + a[1] * c2 - a[3] * c0) * inv;
+	d[10] = (a[12] * s4 - a[13] * s2 + a[15] * s0) * inv;
+	d[11] = (-a[8] * s4 + a[9] * s2 - a[11] * s0) * inv;
+
+	d[12] = (-a[4] * c3 + a[5] * c1 - a[6] * c0) * inv;
+	d[13] = (a[0] * c3 - a[1] * c1 + a[2] * c0) * inv;
+	d[14] = (-a[12] * s3 + a[13] * s1 - a[14] * s0) * inv;
+	d[15] = (a[8] * s3 - a[9] * s1 + a[10] * s0) * inv;
+
+	return true;
+}
+
+void cg_mat4f_multiply_n(struct cg_mat4f *ret, const struct cg_mat4f *a,
+			 const struct cg_mat4f *b, size_t n) {
+	// the kernels read all of a before writing, so ret can alias a
+	for (size_t i = 0; i < n; i++)
+		mat4f_multiply(&ret[i], &a[i], b);
+}
+
 struct cg_vec3f cg_vec3f_mat4f_multiply(const struct cg_vec3f vec, const struct cg_mat4f mat) {
+#if defined(CG_MATH_SSE) || defined(CG_MATH_AVX)
+	__m128 r = _mm_load_ps(&mat.d[12]);
+	r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(vec.x), _mm_load_ps(&mat.d[0])));
+	r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(vec.y), _mm_load_ps(&mat.d[4])));
+	r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(vec.z), _mm_load_ps(&mat.d[8])));
+
+	_Alignas(16) float res[4];
+	_mm_store_ps(res, r);
+
+	return cg_vec3f_from_array(res);
+#elif defined(CG_MATH_NEON)
+	float32x4_t r = vld1q_f32(&mat.d[12]);
+	r = vmlaq_n_f32(r, vld1q_f32(&mat.d[0]), vec.x);
+	r = vmlaq_n_f32(r, vld1q_f32(&mat.d[4]), vec.y);
+	r = vmlaq_n_f32(r, vld1q_f32(&mat.d[8]), vec.z);
+
+	float res[4];
+	vst1q_f32(res, r);
+
+	return cg_vec3f_from_array(res);
+#else
 	struct cg_vec3f res;
 
 	res.x = vec.x * mat.d[m(0, 0)] + vec.y * mat.d[m(0, 1)] + vec.z * mat.d[m(0, 2)];
@@ -185,6 +363,171 @@ struct cg_vec3f cg_vec3f_mat4f_multiply(const struct cg_vec3f vec, const struct
 	res.z += mat.d[m(2, 3)];
 
 	return res;
+#endif
+}
+
+struct cg_vec3f cg_vec3f_transform(const struct cg_vec3f point, const struct cg_mat4f *mat) {
+	const float *d = mat->d;
+
+	return (struct cg_vec3f) {
+		.x = point.x * d[m(0, 0)] + point.y * d[m(1, 0)] + point.z * d[m(2, 0)] + d[m(3, 0)],
+		.y = point.x * d[m(0, 1)] + point.y * d[m(1, 1)] + point.z * d[m(2, 1)] + d[m(3, 1)],
+		.z = point.x * d[m(0, 2)] + point.y * d[m(1, 2)] + point.z * d[m(2, 2)] + d[m(3, 2)],
+	};
+}
+
+/*
+ * The matrix is transposed once up front so every point becomes a broadcast and a
+ * multiply-add per coordinate, as in cg_vec3f_mat4f_multiply.
+ */
+void cg_vec3f_transform_n(struct cg_vec3f *ret, const struct cg_vec3f *points,
+			  const struct cg_mat4f *mat, size_t n) {
+#if defined(CG_MATH_SSE) || defined(CG_MATH_AVX)
+	__m128 c0 = _mm_load_ps(&mat->d[0]);
+	__m128 c1 = _mm_load_ps(&mat->d[4]);
+	__m128 c2 = _mm_load_ps(&mat->d[8]);
+	__m128 c3 = _mm_load_ps(&mat->d[12]);
+	_MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+
+	_Alignas(16) float res[4];
+	for (size_t i = 0; i < n; i++) {
+		__m128 r = c3;
+		r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(points[i].x), c0));
+		r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(points[i].y), c1));
+		r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(points[i].z), c2));
+
+		_mm_store_ps(res, r);
+		ret[i] = cg_vec3f_from_array(res);
+	}
+#elif defined(CG_MATH_NEON)
+	float32x4x4_t c = vld4q_f32(mat->d);
+
+	float res[4];
+	for (size_t i = 0; i < n; i++) {
+		float32x4_t r = c.val[3];
+		r = vmlaq_n_f32(r, c.val[0], points[i].x);
+		r = vmlaq_n_f32(r, c.val[1], points[i].y);
+		r = vmlaq_n_f32(r, c.val[2], points[i].z);
+
+		vst1q_f32(res, r);
+		ret[i] = cg_vec3f_from_array(res);
+	}
+#else
+	for (size_t i = 0; i < n; i++)
+		ret[i] = cg_vec3f_transform(points[i], mat);
+#endif
+}
+
+struct cg_ray cg_ray_transform(const struct cg_ray ray, const struct cg_mat4f *mat) {
+	const float *d = mat->d;
+	struct cg_vec3f dir = ray.dir;
+
+	return (struct cg_ray) {
+		.origin = cg_vec3f_transform(ray.origin, mat),
+		.dir = {
+			dir.x * d[m(0, 0)] + dir.y * d[m(1, 0)] + dir.z * d[m(2, 0)],
+			dir.x * d[m(0, 1)] + dir.y * d[m(1, 1)] + dir.z * d[m(2, 1)],
+			dir.x * d[m(0, 2)] + dir.y * d[m(1, 2)] + dir.z * d[m(2, 2)],
+		},
+	};
+}
+
+struct cg_box cg_box_union(const struct cg_box a, const struct cg_box b) {
+	return (struct cg_box) {
+		.min = {CG_MIN(a.min.x, b.min.x), CG_MIN(a.min.y, b.min.y), CG_MIN(a.min.z, b.min.z)},
+		.max = {CG_MAX(a.max.x, b.max.x), CG_MAX(a.max.y, b.max.y), CG_MAX(a.max.z, b.max.z)},
+	};
+}
+
+float cg_box_surface_area(const struct cg_box box) {
+	struct cg_vec3f e = cg_vec3f_sub(box.max, box.min);
+
+	return 2.0f * (e.x * e.y + e.y * e.z + e.z * e.x);
+}
+
+/*
+ * Transforms the center and projects the extents onto the new axes, which gives the
+ * tightest axis aligned box around all eight transformed corners.
+ */
+struct cg_box cg_box_transform(const struct cg_box box, const struct cg_mat4f *mat) {
+	const float *d = mat->d;
+
+	struct cg_vec3f center = {
+		(box.min.x + box.max.x) * 0.5f,
+		(box.min.y + box.max.y) * 0.5f,
+		(box.min.z + box.max.z) * 0.5f,
+	};
+	struct cg_vec3f extent = cg_vec3f_sub(box.max, center);
+
+	center = cg_vec3f_transform(center, mat);
+	extent = (struct cg_vec3f) {
+		.x = fabsf(d[m(0, 0)]) * extent.x + fabsf(d[m(1, 0)]) * extent.y +
+		     fabsf(d[m(2, 0)]) * extent.z,
+		.y = fabsf(d[m(0, 1)]) * extent.x + fabsf(d[m(1, 1)]) * extent.y +
+		     fabsf(d[m(2, 1)]) * extent.z,
+		.z = fabsf(d[m(0, 2)]) * extent.x + fabsf(d[m(1, 2)]) * extent.y +
+		     fabsf(d[m(2, 2)]) * extent.z,
+	};
+
+	return (struct cg_box) {
+		.min = cg_vec3f_sub(center, extent),
+		.max = cg_vec3f_add(center, extent),
+	};
+}
+
+/*
+ * Gribb and Hartmann: a point is inside the clip volume when -w <= x, y, z <= w, so each
+ * plane is the last row of the matrix plus or minus one of the others.
+ */
+struct cg_frustum cg_frustum_from_matrix(const struct cg_mat4f *view_projection) {
+	const float *d = view_projection->d;
+	struct cg_frustum ret;
+
+	for (size_t i = 0; i < 6; i++) {
+		size_t row = i / 2;
+		float sign = i % 2 == 0 ? 1.0f : -1.0f;
+
+		struct cg_plane plane = {
+			.normal = {
+				d[m(0, 3)] + sign * d[m(0, row)],
+				d[m(1, 3)] + sign * d[m(1, row)],
+				d[m(2, 3)] + sign * d[m(2, row)],
+			},
+			.d = d[m(3, 3)] + sign * d[m(3, row)],
+		};
+
+		float length = sqrtf(plane.normal.x * plane.normal.x +
+				     plane.normal.y * plane.normal.y +
+				     plane.normal.z * plane.normal.z);
+
+		plane.normal.x /= length;
+		plane.normal.y /= length;
+		plane.normal.z /= length;
+		plane.d /= length;
+
+		ret.planes[i] = plane;
+	}
+
+	return ret;
+}
+
+// The box is outside as soon as its corner furthest along a plane normal is behind it
+bool cg_frustum_test_box(const struct cg_frustum *frustum, const struct cg_box box) {
+	for (size_t i = 0; i < CG_ARRAY_LEN(frustum->planes); i++) {
+		const struct cg_plane *plane = &frustum->planes[i];
+
+		struct cg_vec3f corner = {
+			plane->normal.x >= 0 ? box.max.x : box.min.x,
+			plane->normal.y >= 0 ? box.max.y : box.min.y,
+			plane->normal.z >= 0 ? box.max.z : box.min.z,
+		};
+
+		if (plane->normal.x * corner.x + plane->normal.y * corner.y +
+		    plane->normal.z * corner.z + plane->d < 0)
+			return false;
+	}
+
+	return true;
 }
 
 void cg_mat4f_rotation_to_angles(struct cg_mat4f matrix, float *pitch, float *yaw,  float *roll) {
@@ -0,0 +1,221 @@
+/*
+ * Copyright Arthur Grillo (c) 2024
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#include <string.h>
+
+#include <SDL2/SDL.h>
+
+#include <GL/glew.h>
+
+#include "cg_core.h"
+#include "cg_profile.h"
+#include "cg_util.h"
+
+// Enough frames in flight to never wait for a query result
+#define GPU_QUERY_RING_SIZE 4
+
+extern struct cg_contex cg_ctx;
+
+static struct {
+	Uint64 frame_start;
+	Uint64 last_frame_start;
+
+	unsigned int gpu_queries[GPU_QUERY_RING_SIZE];
+	size_t gpu_queries_issued;
+	size_t gpu_queries_read;
+	bool gpu_query_active;
+	double gpu_time;
+
+	Uint64 timer_starts[CG_PROFILE_MAX_TIMERS];
+
+	struct cg_frame_stats last;
+
+	size_t summary_interval;
+	size_t summary_frames;
+	// sum of the stats of the frames since the last summary
+	struct cg_frame_stats summary;
+} profile;
+
+static double ticks_to_ms(Uint64 ticks) {
+	return ticks * 1000.0 / SDL_GetPerformanceFrequency();
+}
+
+static void gpu_query_begin(void) {
+	if (profile.gpu_queries[0] == 0) {
+		glGenQueries(GPU_QUERY_RING_SIZE, profile.gpu_queries);
+		cg_assert_gl();
+	}
+
+	// Every query is still in flight, skip this frame instead of stalling
+	if (profile.gpu_queries_issued - profile.gpu_queries_read == GPU_QUERY_RING_SIZE) {
+		profile.gpu_query_active = false;
+		return;
+	}
+
+	unsigned int query = profile.gpu_queries[profile.gpu_queries_issued % GPU_QUERY_RING_SIZE];
+	glBeginQuery(GL_TIME_ELAPSED, query);
+	cg_assert_gl();
+	profile.gpu_query_active = true;
+}
+
+static void gpu_query_end(void) {
+	if (profile.gpu_query_active) {
+		glEndQuery(GL_TIME_ELAPSED);
+		cg_assert_gl();
+		profile.gpu_queries_issued++;
+		profile.gpu_query_active = false;
+	}
+
+	while (profile.gpu_queries_read < profile.gpu_queries_issued) {
+		unsigned int query = profile.gpu_queries[profile.gpu_queries_read % GPU_QUERY_RING_SIZE];
+
+		int available;
+		glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+		cg_assert_gl();
+		if (!available)
+			break;
+
+		GLuint64 elapsed;
+		glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+		cg_assert_gl();
+
+		profile.gpu_time = elapsed / 1e6;
+		profile.gpu_queries_read++;
+	}
+}
+
+static void summary_add(const struct cg_frame_stats *stats) {
+	struct cg_frame_stats *sum = &profile.summary;
+
+	sum->frame_time += stats->frame_time;
+	sum->cpu_time += stats->cpu_time;
+	sum->gpu_time += stats->gpu_time;
+
+	sum->draw_calls += stats->draw_calls;
+	sum->instances += stats->instances;
+	sum->triangles += stats->triangles;
+	sum->uniform_uploads += stats->uniform_uploads;
+	sum->binds += stats->binds;
+	sum->gl_calls_avoided += stats->gl_calls_avoided;
+	sum->visible += stats->visible;
+	sum->culled += stats->culled;
+
+	// the timers keep their index from frame to frame, new ones only ever go at the end
+	for (size_t i = 0; i < stats->num_timers; i++) {
+		sum->timers[i].name = stats->timers[i].name;
+		sum->timers[i].time += stats->timers[i].time;
+		sum->timers[i].calls += stats->timers[i].calls;
+	}
+	sum->num_timers = CG_MAX(sum->num_timers, stats->num_timers);
+
+	profile.summary_frames++;
+}
+
+static void summary_reset(void) {
+	profile.summary_frames = 0;
+	profile.summary = (struct cg_frame_stats){0};
+}
+
+// Averages per frame of everything since the last summary
+static void print_summary(void) {
+	struct cg_frame_stats *s = &profile.summary;
+	double n = profile.summary_frames;
+
+	cg_info("Frame stats averaged over %zu frames:\n", profile.summary_frames);
+	cg_info("\tframe: %.3f ms, cpu: %.3f ms, gpu: %.3f ms\n",
+		s->frame_time / n, s->cpu_time / n, s->gpu_time / n);
+	cg_info("\tdraw calls: %.1f, instances: %.1f, triangles: %.1f\n",
+		s->draw_calls / n, s->instances / n, s->triangles / n);
+	cg_info("\tuniform uploads: %.1f, binds: %.1f, gl calls avoided: %.1f\n",
+		s->uniform_uploads / n, s->binds / n, s->gl_calls_avoided / n);
+	cg_info("\tvisible: %.1f, culled: %.1f\n", s->visible / n, s->culled / n);
+
+	for (size_t i = 0; i < s->num_timers; i++) {
+		cg_info("\t%s: %.3f ms (%.1f calls)\n",
+			s->timers[i].name, s->timers[i].time / n, s->timers[i].calls / n);
+	}
+
+	summary_reset();
+}
+
+void cg_profile_frame_begin(void) {
+	struct cg_frame_stats *stats = &cg_ctx.frame_stats;
+
+	profile.last_frame_start = profile.frame_start;
+	profile.frame_start = SDL_GetPerformanceCounter();
+
+	// Keep the registered timers so they are reported in a stable order
+	size_t num_timers = stats->num_timers;
+	struct cg_profile_timer timers[CG_PROFILE_MAX_TIMERS];
+	memcpy(timers, stats->timers, sizeof(*timers) * num_timers);
+
+	*stats = (struct cg_frame_stats){0};
+
+	stats->num_timers = num_timers;
+	for (size_t i = 0; i < num_timers; i++)
+		stats->timers[i].name = timers[i].name;
+
+	gpu_query_begin();
+}
+
+void cg_profile_frame_end(void) {
+	struct cg_frame_stats *stats = &cg_ctx.frame_stats;
+
+	gpu_query_end();
+
+	stats->cpu_time = ticks_to_ms(SDL_GetPerformanceCounter() - profile.frame_start);
+	stats->gpu_time = profile.gpu_time;
+	if (profile.last_frame_start != 0)
+		stats->frame_time = ticks_to_ms(profile.frame_start - profile.last_frame_start);
+
+	profile.last = *stats;
+
+	if (profile.summary_interval == 0)
+		return;
+
+	summary_add(stats);
+
+	if (profile.summary_frames == profile.summary_interval)
+		print_summary();
+}
+
+struct cg_frame_stats cg_frame_stats(void) {
+	return profile.last;
+}
+
+void cg_profile_set_summary_interval(size_t n) {
+	profile.summary_interval = n;
+	summary_reset();
+}
+
+static size_t find_timer(const char *name) {
+	struct cg_frame_stats *stats = &cg_ctx.frame_stats;
+
+	for (size_t i = 0; i < stats->num_timers; i++) {
+		if (stats->timers[i].name == name || !strcmp(stats->timers[i].name, name))
+			return i;
+	}
+
+	cg_assert(stats->num_timers < CG_PROFILE_MAX_TIMERS);
+	stats->timers[stats->num_timers] = (struct cg_profile_timer){ .name = name };
+
+	return stats->num_timers++;
+}
+
+void cg_profile_timer_begin(const char *name) {
+	profile.timer_starts[find_timer(name)] = SDL_GetPerformanceCounter();
+}
+
+void cg_profile_timer_end(const char *name) {
+	Uint64 now = SDL_GetPerformanceCounter();
+	size_t i = find_timer(name);
+	struct cg_profile_timer *timer = &cg_ctx.frame_stats.timers[i];
+
+	timer->time += ticks_to_ms(now - profile.timer_starts[i]);
+	timer->calls++;
+}
@@ -0,0 +1,390 @@
+/*
+ * Copyright Arthur Grillo (c) 2024
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cg_bvh.h"
+#include "cg_core.h"
+#include "cg_gfx.h"
+#include "cg_math.h"
+#include "cg_profile.h"
+#include "cg_scene.h"
+#include "cg_util.h"
+
+// the position, rotation or scale of the node changed
+#define NODE_LOCAL_DIRTY (1 << 0)
+// the world matrix of the node needs to be recomputed
+#define NODE_WORLD_DIRTY (1 << 1)
+
+#define SCENE_INITIAL_CAPACITY 64
+
+extern struct cg_contex cg_ctx;
+
+#define scene_realloc(scene, array) \
+	((scene)->array = realloc((scene)->array, (scene)->capacity * sizeof(*(scene)->array)))
+
+static void scene_grow(struct cg_scene *scene) {
+	scene->capacity = scene->capacity == 0 ? SCENE_INITIAL_CAPACITY
+					       : scene->capacity * CG_DA_EXPAND_FACTOR;
+
+	scene_realloc(scene, parent);
+	scene_realloc(scene, position);
+	scene_realloc(scene, rotation);
+	scene_realloc(scene, scale);
+	scene_realloc(scene, local);
+	scene_realloc(scene, world);
+	scene_realloc(scene, flags);
+	scene_realloc(scene, model);
+	scene_realloc(scene, lod);
+}
+
+struct cg_scene cg_scene_create(void) {
+	return (struct cg_scene){0};
+}
+
+void cg_scene_destroy(struct cg_scene *scene) {
+	free(scene->parent);
+	free(scene->position);
+	free(scene->rotation);
+	free(scene->scale);
+	free(scene->local);
+	free(scene->world);
+	free(scene->flags);
+	free(scene->model);
+	free(scene->lod);
+
+	cg_bvh_destroy(&scene->bvh);
+	free(scene->bvh_nodes.items);
+	free(scene->bvh_boxes.items);
+
+	*scene = (struct cg_scene){0};
+}
+
+cg_scene_node cg_scene_add_node(struct cg_scene *scene, cg_scene_node parent,
+				struct cg_model *model) {
+	cg_assert(parent == CG_SCENE_NO_PARENT || parent < scene->len);
+
+	if (scene->len == scene->capacity)
+		scene_grow(scene);
+
+	cg_scene_node node = scene->len++;
+
+	scene->parent[node] = parent;
+	scene->position[node] = (struct cg_vec3f){0, 0, 0};
+	scene->rotation[node] = (struct cg_vec3f){0, 0, 0};
+	scene->scale[node] = (struct cg_vec3f){1, 1, 1};
+	scene->flags[node] = NODE_LOCAL_DIRTY;
+	scene->model[node] = model;
+	scene->lod[node] = 0;
+
+	scene->dirty = true;
+	if (model != NULL)
+		scene->bvh_stale = true;
+
+	return node;
+}
+
+static void node_mark_dirty(struct cg_scene *scene, cg_scene_node node) {
+	scene->flags[node] |= NODE_LOCAL_DIRTY;
+	scene->dirty = true;
+}
+
+void cg_scene_node_set_position(struct cg_scene *scene, cg_scene_node node,
+				struct cg_vec3f position) {
+	cg_assert(node < scene->len);
+
+	scene->position[node] = position;
+	node_mark_dirty(scene, node);
+}
+
+void cg_scene_node_set_rotation(struct cg_scene *scene, cg_scene_node node,
+				struct cg_vec3f rotation) {
+	cg_assert(node < scene->len);
+
+	scene->rotation[node] = rotation;
+	node_mark_dirty(scene, node);
+}
+
+void cg_scene_node_set_scale(struct cg_scene *scene, cg_scene_node node,
+			     struct cg_vec3f scale) {
+	cg_assert(node < scene->len);
+
+	scene->scale[node] = scale;
+	node_mark_dirty(scene, node);
+}
+
+void cg_scene_node_set_model(struct cg_scene *scene, cg_scene_node node,
+			     struct cg_model *model) {
+	cg_assert(node < scene->len);
+
+	scene->model[node] = model;
+
+	scene->dirty = true;
+	scene->bvh_stale = true;
+}
+
+// World bounding boxes of the nodes in the BVH, in primitive order
+static const struct cg_box *scene_bvh_boxes(struct cg_scene *scene) {
+	for (size_t i = 0; i < scene->bvh_nodes.len; i++) {
+		cg_scene_node node = scene->bvh_nodes.items[i];
+
+		scene->bvh_boxes.items[i] = cg_box_transform(scene->model[node]->bounding_box,
+							     &scene->world[node]);
+	}
+
+	return scene->bvh_boxes.items;
+}
+
+static void scene_rebuild_bvh(struct cg_scene *scene) {
+	scene->bvh_nodes.len = 0;
+	for (size_t i = 0; i < scene->len; i++) {
+		if (scene->model[i] != NULL)
+			cg_da_append(&scene->bvh_nodes, i);
+	}
+
+	scene->bvh_boxes.len = 0;
+	for (size_t i = 0; i < scene->bvh_nodes.len; i++)
+		cg_da_append(&scene->bvh_boxes, (struct cg_box){0});
+
+	cg_bvh_destroy(&scene->bvh);
+	scene->bvh = cg_bvh_build(scene_bvh_boxes(scene), scene->bvh_nodes.len);
+
+	scene->bvh_stale = false;
+}
+
+/*
+ * The first pass rebuilds the local matrices that changed and pushes the world dirty flag
+ * down to the children, which is enough since parents come first. The second pass then
+ * recomputes the dirty world matrices, batching runs of siblings that share a parent into a
+ * single cg_mat4f_multiply_n call.
+ */
+void cg_scene_update(struct cg_scene *scene) {
+	if (!scene->dirty)
+		return;
+
+	CG_PROFILE_SCOPE("scene update");
+
+	uint8_t *flags = scene->flags;
+	const cg_scene_node *parent = scene->parent;
+
+	for (size_t i = 0; i < scene->len; i++) {
+		if (parent[i] != CG_SCENE_NO_PARENT && flags[parent[i]] & NODE_WORLD_DIRTY)
+			flags[i] |= NODE_WORLD_DIRTY;
+
+		if (flags[i] & NODE_LOCAL_DIRTY) {
+			scene->local[i] = cg_mat4f_model(scene->position[i], scene->scale[i],
+							 scene->rotation[i]);
+			flags[i] = NODE_WORLD_DIRTY;
+		}
+	}
+
+	bool models_moved = false;
+
+	for (size_t i = 0; i < scene->len;) {
+		if (!(flags[i] & NODE_WORLD_DIRTY)) {
+			i++;
+			continue;
+		}
+
+		models_moved |= scene->model[i] != NULL;
+
+		size_t run_end = i + 1;
+		while (run_end < scene->len && parent[run_end] == parent[i] &&
+		       flags[run_end] & NODE_WORLD_DIRTY) {
+			models_moved |= scene->model[run_end] != NULL;
+			run_end++;
+		}
+
+		if (parent[i] == CG_SCENE_NO_PARENT)
+			memcpy(&scene->world[i], &scene->local[i],
+			       (run_end - i) * sizeof(*scene->world));
+		else
+			cg_mat4f_multiply_n(&scene->world[i], &scene->local[i],
+					    &scene->world[parent[i]], run_end - i);
+
+		memset(&flags[i], 0, run_end - i);
+		i = run_end;
+	}
+
+	scene->dirty = false;
+
+	if (!scene->bvh_enabled)
+		return;
+
+	if (scene->bvh_stale)
+		scene_rebuild_bvh(scene);
+	else if (models_moved)
+		cg_bvh_refit(&scene->bvh, scene_bvh_boxes(scene));
+}
+
+const struct cg_mat4f *cg_scene_node_world_matrix(struct cg_scene *scene, cg_scene_node node) {
+	cg_assert(node < scene->len);
+
+	cg_scene_update(scene);
+
+	return &scene->world[node];
+}
+
+void cg_scene_build_bvh(struct cg_scene *scene) {
+	scene->bvh_enabled = true;
+	scene->bvh_stale = true;
+	scene->dirty = true;
+
+	cg_scene_update(scene);
+}
+
+static void draw_node(struct cg_scene *scene, cg_scene_node node) {
+	struct cg_model *model = scene->model[node];
+	const struct cg_mat4f *world = &scene->world[node];
+
+	scene->lod[node] = cg_model_select_lod(model, world, scene->lod[node]);
+	cg_model_draw_lod(model, world, scene->lod[node]);
+}
+
+static void draw_bvh_node(size_t prim, void *user_data) {
+	struct cg_scene *scene = user_data;
+
+	draw_node(scene, scene->bvh_nodes.items[prim]);
+	cg_ctx.frame_stats.visible++;
+}
+
+void cg_scene_draw(struct cg_scene *scene) {
+	cg_scene_update(scene);
+
+	if (scene->bvh_enabled && cg_get_frustum_culling()) {
+		size_t visible = cg_ctx.frame_stats.visible;
+
+		cg_bvh_query_frustum(&scene->bvh, cg_view_frustum(), draw_bvh_node, scene);
+
+		visible = cg_ctx.frame_stats.visible - visible;
+		cg_ctx.frame_stats.culled += scene->bvh_nodes.len - visible;
+		return;
+	}
+
+	for (size_t i = 0; i < scene->len; i++) {
+		if (scene->model[i] && cg_model_is_visible(scene->model[i], &scene->world[i]))
+			draw_node(scene, i);
+	}
+}
+
+struct ray_cast {
+	struct cg_scene *scene;
+	struct cg_ray_hit hit;
+};
+
+// Tests the meshes of a node with the ray moved into the model's space, where t is the same
+static float node_intersect(cg_scene_node node, const struct cg_ray *ray, float t_max,
+			    struct ray_cast *cast) {
+	struct cg_model *model = cast->scene->model[node];
+
+	struct cg_mat4f inverse;
+	if (!cg_mat4f_inverse(&inverse, &cast->scene->world[node]))
+		return INFINITY;
+
+	struct cg_ray local = cg_ray_transform(*ray, &inverse);
+	float ret = INFINITY;
+
+	for (size_t i = 0; i < model->num_meshes; i++) {
+		float t;
+		size_t triangle;
+
+		if (!cg_mesh_ray_cast(&model->meshes[i], &local, t_max, &t, &triangle))
+			continue;
+
+		t_max = t;
+		ret = t;
+		cast->hit = (struct cg_ray_hit) {
+			.t = t,
+			.node = node,
+			.model = model,
+			.mesh = i,
+			.triangle = triangle,
+		};
+	}
+
+	return ret;
+}
+
+static float bvh_node_intersect(size_t prim, const struct cg_ray *ray, float t_max,
+				void *user_data) {
+	struct ray_cast *cast = user_data;
+
+	return node_intersect(cast->scene->bvh_nodes.items[prim], ray, t_max, cast);
+}
+
+bool cg_ray_cast(struct cg_scene *scene, const struct cg_ray ray, struct cg_ray_hit *hit) {
+	cg_scene_update(scene);
+
+	struct ray_cast cast = {.scene = scene};
+	float t = INFINITY;
+	bool found = false;
+
+	if (scene->bvh_enabled) {
+		found = cg_bvh_ray_cast(&scene->bvh, &ray, INFINITY, bvh_node_intersect, &cast,
+					&t) != SIZE_MAX;
+	} else {
+		for (size_t i = 0; i < scene->len; i++) {
+			if (scene->model[i] == NULL)
+				continue;
+
+			float node_t = node_intersect(i, &ray, t, &cast);
+			if (node_t < t) {
+				t = node_t;
+				found = true;
+			}
+		}
+	}
+
+	if (!found)
+		return false;
+
+	if (hit != NULL) {
+		*hit = cast.hit;
+		hit->point = cg_vec3f_add(ray.origin, cg_vec3f_mul(ray.dir, (struct cg_vec3f){t, t, t}));
+	}
+
+	return true;
+}
+
+struct box_query {
+	struct cg_scene *scene;
+	cg_bvh_visit_callback_t visit;
+	void *user_data;
+};
+
+static void visit_bvh_node(size_t prim, void *user_data) {
+	struct box_query *query = user_data;
+
+	query->visit(query->scene->bvh_nodes.items[prim], query->user_data);
+}
+
+void cg_scene_query_box(struct cg_scene *scene, const struct cg_box box,
+			cg_bvh_visit_callback_t visit, void *user_data) {
+	cg_scene_update(scene);
+
+	if (scene->bvh_enabled) {
+		struct box_query query = {scene, visit, user_data};
+		cg_bvh_query_box(&scene->bvh, box, visit_bvh_node, &query);
+		return;
+	}
+
+	for (size_t i = 0; i < scene->len; i++) {
+		if (scene->model[i] == NULL)
+			continue;
+
+		struct cg_box node_box = cg_box_transform(scene->model[i]->bounding_box,
+							  &scene->world[i]);
+
+		if (node_box.min.x <= box.max.x && node_box.max.x >= box.min.x &&
+		    node_box.min.y <= box.max.y && node_box.max.y >= box.min.y &&
+		    node_box.min.z <= box.max.z && node_box.max.z >= box.min.z)
+			visit(i, user_data);
+	}
+}
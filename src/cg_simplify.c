@@ -0,0 +1,407 @@
+/*
+ * Copyright Arthur Grillo (c) 2024
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cg_math.h"
+#include "cg_simplify.h"
+#include "cg_util.h"
+
+// Symmetric 4x4 matrix: xx, xy, xz, xw, yy, yz, yw, zz, zw, ww
+struct quadric {
+	double q[10];
+};
+
+struct edge {
+	uint64_t key;
+	// collapse from into to, which keeps its position
+	int from, to;
+	double cost;
+};
+
+static uint64_t edge_key(int a, int b) {
+	uint32_t lo = CG_MIN(a, b);
+	uint32_t hi = CG_MAX(a, b);
+
+	return (uint64_t)hi << 32 | lo;
+}
+
+static int compare_edge_key(const void *a, const void *b) {
+	uint64_t ka = ((const struct edge *)a)->key;
+	uint64_t kb = ((const struct edge *)b)->key;
+
+	return (ka > kb) - (ka < kb);
+}
+
+static int compare_edge_cost(const void *a, const void *b) {
+	double ca = ((const struct edge *)a)->cost;
+	double cb = ((const struct edge *)b)->cost;
+
+	return (ca > cb) - (ca < cb);
+}
+
+static struct cg_vec3f vert_pos(const float *verts, int v) {
+	return cg_vec3f_from_array(&verts[v * 3]);
+}
+
+static void quadric_add_plane(struct quadric *q, double a, double b, double c, double d) {
+	q->q[0] += a * a;
+	q->q[1] += a * b;
+	q->q[2] += a * c;
+	q->q[3] += a * d;
+	q->q[4] += b * b;
+	q->q[5] += b * c;
+	q->q[6] += b * d;
+	q->q[7] += c * c;
+	q->q[8] += c * d;
+	q->q[9] += d * d;
+}
+
+// Sum of the squared distances of p to the planes accumulated in a and b
+static double quadric_error(const struct quadric *a, const struct quadric *b,
+			    const struct cg_vec3f p) {
+	double q[10];
+	for (size_t i = 0; i < 10; i++)
+		q[i] = a->q[i] + b->q[i];
+
+	double x = p.x, y = p.y, z = p.z;
+
+	double err = q[0] * x * x + 2 * q[1] * x * y + 2 * q[2] * x * z + 2 * q[3] * x +
+		     q[4] * y * y + 2 * q[5] * y * z + 2 * q[6] * y +
+		     q[7] * z * z + 2 * q[8] * z +
+		     q[9];
+
+	return fabs(err);
+}
+
+static const float *sort_verts;
+
+static int compare_position(const void *a, const void *b) {
+	return memcmp(&sort_verts[*(const int *)a * 3], &sort_verts[*(const int *)b * 3],
+		      3 * sizeof(*sort_verts));
+}
+
+/*
+ * Representative of every vertex among the ones sharing its exact position, the
+ * simplification works on those so attribute seams do not split the surface.
+ */
+static int *position_representatives(const float *verts, size_t num_verts) {
+	int *order = malloc(num_verts * sizeof(*order));
+	int *rep = malloc(num_verts * sizeof(*rep));
+	cg_assert(order != NULL && rep != NULL);
+
+	for (size_t v = 0; v < num_verts; v++)
+		order[v] = v;
+
+	sort_verts = verts;
+	qsort(order, num_verts, sizeof(*order), compare_position);
+
+	for (size_t i = 0; i < num_verts; i++) {
+		bool same = i > 0 && compare_position(&order[i], &order[i - 1]) == 0;
+		rep[order[i]] = same ? rep[order[i - 1]] : order[i];
+	}
+
+	free(order);
+
+	return rep;
+}
+
+static void build_adjacency(size_t *offsets, size_t *adjacency, const int *indices,
+			    size_t num_indices, size_t num_verts) {
+	memset(offsets, 0, (num_verts + 1) * sizeof(*offsets));
+	for (size_t i = 0; i < num_indices; i++)
+		offsets[indices[i] + 1]++;
+	for (size_t v = 0; v < num_verts; v++)
+		offsets[v + 1] += offsets[v];
+	for (size_t i = 0; i < num_indices; i++)
+		adjacency[offsets[indices[i]]++] = i / 3;
+	// filling advanced every offset to the start of the next vertex, move them back
+	for (size_t v = num_verts; v > 0; v--)
+		offsets[v] = offsets[v - 1];
+	offsets[0] = 0;
+}
+
+/*
+ * Vertex with the position of rep to replace the corner v that was collapsed into it,
+ * preferring one used next to v so the attributes stay on the same side of any seam.
+ */
+static int pick_twin(const int *indices, const size_t *offsets, const size_t *adjacency,
+		     const int *reps, int v, int rep) {
+	for (size_t i = offsets[v]; i < offsets[v + 1]; i++) {
+		const int *tri = &indices[adjacency[i] * 3];
+
+		for (size_t k = 0; k < 3; k++) {
+			if (reps[tri[k]] == rep)
+				return tri[k];
+		}
+	}
+
+	return rep;
+}
+
+static struct cg_vec3f triangle_normal(const struct cg_vec3f a, const struct cg_vec3f b,
+				       const struct cg_vec3f c) {
+	return cg_vec3f_cross(cg_vec3f_sub(b, a), cg_vec3f_sub(c, a));
+}
+
+/*
+ * Every undirected edge of the triangles, each appearing once per triangle using it, sorted
+ * by key so that duplicates are next to each other.
+ */
+static size_t collect_edges(struct edge *edges, const int *indices, size_t num_indices) {
+	size_t len = 0;
+
+	for (size_t i = 0; i < num_indices; i += 3) {
+		for (size_t e = 0; e < 3; e++) {
+			int a = indices[i + e];
+			int b = indices[i + (e + 1) % 3];
+
+			edges[len++] = (struct edge){.key = edge_key(a, b), .from = a, .to = b};
+		}
+	}
+
+	qsort(edges, len, sizeof(*edges), compare_edge_key);
+
+	return len;
+}
+
+/*
+ * Collapsing from into to moves every triangle around from, the collapse is rejected when
+ * one of the triangles that survive it would flip.
+ */
+static bool collapse_flips(const int *indices, const size_t *adjacency_offsets,
+			   const size_t *adjacency, const float *verts, int from, int to) {
+	for (size_t i = adjacency_offsets[from]; i < adjacency_offsets[from + 1]; i++) {
+		const int *tri = &indices[adjacency[i] * 3];
+
+		if (tri[0] == to || tri[1] == to || tri[2] == to)
+			continue;
+
+		struct cg_vec3f before[3], after[3];
+		for (size_t k = 0; k < 3; k++) {
+			before[k] = vert_pos(verts, tri[k]);
+			after[k] = vert_pos(verts, tri[k] == from ? to : tri[k]);
+		}
+
+		struct cg_vec3f n0 = triangle_normal(before[0], before[1], before[2]);
+		struct cg_vec3f n1 = triangle_normal(after[0], after[1], after[2]);
+
+		if (cg_vec3f_dot(n0, n1) <= 0)
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * Each pass sorts the edges of the current triangles by collapse cost and collapses the
+ * cheapest ones whose neighborhoods do not overlap, so costs and flip checks stay valid
+ * within a pass. Passes repeat until the target is met or nothing can be collapsed.
+ */
+size_t cg_simplify(int *dst, const int *indices, size_t num_indices,
+		   const float *verts, size_t num_verts,
+		   size_t target_num_indices, float *error) {
+	cg_assert(num_indices % 3 == 0);
+
+	// dst may alias indices
+	int *original = malloc(num_indices * sizeof(*original));
+	int *work = malloc(num_indices * sizeof(*work));
+	int *reps = position_representatives(verts, num_verts);
+	int *collapsed_into = malloc(num_verts * sizeof(*collapsed_into));
+	struct quadric *quadrics = calloc(num_verts, sizeof(*quadrics));
+	bool *locked = calloc(num_verts, sizeof(*locked));
+	bool *touched = malloc(num_verts * sizeof(*touched));
+	int *collapse = malloc(num_verts * sizeof(*collapse));
+	size_t *adjacency_offsets = malloc((num_verts + 1) * sizeof(*adjacency_offsets));
+	size_t *adjacency = malloc(num_indices * sizeof(*adjacency));
+	struct edge *edges = malloc(num_indices * sizeof(*edges));
+	cg_assert(original && work && collapsed_into && quadrics && locked && touched &&
+		  collapse && adjacency_offsets && adjacency && edges);
+
+	memcpy(original, indices, num_indices * sizeof(*original));
+
+	size_t num_work = num_indices;
+	for (size_t i = 0; i < num_indices; i++)
+		work[i] = reps[original[i]];
+
+	for (size_t v = 0; v < num_verts; v++)
+		collapsed_into[v] = v;
+
+	for (size_t i = 0; i < num_work; i += 3) {
+		struct cg_vec3f a = vert_pos(verts, work[i]);
+		struct cg_vec3f b = vert_pos(verts, work[i + 1]);
+		struct cg_vec3f c = vert_pos(verts, work[i + 2]);
+
+		struct cg_vec3f n = triangle_normal(a, b, c);
+		double length = sqrt(cg_vec3f_dot(n, n));
+		if (length == 0)
+			continue;
+
+		double nx = n.x / length, ny = n.y / length, nz = n.z / length;
+		double d = -(nx * a.x + ny * a.y + nz * a.z);
+
+		for (size_t k = 0; k < 3; k++)
+			quadric_add_plane(&quadrics[work[i + k]], nx, ny, nz, d);
+	}
+
+	// edges used by a single triangle are open borders, more than two is non manifold
+	size_t num_edges = collect_edges(edges, work, num_work);
+	for (size_t i = 0; i < num_edges;) {
+		size_t j = i + 1;
+		while (j < num_edges && edges[j].key == edges[i].key)
+			j++;
+
+		if (j - i != 2) {
+			locked[edges[i].from] = true;
+			locked[edges[i].to] = true;
+		}
+
+		i = j;
+	}
+
+	double max_cost = 0;
+
+	while (num_work > target_num_indices) {
+		build_adjacency(adjacency_offsets, adjacency, work, num_work, num_verts);
+
+		num_edges = collect_edges(edges, work, num_work);
+
+		// keep one entry per edge, in the cheapest direction that moves an unlocked vertex
+		size_t num_candidates = 0;
+		for (size_t i = 0; i < num_edges; i++) {
+			if (i > 0 && edges[i].key == edges[i - 1].key)
+				continue;
+
+			int a = edges[i].from;
+			int b = edges[i].to;
+
+			double cost_ab = locked[a] ? INFINITY
+						   : quadric_error(&quadrics[a], &quadrics[b],
+								   vert_pos(verts, b));
+			double cost_ba = locked[b] ? INFINITY
+						   : quadric_error(&quadrics[a], &quadrics[b],
+								   vert_pos(verts, a));
+
+			if (cost_ab == INFINITY && cost_ba == INFINITY)
+				continue;
+
+			edges[num_candidates++] = cost_ab <= cost_ba
+				? (struct edge){.from = a, .to = b, .cost = cost_ab}
+				: (struct edge){.from = b, .to = a, .cost = cost_ba};
+		}
+
+		qsort(edges, num_candidates, sizeof(*edges), compare_edge_cost);
+
+		memset(touched, 0, num_verts * sizeof(*touched));
+		for (size_t v = 0; v < num_verts; v++)
+			collapse[v] = v;
+
+		size_t removed_indices = 0;
+		for (size_t i = 0; i < num_candidates; i++) {
+			if (num_work - removed_indices <= target_num_indices)
+				break;
+
+			int from = edges[i].from;
+			int to = edges[i].to;
+
+			if (touched[from] || touched[to])
+				continue;
+
+			if (collapse_flips(work, adjacency_offsets, adjacency, verts, from, to))
+				continue;
+
+			collapse[from] = to;
+			collapsed_into[from] = to;
+			for (size_t k = 0; k < 10; k++)
+				quadrics[to].q[k] += quadrics[from].q[k];
+
+			max_cost = fmax(max_cost, edges[i].cost);
+
+			// the triangles around from change, freeze them until the next pass
+			for (size_t j = adjacency_offsets[from]; j < adjacency_offsets[from + 1]; j++) {
+				const int *tri = &work[adjacency[j] * 3];
+
+				if (tri[0] == to || tri[1] == to || tri[2] == to)
+					removed_indices += 3;
+
+				touched[tri[0]] = touched[tri[1]] = touched[tri[2]] = true;
+			}
+		}
+
+		if (removed_indices == 0)
+			break;
+
+		size_t len = 0;
+		for (size_t i = 0; i < num_work; i += 3) {
+			int a = collapse[work[i]];
+			int b = collapse[work[i + 1]];
+			int c = collapse[work[i + 2]];
+
+			if (a == b || b == c || c == a)
+				continue;
+
+			work[len++] = a;
+			work[len++] = b;
+			work[len++] = c;
+		}
+		num_work = len;
+	}
+
+	// follow every chain of collapses to the vertex that was finally kept
+	for (size_t v = 0; v < num_verts; v++) {
+		int kept = v;
+		while (collapsed_into[kept] != kept)
+			kept = collapsed_into[kept];
+		collapsed_into[v] = kept;
+	}
+
+	/*
+	 * The surviving triangles are the original ones that did not degenerate, emitted with
+	 * their own vertices wherever those did not move.
+	 */
+	build_adjacency(adjacency_offsets, adjacency, original, num_indices, num_verts);
+
+	size_t len = 0;
+	for (size_t i = 0; i < num_indices; i += 3) {
+		int kept[3];
+		for (size_t k = 0; k < 3; k++)
+			kept[k] = collapsed_into[reps[original[i + k]]];
+
+		if (kept[0] == kept[1] || kept[1] == kept[2] || kept[2] == kept[0])
+			continue;
+
+		for (size_t k = 0; k < 3; k++) {
+			int v = original[i + k];
+
+			dst[len++] = kept[k] == reps[v]
+				? v
+				: pick_twin(original, adjacency_offsets, adjacency, reps, v, kept[k]);
+		}
+	}
+
+	if (error != NULL)
+		*error = sqrt(max_cost);
+
+	free(original);
+	free(work);
+	free(reps);
+	free(collapsed_into);
+	free(quadrics);
+	free(locked);
+	free(touched);
+	free(collapse);
+	free(adjacency_offsets);
+	free(adjacency);
+	free(edges);
+
+	return len;
+}
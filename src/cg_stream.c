@@ -0,0 +1,248 @@
+/*
+ * Copyright Arthur Grillo (c) 2024
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <GL/glew.h>
+
+#include "cg_stream.h"
+#include "cg_util.h"
+
+#define STREAM_FRAMES 3
+#define DEFAULT_STREAM_FRAME_SIZE (4 << 20)
+
+#define STREAM_PERSISTENT_FLAGS \
+	(GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT)
+
+// Buffer for a range that did not fit in the ring, the data is sent on commit
+struct stream_overflow {
+	unsigned int buffer;
+	void *data;
+};
+
+static struct {
+	unsigned int buffer;
+	bool persistent;
+	// the whole ring, mapped when persistent and a CPU copy of it otherwise
+	unsigned char *data;
+
+	size_t frame_size;
+	// asked for with cg_set_stream_frame_size, used when the ring is made again
+	size_t next_frame_size;
+
+	// part of the ring the frame allocates from, and the next free byte in it
+	size_t frame;
+	size_t head;
+	bool frame_started;
+	GLsync fences[STREAM_FRAMES];
+
+	struct CG_DA(struct stream_overflow) overflows;
+	size_t overflow_size;
+} stream = {
+	.next_frame_size = DEFAULT_STREAM_FRAME_SIZE,
+};
+
+void cg_set_stream_frame_size(size_t size) {
+	cg_assert(size > 0);
+
+	stream.next_frame_size = size;
+}
+
+static void stream_create(void) {
+	stream.frame_size = stream.next_frame_size;
+	stream.persistent = GLEW_ARB_buffer_storage;
+
+	size_t size = stream.frame_size * STREAM_FRAMES;
+
+	glGenBuffers(1, &stream.buffer);
+	cg_assert(stream.buffer > 0);
+
+	// GL_COPY_WRITE_BUFFER leaves the vertex, element and uniform bindings alone
+	glBindBuffer(GL_COPY_WRITE_BUFFER, stream.buffer);
+	cg_assert_gl();
+
+	if (stream.persistent) {
+		glBufferStorage(GL_COPY_WRITE_BUFFER, size, NULL, STREAM_PERSISTENT_FLAGS);
+		cg_assert_gl();
+
+		stream.data = glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, size,
+					       STREAM_PERSISTENT_FLAGS);
+		cg_assert_gl();
+		cg_assert(stream.data != NULL);
+	} else {
+		glBufferData(GL_COPY_WRITE_BUFFER, size, NULL, GL_STREAM_DRAW);
+		cg_assert_gl();
+
+		stream.data = malloc(size);
+		cg_assert(stream.data != NULL);
+	}
+
+	cg_info("Stream buffer of %zu bytes, %s\n", size,
+		stream.persistent ? "persistently mapped" : "unsynchronized maps");
+}
+
+// The GPU may still use it, deleting only leaves freeing the storage to the driver
+static void stream_destroy(void) {
+	for (size_t i = 0; i < STREAM_FRAMES; i++) {
+		if (stream.fences[i] != NULL)
+			glDeleteSync(stream.fences[i]);
+		stream.fences[i] = NULL;
+	}
+
+	if (!stream.persistent)
+		free(stream.data);
+
+	glDeleteBuffers(1, &stream.buffer);
+	cg_assert_gl();
+
+	stream.buffer = 0;
+	stream.data = NULL;
+	stream.frame = 0;
+}
+
+// Waits for the GPU to be done with the part of the ring the frame is about to write
+static void stream_begin_frame(void) {
+	if (stream.buffer == 0)
+		stream_create();
+
+	GLsync fence = stream.fences[stream.frame];
+	if (fence != NULL) {
+		while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, UINT64_MAX) ==
+		       GL_TIMEOUT_EXPIRED)
+			;
+		cg_assert_gl();
+
+		glDeleteSync(fence);
+		stream.fences[stream.frame] = NULL;
+	}
+
+	stream.head = 0;
+	stream.frame_started = true;
+}
+
+static struct cg_stream_range stream_alloc_overflow(size_t size) {
+	struct stream_overflow overflow = {
+		.data = malloc(CG_MAX(size, 1)),
+	};
+	cg_assert(overflow.data != NULL);
+
+	glGenBuffers(1, &overflow.buffer);
+	cg_assert(overflow.buffer > 0);
+
+	glBindBuffer(GL_COPY_WRITE_BUFFER, overflow.buffer);
+	cg_assert_gl();
+
+	glBufferData(GL_COPY_WRITE_BUFFER, size, NULL, GL_STREAM_DRAW);
+	cg_assert_gl();
+
+	cg_da_append(&stream.overflows, overflow);
+	stream.overflow_size += size;
+
+	return (struct cg_stream_range){
+		.data = overflow.data,
+		.buffer = overflow.buffer,
+		.size = size,
+	};
+}
+
+struct cg_stream_range cg_stream_alloc(size_t size, size_t alignment) {
+	cg_assert(alignment > 0);
+
+	if (!stream.frame_started)
+		stream_begin_frame();
+
+	size_t offset = (stream.head + alignment - 1) / alignment * alignment;
+
+	if (offset + size > stream.frame_size)
+		return stream_alloc_overflow(size);
+
+	stream.head = offset + size;
+	offset += stream.frame * stream.frame_size;
+
+	return (struct cg_stream_range){
+		.data = stream.data + offset,
+		.buffer = stream.buffer,
+		.offset = offset,
+		.size = size,
+	};
+}
+
+void cg_stream_commit(const struct cg_stream_range *range) {
+	// coherent, so it is already there
+	if (range->buffer == stream.buffer && stream.persistent)
+		return;
+
+	if (range->size == 0)
+		return;
+
+	glBindBuffer(GL_COPY_WRITE_BUFFER, range->buffer);
+	cg_assert_gl();
+
+	if (range->buffer != stream.buffer) {
+		glBufferSubData(GL_COPY_WRITE_BUFFER, 0, range->size, range->data);
+		cg_assert_gl();
+		return;
+	}
+
+	// the fences already keep the GPU off this part of the ring
+	void *dst = glMapBufferRange(GL_COPY_WRITE_BUFFER, range->offset, range->size,
+				     GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT |
+				     GL_MAP_INVALIDATE_RANGE_BIT);
+	cg_assert_gl();
+	cg_assert(dst != NULL);
+
+	memcpy(dst, range->data, range->size);
+
+	glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+	cg_assert_gl();
+}
+
+struct cg_stream_range cg_stream_upload(const void *data, size_t size, size_t alignment) {
+	struct cg_stream_range range = cg_stream_alloc(size, alignment);
+
+	memcpy(range.data, data, size);
+	cg_stream_commit(&range);
+
+	return range;
+}
+
+void cg_stream_end_frame(void) {
+	if (!stream.frame_started)
+		return;
+
+	stream.fences[stream.frame] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	cg_assert_gl();
+
+	stream.frame = (stream.frame + 1) % STREAM_FRAMES;
+	stream.frame_started = false;
+
+	for (size_t i = 0; i < stream.overflows.len; i++) {
+		glDeleteBuffers(1, &stream.overflows.items[i].buffer);
+		cg_assert_gl();
+		free(stream.overflows.items[i].data);
+	}
+	stream.overflows.len = 0;
+
+	if (stream.overflow_size > 0) {
+		size_t size = stream.frame_size;
+		while (size < stream.head + stream.overflow_size)
+			size *= 2;
+
+		cg_warn("Stream frame of %zu bytes was too small, growing to %zu\n",
+			stream.frame_size, size);
+
+		stream.next_frame_size = CG_MAX(stream.next_frame_size, size);
+		stream.overflow_size = 0;
+	}
+
+	if (stream.next_frame_size != stream.frame_size)
+		stream_destroy();
+}
@@ -0,0 +1,141 @@
+/*
+ * Copyright Arthur Grillo (c) 2024
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#include <stdbool.h>
+
+#include <SDL2/SDL.h>
+
+#include "cg_core.h"
+#include "cg_time.h"
+#include "cg_util.h"
+
+extern struct cg_contex cg_ctx;
+
+#define MAX_DELTA_TIME 0.25
+#define DEFAULT_MAX_STEPS 8
+
+// SDL_Delay oversleeps by up to a scheduler tick, the rest of the wait is spun
+#define LIMIT_SPIN_SECONDS 0.002
+
+static struct {
+	Uint64 start;
+	double frequency;
+
+	Uint64 last_frame_end;
+	double delta;
+
+	// performance counter ticks per frame and when the next frame may end, 0 if unlimited
+	Uint64 limit_period;
+	Uint64 limit_deadline;
+} timing;
+
+static void time_init(void) {
+	if (timing.start != 0)
+		return;
+
+	timing.start = SDL_GetPerformanceCounter();
+	timing.frequency = SDL_GetPerformanceFrequency();
+}
+
+double cg_time(void) {
+	time_init();
+
+	return (SDL_GetPerformanceCounter() - timing.start) / timing.frequency;
+}
+
+double cg_delta_time(void) {
+	return timing.delta;
+}
+
+enum cg_swap_interval cg_set_swap_interval(enum cg_swap_interval interval) {
+	if (cg_ctx.window.headless)
+		return CG_SWAP_IMMEDIATE;
+
+	if (SDL_GL_SetSwapInterval(interval) == 0)
+		return interval;
+
+	if (interval == CG_SWAP_ADAPTIVE) {
+		cg_warn("Adaptive vsync is not supported, using vsync\n");
+		return cg_set_swap_interval(CG_SWAP_VSYNC);
+	}
+
+	cg_warn("Could not set the swap interval to %d: %s\n", interval, SDL_GetError());
+
+	return SDL_GL_GetSwapInterval();
+}
+
+void cg_set_frame_limit(double fps) {
+	cg_assert(fps >= 0);
+	time_init();
+
+	timing.limit_period = fps > 0 ? timing.frequency / fps : 0;
+	timing.limit_deadline = 0;
+}
+
+static void frame_limit_wait(void) {
+	Uint64 now = SDL_GetPerformanceCounter();
+
+	// the first limited frame, or one so late that catching up would mean a burst of frames
+	if (timing.limit_deadline == 0 || now > timing.limit_deadline + timing.limit_period)
+		timing.limit_deadline = now;
+
+	if (now < timing.limit_deadline) {
+		double wait = (timing.limit_deadline - now) / timing.frequency;
+
+		if (wait > LIMIT_SPIN_SECONDS)
+			SDL_Delay((wait - LIMIT_SPIN_SECONDS) * 1000);
+
+		while (SDL_GetPerformanceCounter() < timing.limit_deadline)
+			;
+	}
+
+	timing.limit_deadline += timing.limit_period;
+}
+
+void cg_time_end_frame(void) {
+	time_init();
+
+	if (timing.limit_period != 0)
+		frame_limit_wait();
+
+	Uint64 now = SDL_GetPerformanceCounter();
+
+	if (timing.last_frame_end != 0) {
+		double delta = (now - timing.last_frame_end) / timing.frequency;
+		timing.delta = CG_MIN(delta, MAX_DELTA_TIME);
+	}
+
+	timing.last_frame_end = now;
+}
+
+struct cg_fixed_step cg_fixed_step_create(double step) {
+	cg_assert(step > 0);
+
+	return (struct cg_fixed_step) {
+		.step = step,
+		.max_steps = DEFAULT_MAX_STEPS,
+	};
+}
+
+size_t cg_fixed_step_advance(struct cg_fixed_step *fixed, double dt) {
+	fixed->accumulator += dt;
+
+	size_t steps = fixed->accumulator / fixed->step;
+	if (steps > fixed->max_steps) {
+		steps = fixed->max_steps;
+		fixed->accumulator = 0;
+	} else {
+		fixed->accumulator -= steps * fixed->step;
+	}
+
+	return steps;
+}
+
+float cg_fixed_step_alpha(const struct cg_fixed_step *fixed) {
+	return fixed->accumulator / fixed->step;
+}
@@ -44,3 +44,28 @@ bool cg_check_gl(void) {
 
 	return has_error;
 }
+
+static void GLAPIENTRY gl_debug_callback(GLenum source, GLenum type, GLuint id,
+					 GLenum severity, GLsizei length,
+					 const GLchar *message, const void *user_param) {
+	(void) source;
+	(void) id;
+	(void) user_param;
+
+	if (type == GL_DEBUG_TYPE_ERROR || severity == GL_DEBUG_SEVERITY_HIGH)
+		cg_error("gl_debug: %.*s\n", length, message);
+	else
+		cg_warn("gl_debug: %.*s\n", length, message);
+}
+
+void cg_install_gl_debug_callback(void) {
+	if (!GLEW_KHR_debug) {
+		cg_warn("GL_KHR_debug not supported, GL errors will not be reported\n");
+		return;
+	}
+
+	glEnable(GL_DEBUG_OUTPUT);
+	glDebugMessageCallback(gl_debug_callback, NULL);
+	glDebugMessageControl(GL_DONT_CARE, GL_DONT_CARE, GL_DEBUG_SEVERITY_NOTIFICATION,
+			      0, NULL, GL_FALSE);
+}
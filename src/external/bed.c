@@ -11,6 +11,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <string.h>
 
 #include <fcntl.h>
@@ -18,33 +19,91 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
+/*
+ * Files are found through a perfect hash: a name goes to the bucket of bed_hash(name, 0),
+ * and the seed of that bucket then gives its slot of metadata, which holds TABLE_SIZE
+ * entries. A compressed file has its stored_size set, it is held in the LZ4 block format.
+ */
 #define STRUCT_BED_FILE_DEFINE \
 struct bed_file { \
-	char *name; \
+	const char *name; \
 	size_t size; \
 	size_t offset; \
-	size_t mmap_offset; \
+	size_t stored_size; \
 };
 
-#define FUNC_BED_GET_DEFINE(prefix) \
-unsigned char* prefix##bed_get(char* file_name, size_t *size) { \
-	struct bed_file *f; \
-	bool found = false; \
-	for (int i = 0; i < NUM_FILES; i++) { \
-		if(!strcmp(metadata[i].name, file_name)) { \
-			found = true; \
-			f = &metadata[i]; \
+#define FUNC_BED_HASH_DEFINE \
+static uint32_t bed_hash(const char *name, uint32_t seed) { \
+	uint32_t hash = 2166136261u ^ seed * 16777619u; \
+	while (*name != 0) \
+		hash = (hash ^ (unsigned char)*name++) * 16777619u; \
+	return hash; \
+}
+
+#define FUNC_BED_LZ4_DECOMPRESS_DEFINE \
+static size_t bed_lz4_length(const unsigned char **src, size_t len) { \
+	if (len != 15) \
+		return len; \
+	unsigned char byte; \
+	do { \
+		byte = *(*src)++; \
+		len += byte; \
+	} while (byte == 255); \
+	return len; \
+} \
+ \
+static void bed_lz4_decompress(const unsigned char *src, size_t src_size, unsigned char *dst) { \
+	const unsigned char *end = src + src_size; \
+	while (src < end) { \
+		unsigned char token = *src++; \
+		size_t len = bed_lz4_length(&src, token >> 4); \
+		memcpy(dst, src, len); \
+		dst += len; \
+		src += len; \
+		if (src >= end) \
 			break; \
-		} \
+		size_t offset = src[0] | (size_t)src[1] << 8; \
+		src += 2; \
+		len = bed_lz4_length(&src, token & 15) + 4; \
+		const unsigned char *match = dst - offset; \
+		while (len-- > 0) \
+			*dst++ = *match++; \
 	} \
+}
+
+#define FUNC_BED_GET_DEFINE(prefix) \
+static _Atomic(unsigned char *) decompressed[TABLE_SIZE]; \
  \
-	if (found) { \
-		*size = f->size; \
-		return &resource[f->offset]; \
-	} else { \
+static unsigned char *bed_decompressed(struct bed_file *f) { \
+	_Atomic(unsigned char *) *slot = &decompressed[f - metadata]; \
+	unsigned char *data = atomic_load(slot); \
+	if (data != NULL) \
+		return data; \
+	data = aligned_alloc(ALIGNMENT, (f->size + ALIGNMENT) / ALIGNMENT * ALIGNMENT); \
+	if (data == NULL) \
+		return NULL; \
+	bed_lz4_decompress(&resource[f->offset], f->stored_size, data); \
+	unsigned char *expected = NULL; \
+	if (!atomic_compare_exchange_strong(slot, &expected, data)) { \
+		free(data); \
+		data = expected; \
+	} \
+	return data; \
+} \
+ \
+unsigned char* prefix##bed_get(const char* file_name, size_t *size) { \
+	uint32_t bucket = bed_hash(file_name, 0) & (TABLE_SIZE - 1); \
+	struct bed_file *f = &metadata[bed_hash(file_name, seeds[bucket]) & (TABLE_SIZE - 1)]; \
+ \
+	if (f->name == NULL || strcmp(f->name, file_name) != 0) { \
 		*size = 0; \
 		return NULL; \
 	} \
+ \
+	*size = f->size; \
+	if (f->stored_size == 0) \
+		return &resource[f->offset]; \
+	return bed_decompressed(f); \
 }
 
 #define COLUMNS 12
@@ -72,8 +131,10 @@ unsigned char* prefix##bed_get(char* file_name, size_t *size) { \
 } while (0)
 
 static void print_help(char *prg_name) {
-	printf("usage: %s [-p <prefix>] <file>...\n", prg_name);
+	printf("usage: %s [-p <prefix>] [-a <alignment>] [-z] <file>...\n", prg_name);
 	printf("Embed files into a C program by creating a .c file\n");
+	printf("  -a  align the data of every file to this power of two, 16 by default\n");
+	printf("  -z  compress the files that shrink enough, they are decompressed on first use\n");
 }
 
 static size_t get_file_size(char *file_name) {
@@ -103,10 +164,232 @@ static void __write_to_c(char *file_path, int line_num, const char *fmt, const c
 	printf("\t// %s:%d%s", file_path, line_num, end);
 }
 
+FUNC_BED_HASH_DEFINE
+FUNC_BED_LZ4_DECOMPRESS_DEFINE
+
+#define LZ4_HASH_LOG 16
+// the last match has to start this far from the end, and the last bytes are always literals
+#define LZ4_MF_LIMIT 12
+#define LZ4_LAST_LITERALS 5
+
+static size_t lz4_bound(size_t size) {
+	return size + size / 255 + 16;
+}
+
+static unsigned char *lz4_write_length(unsigned char *out, size_t len) {
+	for (; len >= 255; len -= 255)
+		*out++ = 255;
+	*out++ = len;
+
+	return out;
+}
+
+static unsigned char *lz4_write_sequence(unsigned char *out, const unsigned char *literals,
+					 size_t num_literals, size_t offset, size_t match_len) {
+	unsigned char *token = out++;
+	*token = (num_literals < 15 ? num_literals : 15) << 4;
+	if (num_literals >= 15)
+		out = lz4_write_length(out, num_literals - 15);
+
+	memcpy(out, literals, num_literals);
+	out += num_literals;
+
+	if (match_len == 0)
+		return out;
+
+	*out++ = offset & 0xff;
+	*out++ = offset >> 8;
+
+	match_len -= 4;
+	*token |= match_len < 15 ? match_len : 15;
+	if (match_len >= 15)
+		out = lz4_write_length(out, match_len - 15);
+
+	return out;
+}
+
+// Greedy LZ4 block compression into dst, which holds lz4_bound(size) bytes
+static size_t lz4_compress(const unsigned char *src, size_t size, unsigned char *dst) {
+	static uint32_t table[1 << LZ4_HASH_LOG];
+	memset(table, 0, sizeof(table));
+
+	unsigned char *out = dst;
+	size_t anchor = 0;
+
+	for (size_t i = 0; size > LZ4_MF_LIMIT && i <= size - LZ4_MF_LIMIT;) {
+		uint32_t seq;
+		memcpy(&seq, &src[i], sizeof(seq));
+
+		uint32_t *entry = &table[(seq * 2654435761u) >> (32 - LZ4_HASH_LOG)];
+		size_t candidate = *entry;
+		// positions are kept plus one, so 0 is an empty entry
+		*entry = i + 1;
+
+		if (candidate == 0 || i - (candidate - 1) > 0xffff ||
+		    memcmp(&src[candidate - 1], &src[i], sizeof(seq)) != 0) {
+			i++;
+			continue;
+		}
+		candidate--;
+
+		size_t len = sizeof(seq);
+		while (i + len < size - LZ4_LAST_LITERALS && src[candidate + len] == src[i + len])
+			len++;
+
+		out = lz4_write_sequence(out, &src[anchor], i - anchor, i - candidate, len);
+
+		i += len;
+		anchor = i;
+	}
+
+	out = lz4_write_sequence(out, &src[anchor], size - anchor, 0, 0);
+
+	return out - dst;
+}
+
 STRUCT_BED_FILE_DEFINE
 static DA_DEFINE(struct bed_file) metadata;
-static unsigned char *storage;
+static DA_DEFINE(unsigned char) blob;
 static char *prefix = NULL;
+static size_t alignment = 16;
+static bool compress = false;
+
+// a file is only kept compressed when that drops at least 1/MIN_SAVING of it
+#define MIN_SAVING 8
+
+static void blob_append(const void *data, size_t size) {
+	if (blob.len + size > blob.capacity) {
+		while (blob.len + size > blob.capacity)
+			blob.capacity = blob.capacity == 0 ? 4096 : blob.capacity * DA_EXPAND_FACTOR;
+
+		blob.items = realloc(blob.items, blob.capacity);
+		assert(blob.items != NULL);
+	}
+
+	if (data != NULL)
+		memcpy(blob.items + blob.len, data, size);
+	else
+		memset(blob.items + blob.len, 0, size);
+	blob.len += size;
+}
+
+// Appends the file to the blob at the next aligned offset, compressed when it is worth it
+static void embed_file(struct bed_file *f) {
+	blob_append(NULL, (alignment - blob.len % alignment) % alignment);
+	f->offset = blob.len;
+
+	if (f->size == 0)
+		return;
+
+	int fd = open(f->name, O_RDONLY);
+	assert(fd != -1);
+
+	unsigned char *data = mmap(NULL, f->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (data == MAP_FAILED) {
+		perror("mmap");
+		assert(0);
+	}
+
+	int ret = close(fd);
+	assert(ret != -1);
+
+	if (compress) {
+		unsigned char *packed = malloc(lz4_bound(f->size));
+		assert(packed != NULL);
+
+		size_t packed_size = lz4_compress(data, f->size, packed);
+
+		if (packed_size < f->size - f->size / MIN_SAVING) {
+			unsigned char *check = malloc(f->size);
+			assert(check != NULL);
+
+			bed_lz4_decompress(packed, packed_size, check);
+			assert(memcmp(check, data, f->size) == 0);
+			free(check);
+
+			f->stored_size = packed_size;
+			blob_append(packed, packed_size);
+		}
+
+		free(packed);
+	}
+
+	if (f->stored_size == 0)
+		blob_append(data, f->size);
+
+	munmap(data, f->size);
+}
+
+// seeds tried for a bucket before giving up on the table size
+#define MAX_SEED (1u << 20)
+
+/*
+ * Finds the seed of every bucket of a table_size perfect hash over the file names, going
+ * from the fullest bucket to the emptiest. slots is set to the file in each slot, or -1.
+ * Returns false when some bucket has no seed that fits, so a larger table is needed.
+ */
+static bool build_perfect_hash(size_t table_size, uint32_t *seeds, long *slots) {
+	size_t mask = table_size - 1;
+
+	size_t *bucket_len = calloc(table_size, sizeof(*bucket_len));
+	size_t *members = malloc(sizeof(*members) * metadata.len);
+	bool *done = calloc(table_size, sizeof(*done));
+	assert(bucket_len != NULL && members != NULL && done != NULL);
+
+	for (size_t i = 0; i < metadata.len; i++)
+		bucket_len[bed_hash(metadata.items[i].name, 0) & mask]++;
+
+	for (size_t i = 0; i < table_size; i++) {
+		seeds[i] = 0;
+		slots[i] = -1;
+	}
+
+	bool ok = true;
+	while (ok) {
+		size_t bucket = table_size;
+		for (size_t i = 0; i < table_size; i++) {
+			if (!done[i] && bucket_len[i] > 0 &&
+			    (bucket == table_size || bucket_len[i] > bucket_len[bucket]))
+				bucket = i;
+		}
+
+		if (bucket == table_size)
+			break;
+		done[bucket] = true;
+
+		size_t len = 0;
+		for (size_t i = 0; i < metadata.len; i++) {
+			if ((bed_hash(metadata.items[i].name, 0) & mask) == bucket)
+				members[len++] = i;
+		}
+
+		uint32_t seed;
+		for (seed = 1; seed < MAX_SEED; seed++) {
+			size_t placed = 0;
+			for (; placed < len; placed++) {
+				size_t slot = bed_hash(metadata.items[members[placed]].name, seed) & mask;
+				if (slots[slot] != -1)
+					break;
+				slots[slot] = members[placed];
+			}
+
+			if (placed == len)
+				break;
+
+			for (size_t i = 0; i < placed; i++)
+				slots[bed_hash(metadata.items[members[i]].name, seed) & mask] = -1;
+		}
+
+		seeds[bucket] = seed;
+		ok = seed < MAX_SEED;
+	}
+
+	free(done);
+	free(members);
+	free(bucket_len);
+
+	return ok;
+}
 
 int main(int argc, char *argv[]) {
 	if (argc == 1) {
@@ -116,17 +399,31 @@ int main(int argc, char *argv[]) {
 	}
 
 	int c;
-	while(c = getopt(argc, argv, "p:"), c != -1) {
+	while(c = getopt(argc, argv, "p:a:z"), c != -1) {
 		switch (c) {
 		case 'p':
 			prefix = optarg;
 			break;
+		case 'a':
+			alignment = strtoul(optarg, NULL, 0);
+			if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+				fprintf(stderr, "%s: alignment must be a power of two\n", argv[0]);
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'z':
+			compress = true;
+			break;
 		case '?':
 			switch (optopt) {
 			case 'p':
 				fprintf(stderr, "%s: missing prefix\n", argv[0]);
 				print_help(argv[0]);
 				exit(EXIT_FAILURE);
+			case 'a':
+				fprintf(stderr, "%s: missing alignment\n", argv[0]);
+				print_help(argv[0]);
+				exit(EXIT_FAILURE);
 			}
 		}
 	}
@@ -134,79 +431,96 @@ int main(int argc, char *argv[]) {
 	argv += optind;
 	argc -= optind;
 
-	size_t total_size = 0;
-	size_t virtual_total_size = 0;
 	for (int i = 0; i < argc; i++) {
+		for (int j = 0; j < i; j++) {
+			if (strcmp(argv[i], argv[j]) == 0) {
+				fprintf(stderr, "bed: %s is given twice\n", argv[i]);
+				exit(EXIT_FAILURE);
+			}
+		}
+
 		struct bed_file f = {
 			.name = argv[i],
 			.size = get_file_size(argv[i]),
-			.offset = i == 0 ? 0 : virtual_total_size,
-			.mmap_offset = i == 0 ? 0 : total_size,
 		};
 
-		size_t pg_size = getpagesize();
-		total_size += (f.size + pg_size) / pg_size * pg_size;
-		virtual_total_size += f.size;
-
+		embed_file(&f);
 		da_append(&metadata, f);
 	}
 
-	storage = aligned_alloc(getpagesize(), total_size);
-	assert(storage != NULL);
-
-	for (size_t i = 0; i < metadata.len; i++) {
-		struct bed_file *f = &metadata.items[i];
+	// an empty initializer is not valid C
+	if (blob.len == 0)
+		blob_append(NULL, 1);
 
-		if (f->size == 0)
-			continue;
+	size_t table_size = 1;
+	while (table_size < metadata.len)
+		table_size *= 2;
 
-		int fd = open(f->name, O_RDONLY);
-		assert(fd != -1);
+	uint32_t *seeds = NULL;
+	long *slots = NULL;
+	for (;; table_size *= 2) {
+		seeds = realloc(seeds, sizeof(*seeds) * table_size);
+		slots = realloc(slots, sizeof(*slots) * table_size);
+		assert(seeds != NULL && slots != NULL);
 
-		void* pa;
-		pa = mmap(storage + f->mmap_offset, f->size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0);
-		if (pa == MAP_FAILED) {
-			perror("mmap");
-			assert(0);
-		}
-
-		int ret = close(fd);
-		assert(ret != -1);
+		if (build_perfect_hash(table_size, seeds, slots))
+			break;
 	}
 
-	write_to_c("#include <stdbool.h>", "\n");
+	write_to_c("#include <stdatomic.h>", "\n");
+	write_to_c("#include <stdint.h>", "\n");
+	write_to_c("#include <stdlib.h>", "\n");
 	write_to_c("#include <string.h>", "\n");
+	write_to_c("#define TABLE_SIZE %zu", "\n", table_size);
+	write_to_c("#define ALIGNMENT %zu", "\n", alignment);
 	write_to_c(STRINGFY(STRUCT_BED_FILE_DEFINE), "\n");
-	write_to_c("static struct bed_file metadata[] = {", "\n\t");
-	for (size_t i = 0; i < metadata.len; i++) {
-		struct bed_file *f = &metadata.items[i];
-		write_to_c("{.name = \"%s\", .size = %zu, .offset = %zu},", "\n", f->name, f->size, f->offset);
-		if(i < metadata.len - 1) printf("\t");
+	write_to_c("static struct bed_file metadata[TABLE_SIZE] = {", "\n\t");
+	for (size_t i = 0; i < table_size; i++) {
+		if (slots[i] == -1) {
+			write_to_c("{0},", "\n");
+		} else {
+			struct bed_file *f = &metadata.items[slots[i]];
+			write_to_c("{.name = \"%s\", .size = %zu, .offset = %zu, .stored_size = %zu},",
+				   "\n", f->name, f->size, f->offset, f->stored_size);
+		}
+		if (i < table_size - 1) printf("\t");
 	}
 	write_to_c("};", "\n");
 
-	write_to_c("static unsigned char resource[] = {", "\n\t");
-	for (size_t i = 0; i < metadata.len; i++) {
-		struct bed_file *f = &metadata.items[i];
-		for (size_t j = 0; j < f->size; j++) {
-			printf("0x%02x,", storage[j + f->mmap_offset]);
-			if ((j + f->offset + 1) % COLUMNS == 0) {
-				write_to_c("","\n");
-				if(j + f->offset < virtual_total_size) printf("\t");
-			}
-			else {
-				printf(" ");
-			}
+	write_to_c("static const uint32_t seeds[TABLE_SIZE] = {", "\n\t");
+	for (size_t i = 0; i < table_size; i++) {
+		printf("%u,", seeds[i]);
+		if ((i + 1) % COLUMNS == 0 || i == table_size - 1) {
+			write_to_c("", "\n");
+			if (i < table_size - 1) printf("\t");
+		} else {
+			printf(" ");
 		}
 	}
+	write_to_c("};", "\n");
 
+	write_to_c("static _Alignas(ALIGNMENT) unsigned char resource[] = {", "\n\t");
+	for (size_t i = 0; i < blob.len; i++) {
+		printf("0x%02x,", blob.items[i]);
+		if ((i + 1) % COLUMNS == 0) {
+			write_to_c("", "\n");
+			if (i < blob.len - 1) printf("\t");
+		} else {
+			printf(" ");
+		}
+	}
 	write_to_c("};", "\n");
-	write_to_c("#define NUM_FILES %d", "\n", metadata.len);
+
+	write_to_c(STRINGFY(FUNC_BED_HASH_DEFINE), "\n");
+	write_to_c(STRINGFY(FUNC_BED_LZ4_DECOMPRESS_DEFINE), "\n");
 	if (prefix != NULL) {
 		write_to_c(STRINGFY(FUNC_BED_GET_DEFINE(%s_)), "\n", prefix);
 	} else {
 		write_to_c(STRINGFY(FUNC_BED_GET_DEFINE()), "\n");
 	}
 
+	free(slots);
+	free(seeds);
+
 	exit(EXIT_SUCCESS);
 }